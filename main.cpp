@@ -6,35 +6,60 @@
 
 #include <GLUT/glut.h>
 #include <OpenGL/gl.h>
+#ifdef __APPLE__
+#include <OpenGL/OpenGL.h>
+// the legacy (GL 2.1) context only exposes vertex array objects through APPLE_vertex_array_object
+#define glGenVertexArrays glGenVertexArraysAPPLE
+#define glBindVertexArray glBindVertexArrayAPPLE
+#define glDeleteVertexArrays glDeleteVertexArraysAPPLE
+#endif
 #include <cmath>
 #include <vector>
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <cstdarg>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <queue>
+#include <fstream>
+#include <memory>
+#include <functional>
+#include <sstream>
+#include "mesh.h"
+#include "render.h"
 
-// -------- Math helpers --------
-struct Vec3 { float x,y,z; Vec3():x(0),y(0),z(0){} Vec3(float X,float Y,float Z):x(X),y(Y),z(Z){} };
-static Vec3 operator+(const Vec3&a,const Vec3&b){return Vec3(a.x+b.x,a.y+b.y,a.z+b.z);}
-static Vec3 operator-(const Vec3&a,const Vec3&b){return Vec3(a.x-b.x,a.y-b.y,a.z-b.z);}
-static Vec3 operator*(const Vec3&a,float s){return Vec3(a.x*s,a.y*s,a.z*s);}
-static float len(const Vec3&a){return sqrtf(a.x*a.x+a.y*a.y+a.z*a.z);}
-static Vec3 normalize(const Vec3&a){float L=len(a); if(L<1e-6f) return Vec3(0,0,0); return Vec3(a.x/L,a.y/L,a.z/L);}
-static Vec3 cross(const Vec3&a,const Vec3&b){ return Vec3(a.y*b.z-a.z*b.y, a.z*b.x-a.x*b.z, a.x*b.y-a.y*b.x); }
+// The layout enums in mesh.h stand in for these GL types.
+static_assert(LAYOUT_FLOAT == GL_FLOAT && LAYOUT_SHORT == GL_SHORT && LAYOUT_UNSIGNED_SHORT == GL_UNSIGNED_SHORT &&
+              LAYOUT_UNSIGNED_INT == GL_UNSIGNED_INT, "VertexLayout component types must match GL");
 
 // -------- Mesh --------
-struct Vertex { Vec3 p; Vec3 n; };
-struct Tri { int a,b,c; Vec3 fn; };
-
-std::vector<Vertex> vertices;
-std::vector<Tri> triangles;
-Vec3 centroid(0,0,0);
-float modelScale = 1.0f;
+// The displayed mesh; loads build a separate MeshData (mesh.h) and MeshData::swap() installs it in one step. With a
+// cache load `vertices`/`triangles` stay empty and the data lives in `cache` (see ensureCPUMesh() in mesh.h).
+MeshData displayed;
 
 // -------- VBOs --------
-GLuint vboPos=0, vboNorm=0, ibo=0;
+GLuint vboPos=0, vboNorm=0, vboAo=0, ibo=0;   // interleaved layouts keep everything in vboPos; vboAo is empty without --ao
+GLuint meshVao=0;                    // attribute pointers + IBO for the shader paths
+// Attribute slots are fixed with glBindAttribLocation before linking, so one VAO serves both programs.
+// ATTRIB_AO/ATTRIB_SHADOW fall back to the constant 1 (unoccluded, lit) when a VAO has no array for them.
+enum { ATTRIB_POS = 0, ATTRIB_NORM = 1, ATTRIB_INST_C0 = 2, ATTRIB_INST_MATERIAL = 6, ATTRIB_AO = 7, ATTRIB_SHADOW = 8 };
 GLsizei triCount=0;
+size_t residentIndices=0;            // indices uploaded so far; below triCount*3 while a first load is streaming in
+unsigned meshGeneration=0;           // bumped whenever the displayed mesh's buffers are replaced
+VertexLayout vboLayout;
 bool buffersReady=false;
 
 // -------- Camera & UI state --------
@@ -46,82 +71,330 @@ bool autoRotateLight=false; // by default light does NOT move automatically (req
 float lightAngle=0.0f, lightRadius=1.2f, lightHeight=0.5f;
 
 int winW=900, winH=700;
+size_t trisDrawn = 0;   // triangles submitted by the last frame, for the HUD
+
+// -------- View parameters --------
+// Materials, lights, ViewParams and cameraMatrices() live in render.h.
+ViewParams currentViewParams(){
+    return { camAngle, camRadius, camHeight, perspectiveOn, shadeMode, materialIndex,
+             lightAngle, lightRadius, lightHeight, winW, winH };
+}
+Mat4 cameraProj = mat4Identity(), cameraView = mat4Identity();   // this frame's camera, set by setupCamera()
 
-// -------- Materials --------
-struct Material {
-    float ambient[4];
-    float diffuse[4];
-    float specular[4];
-    float shininess;
-    std::string name;
+// -------- LOD selection --------
+int activeLod = 0;
+float lodPixelError = 1.0f;             // coarsest LOD whose projected error stays under this many pixels
+static const float LOD_HYSTERESIS = 0.25f;
+// Picks the coarsest level whose projected geometric error is under lodPixelError, with hysteresis so the
+// level does not flicker at the threshold.
+int selectLod(const ViewParams &vp, int current){
+    if(displayed.lodLevels.size() <= 1) return 0;
+    float pxPerUnit;
+    if(vp.perspective){
+        float dist = std::max(0.1f, sqrtf(vp.camRadius*vp.camRadius + vp.camHeight*vp.camHeight) - 1.0f);   // model radius is 1
+        pxPerUnit = vp.height / (2.0f * dist * tanf(30.0f * 3.14159265f / 180.0f));
+    } else pxPerUnit = vp.height / (2.0f * 1.8f);
+    auto errPx = [&](int l){ return displayed.lodLevels[l].error * displayed.modelScale * pxPerUnit; };
+    int l = std::max(0, std::min(current, (int)displayed.lodLevels.size()-1));
+    while(l > 0 && errPx(l) > lodPixelError) --l;
+    while(l+1 < (int)displayed.lodLevels.size() && errPx(l+1) <= lodPixelError * (1.0f - LOD_HYSTERESIS)) ++l;
+    return l;
+}
+
+// Meshlet bounds transposed into 4-wide SoA blocks; padding lanes carry a huge negative radius so they always cull.
+struct MeshletCullData {
+    std::vector<float> cx, cy, cz, r, ax, ay, az, cut;
+    size_t count = 0;
+    void build(const std::vector<Meshlet> &ml){
+        count = ml.size();
+        size_t n = (count + 3) & ~(size_t)3;
+        for(auto *v : { &cx, &cy, &cz, &ax, &ay, &az, &cut }) v->assign(n, 0.0f);
+        r.assign(n, -1e30f);
+        for(size_t i=0;i<count;++i){
+            cx[i] = ml[i].center[0]; cy[i] = ml[i].center[1]; cz[i] = ml[i].center[2]; r[i] = ml[i].radius;
+            ax[i] = ml[i].axis[0]; ay[i] = ml[i].axis[1]; az[i] = ml[i].axis[2]; cut[i] = ml[i].cutoff;
+        }
+    }
 };
-std::vector<Material> materials;
-
-void initMaterials(){
-    materials.clear();
-    // White shiny
-    materials.push_back({ {0.25f,0.25f,0.25f,1.0f}, {0.8f,0.8f,0.8f,1.0f}, {1.0f,1.0f,1.0f,1.0f}, 120.0f, "White Shiny" });
-    // Gold (different shading properties)
-    materials.push_back({ {0.24725f,0.1995f,0.0745f,1.0f}, {0.75164f,0.60648f,0.22648f,1.0f}, {0.628281f,0.555802f,0.366065f,1.0f}, 51.2f, "Gold" });
-    // Required red high-specular material (matches assignment)
-    materials.push_back({ {0.6f,0.2f,0.2f,1.0f}, {0.9f,0.1f,0.1f,1.0f}, {0.8f,0.8f,0.8f,1.0f}, 80.0f, "Red Bright Spec" });
-}
-
-// -------- SMF loader & normal averaging --------
-bool loadSMF(const std::string &path){
-    std::ifstream fin(path);
-    if(!fin.is_open()){ std::cerr << "Cannot open " << path << "\n"; return false; }
-    std::vector<Vec3> pts;
-    std::string line;
-    while(std::getline(fin, line)){
-        std::stringstream ss(line); char c; ss >> c;
-        if(!ss) continue;
-        if(c=='v'){ float x,y,z; ss>>x>>y>>z; pts.emplace_back(x,y,z); }
-        else if(c=='f'){ int a,b,c2; ss>>a>>b>>c2; Tri t; t.a=a-1; t.b=b-1; t.c=c2-1;
-            Vec3 u = pts[t.b] - pts[t.a]; Vec3 v = pts[t.c] - pts[t.a];
-            t.fn = normalize(cross(u,v)); triangles.push_back(t); }
-    }
-    // build vertex list
-    vertices.resize(pts.size());
-    for(size_t i=0;i<pts.size();++i){ vertices[i].p=pts[i]; vertices[i].n=Vec3(0,0,0); }
-    for(auto &t : triangles){
-        vertices[t.a].n = vertices[t.a].n + t.fn;
-        vertices[t.b].n = vertices[t.b].n + t.fn;
-        vertices[t.c].n = vertices[t.c].n + t.fn;
-    }
-    for(auto &v : vertices) v.n = normalize(v.n);
-    // centroid & scale
-    centroid = Vec3(0,0,0);
-    for(auto &v : vertices) centroid = centroid + v.p;
-    centroid = centroid * (1.0f / (float)vertices.size());
-    float maxd = 0.0f;
-    for(auto &v : vertices){ Vec3 d = v.p - centroid; maxd = std::max(maxd, len(d)); }
-    if(maxd < 1e-6f) maxd = 1.0f;
-    modelScale = 1.0f / maxd;
-    std::cout << "Loaded " << vertices.size() << " verts, " << triangles.size() << " tris.\n";
+MeshletCullData meshletCull;
+
+// -------- Mesh loading --------
+// Synchronous load straight into the displayed mesh.
+bool loadMesh(const std::string &path){
+    MeshData m;
+    if(!loadMesh(path, m)) return false;
+    displayed.swap(m);
     return true;
 }
 
 // -------- Build VBOs --------
-void buildBuffers(){
-    if(buffersReady){
-        glDeleteBuffers(1, &vboPos); glDeleteBuffers(1, &vboNorm); glDeleteBuffers(1, &ibo);
-    }
-    std::vector<float> pos, norm;
-    std::vector<unsigned int> idx;
-    pos.reserve(vertices.size()*3); norm.reserve(vertices.size()*3);
-    for(auto &v : vertices){ pos.push_back(v.p.x); pos.push_back(v.p.y); pos.push_back(v.p.z);
-                             norm.push_back(v.n.x); norm.push_back(v.n.y); norm.push_back(v.n.z); }
-    idx.reserve(triangles.size()*3);
-    for(auto &t : triangles){ idx.push_back(t.a); idx.push_back(t.b); idx.push_back(t.c); }
-    glGenBuffers(1, &vboPos); glBindBuffer(GL_ARRAY_BUFFER, vboPos); glBufferData(GL_ARRAY_BUFFER, pos.size()*sizeof(float), pos.data(), GL_STATIC_DRAW);
-    glGenBuffers(1, &vboNorm); glBindBuffer(GL_ARRAY_BUFFER, vboNorm); glBufferData(GL_ARRAY_BUFFER, norm.size()*sizeof(float), norm.data(), GL_STATIC_DRAW);
-    glGenBuffers(1, &ibo); glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo); glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size()*sizeof(unsigned int), idx.data(), GL_STATIC_DRAW);
+// Creates the buffers and VAO for `img`; without `upload` the buffers are only sized and filled later with
+// glBufferSubData (progressive loading).
+void createMeshBuffers(const BufferImage &img, bool upload, GLuint buf[BUF_COUNT], GLuint &vao){
+    glGenBuffers(BUF_COUNT, buf);
+    for(int b=0;b<BUF_COUNT;++b){
+        GLenum target = b == BUF_INDEX ? GL_ELEMENT_ARRAY_BUFFER : GL_ARRAY_BUFFER;
+        glBindBuffer(target, buf[b]);
+        glBufferData(target, (GLsizeiptr)img.bytes[b], upload ? img.data[b] : nullptr, GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0); glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    const VertexLayout &vl = img.layout;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glEnableVertexAttribArray(ATTRIB_POS);
+    glBindBuffer(GL_ARRAY_BUFFER, buf[BUF_POS]);
+    glVertexAttribPointer(ATTRIB_POS, 3, vl.posType, vl.posNormalized, vl.stride, (void*)vl.posOffset);
+    glEnableVertexAttribArray(ATTRIB_NORM);
+    glBindBuffer(GL_ARRAY_BUFFER, vl.stride ? buf[BUF_POS] : buf[BUF_NORM]);
+    glVertexAttribPointer(ATTRIB_NORM, vl.normSize, vl.normType, vl.normNormalized, vl.stride, (void*)vl.normOffset);
+    if(img.bytes[BUF_AO]){
+        glEnableVertexAttribArray(ATTRIB_AO);
+        glBindBuffer(GL_ARRAY_BUFFER, buf[BUF_AO]);
+        glVertexAttribPointer(ATTRIB_AO, 1, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void*)0);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf[BUF_INDEX]);
+    glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0); glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    triCount = (GLsizei)triangles.size();
+}
+
+void deleteMeshBuffers(){
+    if(!buffersReady) return;
+    glDeleteBuffers(1, &vboPos); glDeleteBuffers(1, &vboNorm); glDeleteBuffers(1, &vboAo); glDeleteBuffers(1, &ibo);
+    glDeleteVertexArrays(1, &meshVao);
+    vboPos = vboNorm = vboAo = ibo = meshVao = 0; buffersReady = false;
+}
+
+// Makes `buf`/`vao` (from createMeshBuffers) the displayed mesh's buffers.
+void adoptMeshBuffers(const BufferImage &img, const GLuint buf[BUF_COUNT], GLuint vao){
+    vboPos = buf[BUF_POS]; vboNorm = buf[BUF_NORM]; vboAo = buf[BUF_AO]; ibo = buf[BUF_INDEX]; meshVao = vao;
+    ++meshGeneration;
+    vboLayout = img.layout;
+    triCount = (GLsizei)img.triCount;
+    residentIndices = img.triCount*3;
+    meshletCull.build(displayed.meshlets);
+    activeLod = 0;
     buffersReady = true;
 }
 
+// Synchronous upload of the displayed mesh.
+void buildBuffers(){
+    deleteMeshBuffers();
+    BufferImage img;
+    prepareBufferImage(meshView(displayed), displayed.modelScale, img);
+    GLuint buf[BUF_COUNT], vao;
+    createMeshBuffers(img, true, buf, vao);
+    adoptMeshBuffers(img, buf, vao);
+}
+
+// -------- Background loading & hot reload --------
+// The viewer never blocks on a model: a loader thread parses (or maps) it and prepares the buffer contents, then
+// streams them to the main thread in LOAD_CHUNK_BYTES pieces through a single-producer/single-consumer ring.
+// idle() uploads at most LOAD_UPLOAD_BUDGET bytes per frame with glBufferSubData. The first load is drawn as its
+// triangles arrive; a reload fills fresh buffers and replaces the old mesh between two frames once complete.
+// Between loads the same thread polls the .smf's size and mtime and reloads it after an edit.
+static const size_t LOAD_CHUNK_BYTES = 1u << 20;
+static const size_t LOAD_UPLOAD_BUDGET = 16u << 20;
+static const int WATCH_INTERVAL_MS = 250;
+
+// Lock-free ring for one producer and one consumer thread; push/pop fail instead of blocking.
+template<class T, size_t N> struct SpscRing {
+    T items[N];
+    std::atomic<size_t> head{0}, tail{0};   // next slot to pop (consumer) / to push (producer)
+    bool push(const T &v){
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == N) return false;
+        items[t % N] = v;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T &v){
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) return false;
+        v = items[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// One load, handed from the loader thread to the main thread with LOAD_BEGIN; the loader only reads it afterwards
+// and forgets it after LOAD_DONE/LOAD_FAILED, at which point the main thread deletes it.
+struct LoadJob {
+    MeshData mesh;
+    BufferImage image;
+    bool reload = false;
+    double loadMs = 0;
+    // main thread only
+    GLuint buf[BUF_COUNT] = { 0, 0, 0, 0 }, vao = 0;
+    size_t uploaded = 0;
+    bool displayed = false;       // the buffers are already the ones on screen (first load)
+};
+enum LoadEvent { LOAD_BEGIN, LOAD_CHUNK, LOAD_DONE, LOAD_FAILED };
+struct LoadMessage { LoadEvent event; LoadJob* job; int buffer; size_t offset, bytes; };
+
+enum LoaderState { LOADER_IDLE, LOADER_READING, LOADER_STREAMING };
+struct MeshLoader {
+    std::string path;
+    bool watch = true;
+    std::thread thread;
+    std::atomic<int> state{LOADER_IDLE};
+    SpscRing<LoadMessage, 256> ring;
+    LoadJob* job = nullptr;       // main thread: the job currently being uploaded
+    bool failed = false;          // main thread: the last load failed (the HUD says so)
+};
+MeshLoader* meshLoader = nullptr;   // only in the interactive viewer
+
+static bool fileStamp(const std::string &path, int64_t &stamp){
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return false;
+#ifdef __APPLE__
+    int64_t ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    int64_t ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    stamp = ns ^ ((int64_t)st.st_size << 40);
+    return true;
+}
+
+static void loaderPush(MeshLoader &L, const LoadMessage &msg){
+    while(!L.ring.push(msg)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static void loaderLoad(MeshLoader &L, bool reload){
+    L.state = LOADER_READING;
+    auto t0 = std::chrono::steady_clock::now();
+    LoadJob* job = new LoadJob();
+    job->reload = reload;
+    if(!loadMesh(L.path, job->mesh)){
+        L.state = LOADER_IDLE;
+        loaderPush(L, { LOAD_FAILED, job, 0, 0, 0 });
+        return;
+    }
+    prepareBufferImage(meshView(job->mesh), job->mesh.modelScale, job->image);
+    job->loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    L.state = LOADER_STREAMING;
+    loaderPush(L, { LOAD_BEGIN, job, 0, 0, 0 });
+    // vertices first, so every index chunk only references uploaded vertices
+    for(int b=0; b<BUF_COUNT; ++b){
+        const char* data = (const char*)job->image.data[b];
+        for(size_t off=0; off<job->image.bytes[b]; off += LOAD_CHUNK_BYTES){
+            size_t n = std::min(LOAD_CHUNK_BYTES, job->image.bytes[b] - off);
+            // fault mapped pages in here rather than inside glBufferSubData on the render thread
+            volatile char sink = 0;
+            for(size_t k=0; k<n; k += 4096) sink += data[off + k];
+            (void)sink;
+            loaderPush(L, { LOAD_CHUNK, job, b, off, n });
+        }
+    }
+    loaderPush(L, { LOAD_DONE, job, 0, 0, 0 });
+    L.state = LOADER_IDLE;
+}
+
+static void loaderMain(MeshLoader* L){
+    int64_t seen = 0, pending = 0;
+    fileStamp(L->path, seen);
+    loaderLoad(*L, false);
+    while(L->watch){
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_INTERVAL_MS));
+        int64_t now;
+        if(!fileStamp(L->path, now) || now == seen){ pending = 0; continue; }
+        // wait for one quiet interval so a file that is still being written is not picked up half-way
+        if(now != pending){ pending = now; continue; }
+        seen = now; pending = 0;
+        std::cout << "Reloading " << L->path << "\n";
+        loaderLoad(*L, true);
+    }
+}
+
+void startMeshLoader(const std::string &path, bool watch){
+    meshLoader = new MeshLoader();   // never freed: the thread may still run while the process exits
+    meshLoader->path = path;
+    meshLoader->watch = watch;
+    meshLoader->thread = std::thread(loaderMain, meshLoader);
+    meshLoader->thread.detach();
+}
+
+// Drains the loader ring within this frame's upload budget; returns true when the picture changed.
+bool pollMeshLoader(){
+    if(!meshLoader) return false;
+    MeshLoader &L = *meshLoader;
+    size_t budget = LOAD_UPLOAD_BUDGET;
+    bool changed = false;
+    LoadMessage msg;
+    while(budget > 0 && L.ring.pop(msg)){
+        LoadJob* job = msg.job;
+        switch(msg.event){
+        case LOAD_BEGIN:
+            L.job = job; L.failed = false;
+            createMeshBuffers(job->image, false, job->buf, job->vao);
+            if(!buffersReady){
+                // nothing on screen yet: show this mesh right away and let it fill in
+                displayed.swap(job->mesh);
+                adoptMeshBuffers(job->image, job->buf, job->vao);
+                residentIndices = 0;
+                job->displayed = true;
+                changed = true;
+            }
+            break;
+        case LOAD_CHUNK: {
+            GLenum target = msg.buffer == BUF_INDEX ? GL_ELEMENT_ARRAY_BUFFER : GL_ARRAY_BUFFER;
+            glBindBuffer(target, job->buf[msg.buffer]);
+            glBufferSubData(target, (GLintptr)msg.offset, (GLsizeiptr)msg.bytes, (const char*)job->image.data[msg.buffer] + msg.offset);
+            glBindBuffer(target, 0);
+            job->uploaded += msg.bytes;
+            budget -= std::min(budget, msg.bytes);
+            if(job->displayed && msg.buffer == BUF_INDEX){
+                size_t indexSize = job->image.layout.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+                residentIndices = std::min((size_t)triCount*3, (msg.offset + msg.bytes) / indexSize / 3 * 3);
+                changed = true;
+            }
+            break;
+        }
+        case LOAD_DONE:
+            if(!job->displayed){
+                // swap between frames: the old mesh stays on screen until every byte of the new one is resident
+                displayed.swap(job->mesh);
+                deleteMeshBuffers();
+                adoptMeshBuffers(job->image, job->buf, job->vao);
+            }
+            residentIndices = (size_t)triCount*3;
+            std::cout << (job->reload ? "Reloaded " : "Loaded ") << L.path << " in " << job->loadMs << " ms ("
+                      << triCount << " tris)\n";
+            L.job = nullptr;
+            delete job;   // with a reload, this frees the previous mesh
+            changed = true;
+            break;
+        case LOAD_FAILED:
+            L.failed = true;
+            delete job;
+            changed = true;
+            break;
+        }
+    }
+    return changed;
+}
+
+// HUD status while a load or reload is in flight.
+bool loaderHudLine(std::string &line){
+    if(!meshLoader) return false;
+    MeshLoader &L = *meshLoader;
+    size_t slash = L.path.find_last_of('/');
+    std::string name = slash == std::string::npos ? L.path : L.path.substr(slash + 1);
+    char buf[160];
+    if(L.job){
+        size_t total = 0;
+        for(int b=0; b<BUF_COUNT; ++b) total += L.job->image.bytes[b];
+        snprintf(buf, sizeof(buf), "%s %s: %.0f%% of %.1f MB uploaded", L.job->reload ? "Reloading" : "Loading", name.c_str(),
+                 total ? 100.0 * L.job->uploaded / total : 100.0, total / (1024.0*1024.0));
+    } else if(L.state == LOADER_READING){
+        snprintf(buf, sizeof(buf), "%s %s: reading...", buffersReady ? "Reloading" : "Loading", name.c_str());
+    } else if(L.failed){
+        snprintf(buf, sizeof(buf), "Loading %s failed (see console)%s", name.c_str(), buffersReady ? ", keeping the previous mesh" : "");
+    } else return false;
+    line = buf;
+    return true;
+}
+
 // -------- Simple shader utilities (GLSL 1.20) --------
 static GLuint compileShader(GLenum type, const char* src){
     GLuint s = glCreateShader(type);
@@ -131,11 +404,13 @@ static GLuint compileShader(GLenum type, const char* src){
     if(!ok){ GLint len=0; glGetShaderiv(s, GL_INFO_LOG_LENGTH, &len); std::vector<char> log(len+1); glGetShaderInfoLog(s, len, NULL, log.data()); std::cerr<<"Shader compile error: "<<log.data()<<"\n"; }
     return s;
 }
-static GLuint linkProgram(GLuint vs, GLuint fs){
-    GLuint p = glCreateProgram(); glAttachShader(p, vs); glAttachShader(p, fs); glLinkProgram(p);
-    GLint ok=0; glGetProgramiv(p, GL_LINK_STATUS, &ok);
-    if(!ok){ GLint len=0; glGetProgramiv(p, GL_INFO_LOG_LENGTH, &len); std::vector<char> log(len+1); glGetProgramInfoLog(p, len, NULL, log.data()); std::cerr<<"Program link error: "<<log.data()<<"\n"; }
-    return p;
+
+static std::string withDefines(const char* src, const std::string &defines){
+    std::string s(src);
+    if(defines.empty()) return s;
+    size_t v = s.find("#version");
+    size_t eol = v == std::string::npos ? std::string::npos : s.find('\n', v);
+    return eol == std::string::npos ? defines + s : s.insert(eol + 1, defines);
 }
 
 // -------- Shaders (Gouraud: vertex-lit, Phong: fragment-lit) --------
@@ -143,13 +418,39 @@ static const char* gouraud_vs = R"GLSL(
 #version 120
 attribute vec3 inPos;
 attribute vec3 inNorm;
-uniform mat4 modelViewMatrix;
+attribute float inAO;       // baked ambient occlusion: scales the ambient term and the camera light's diffuse
+attribute float inShadow;   // light1 visibility
+#ifdef INSTANCED
+attribute vec3 inInstC0, inInstC1, inInstC2, inInstC3;   // per-instance object -> world, column-major
+attribute float inInstMaterial;
+#endif
+uniform mat4 modelViewMatrix;     // view matrix only when INSTANCED
 uniform mat4 projectionMatrix;
 uniform mat3 normalMatrix;
+uniform vec3 posDecodeScale;
+uniform vec3 posDecodeOffset;
+uniform bool octNormals;
+vec3 decodeNormal(vec3 n){
+    if(!octNormals) return n;
+    vec3 d = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+    if(d.z < 0.0) d.xy = (1.0 - abs(d.yx)) * vec2(d.x >= 0.0 ? 1.0 : -1.0, d.y >= 0.0 ? 1.0 : -1.0);
+    return d;
+}
+#ifdef INSTANCED
+uniform vec4 material_ambients[MATERIAL_COUNT];
+uniform vec4 material_diffuses[MATERIAL_COUNT];
+uniform vec4 material_speculars[MATERIAL_COUNT];
+uniform float material_shininesses[MATERIAL_COUNT];
+#define material_ambient material_ambients[materialId]
+#define material_diffuse material_diffuses[materialId]
+#define material_specular material_speculars[materialId]
+#define material_shininess material_shininesses[materialId]
+#else
 uniform vec4 material_ambient;
 uniform vec4 material_diffuse;
 uniform vec4 material_specular;
 uniform float material_shininess;
+#endif
 uniform vec3 light0_pos_eye;
 uniform vec4 light0_ambient;
 uniform vec4 light0_diffuse;
@@ -160,22 +461,39 @@ uniform vec4 light1_diffuse;
 uniform vec4 light1_specular;
 varying vec4 vColor;
 void main(){
-    vec4 posEye = modelViewMatrix * vec4(inPos,1.0);
-    vec3 N = normalize(normalMatrix * inNorm);
+#ifdef INSTANCED
+    int materialId = int(inInstMaterial + 0.5);
+    mat4 mv = modelViewMatrix * mat4(vec4(inInstC0, 0.0), vec4(inInstC1, 0.0), vec4(inInstC2, 0.0), vec4(inInstC3, 1.0));
+    mat3 nm = mat3(mv);
+#else
+    mat4 mv = modelViewMatrix;
+    mat3 nm = normalMatrix;
+#endif
+    vec4 posEye = mv * vec4(posDecodeOffset + posDecodeScale * inPos, 1.0);
+    vec3 N = normalize(nm * decodeNormal(inNorm));
     vec3 V = normalize(-posEye.xyz);
     vec3 L0 = normalize(light0_pos_eye - posEye.xyz);
     float nL0 = max(dot(N,L0), 0.0);
     vec3 R0 = reflect(-L0,N);
     float s0 = (nL0>0.0)?pow(max(dot(R0,V),0.0), material_shininess):0.0;
+    vec4 ambient = material_ambient * (light0_ambient + light1_ambient) * inAO;
+    gl_Position = projectionMatrix * posEye;
+#ifdef CLUSTERED
+    // vertex-lit: the cluster is looked up at the vertex's window position
+    vec2 px = (gl_Position.xy / max(gl_Position.w, 1e-6) * 0.5 + 0.5) * viewportSize;
+    vec3 rigD = vec3(0.0), rigS = vec3(0.0);
+    clusterLights(posEye.xyz, N, V, px, material_shininess, rigD, rigS);
+    vec4 diffuse = material_diffuse * (light0_diffuse * nL0 * inAO + vec4(rigD, 0.0));
+    vec4 spec = material_specular * (light0_specular * s0 + vec4(rigS, 0.0));
+#else
     vec3 L1 = normalize(light1_pos_eye - posEye.xyz);
     float nL1 = max(dot(N,L1), 0.0);
     vec3 R1 = reflect(-L1,N);
     float s1 = (nL1>0.0)?pow(max(dot(R1,V),0.0), material_shininess):0.0;
-    vec4 ambient = material_ambient * (light0_ambient + light1_ambient);
-    vec4 diffuse = material_diffuse * (light0_diffuse * nL0 + light1_diffuse * nL1);
-    vec4 spec = material_specular * (light0_specular * s0 + light1_specular * s1);
+    vec4 diffuse = material_diffuse * (light0_diffuse * nL0 * inAO + light1_diffuse * nL1 * inShadow);
+    vec4 spec = material_specular * (light0_specular * s0 + light1_specular * s1 * inShadow);
+#endif
     vColor = ambient + diffuse + spec;
-    gl_Position = projectionMatrix * posEye;
 }
 )GLSL";
 
@@ -189,15 +507,45 @@ static const char* phong_vs = R"GLSL(
 #version 120
 attribute vec3 inPos;
 attribute vec3 inNorm;
-uniform mat4 modelViewMatrix;
+attribute float inAO;
+attribute float inShadow;
+#ifdef INSTANCED
+attribute vec3 inInstC0, inInstC1, inInstC2, inInstC3;   // per-instance object -> world, column-major
+attribute float inInstMaterial;
+#endif
+uniform mat4 modelViewMatrix;     // view matrix only when INSTANCED
 uniform mat4 projectionMatrix;
 uniform mat3 normalMatrix;
+uniform vec3 posDecodeScale;
+uniform vec3 posDecodeOffset;
+uniform bool octNormals;
+vec3 decodeNormal(vec3 n){
+    if(!octNormals) return n;
+    vec3 d = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+    if(d.z < 0.0) d.xy = (1.0 - abs(d.yx)) * vec2(d.x >= 0.0 ? 1.0 : -1.0, d.y >= 0.0 ? 1.0 : -1.0);
+    return d;
+}
 varying vec3 vPosEye;
 varying vec3 vNormalEye;
+varying vec2 vOcclusion;    // baked AO, light1 visibility
+#ifdef INSTANCED
+varying float vMaterial;
+#endif
 void main(){
-    vec4 posEye = modelViewMatrix * vec4(inPos,1.0);
+#ifdef INSTANCED
+    mat4 mv = modelViewMatrix * mat4(vec4(inInstC0, 0.0), vec4(inInstC1, 0.0), vec4(inInstC2, 0.0), vec4(inInstC3, 1.0));
+    mat3 nm = mat3(mv);
+#else
+    mat4 mv = modelViewMatrix;
+    mat3 nm = normalMatrix;
+#endif
+#ifdef INSTANCED
+    vMaterial = inInstMaterial;
+#endif
+    vec4 posEye = mv * vec4(posDecodeOffset + posDecodeScale * inPos, 1.0);
     vPosEye = posEye.xyz;
-    vNormalEye = normalize(normalMatrix * inNorm);
+    vNormalEye = normalize(nm * decodeNormal(inNorm));
+    vOcclusion = vec2(inAO, inShadow);
     gl_Position = projectionMatrix * posEye;
 }
 )GLSL";
@@ -206,10 +554,23 @@ static const char* phong_fs = R"GLSL(
 #version 120
 varying vec3 vPosEye;
 varying vec3 vNormalEye;
+varying vec2 vOcclusion;
+#ifdef INSTANCED
+varying float vMaterial;
+uniform vec4 material_ambients[MATERIAL_COUNT];
+uniform vec4 material_diffuses[MATERIAL_COUNT];
+uniform vec4 material_speculars[MATERIAL_COUNT];
+uniform float material_shininesses[MATERIAL_COUNT];
+#define material_ambient material_ambients[materialId]
+#define material_diffuse material_diffuses[materialId]
+#define material_specular material_speculars[materialId]
+#define material_shininess material_shininesses[materialId]
+#else
 uniform vec4 material_ambient;
 uniform vec4 material_diffuse;
 uniform vec4 material_specular;
 uniform float material_shininess;
+#endif
 uniform vec3 light0_pos_eye;
 uniform vec4 light0_ambient;
 uniform vec4 light0_diffuse;
@@ -219,209 +580,1693 @@ uniform vec4 light1_ambient;
 uniform vec4 light1_diffuse;
 uniform vec4 light1_specular;
 void main(){
+#ifdef INSTANCED
+    int materialId = int(vMaterial + 0.5);
+#endif
     vec3 N = normalize(vNormalEye);
     vec3 V = normalize(-vPosEye);
     vec3 L0 = normalize(light0_pos_eye - vPosEye);
     float nL0 = max(dot(N,L0), 0.0);
     vec3 R0 = reflect(-L0, N);
     float s0 = (nL0>0.0)?pow(max(dot(R0,V),0.0), material_shininess):0.0;
+    vec4 ambient = material_ambient * (light0_ambient + light1_ambient) * vOcclusion.x;
+#ifdef CLUSTERED
+    // the light rig replaces light1; only this fragment's cluster is visited
+    vec3 rigD = vec3(0.0), rigS = vec3(0.0);
+    clusterLights(vPosEye, N, V, gl_FragCoord.xy, material_shininess, rigD, rigS);
+    vec4 diffuse = material_diffuse * (light0_diffuse * nL0 * vOcclusion.x + vec4(rigD, 0.0));
+    vec4 spec = material_specular * (light0_specular * s0 + vec4(rigS, 0.0));
+#else
     vec3 L1 = normalize(light1_pos_eye - vPosEye);
     float nL1 = max(dot(N,L1), 0.0);
     vec3 R1 = reflect(-L1, N);
     float s1 = (nL1>0.0)?pow(max(dot(R1,V),0.0), material_shininess):0.0;
-    vec4 ambient = material_ambient * (light0_ambient + light1_ambient);
-    vec4 diffuse = material_diffuse * (light0_diffuse * nL0 + light1_diffuse * nL1);
-    vec4 spec = material_specular * (light0_specular * s0 + light1_specular * s1);
+    vec4 diffuse = material_diffuse * (light0_diffuse * nL0 * vOcclusion.x + light1_diffuse * nL1 * vOcclusion.y);
+    vec4 spec = material_specular * (light0_specular * s0 + light1_specular * s1 * vOcclusion.y);
+#endif
     vec4 color = ambient + diffuse + spec;
     gl_FragColor = clamp(color, 0.0, 1.0);
 }
 )GLSL";
 
-// Program IDs
-GLuint progGouraud=0, progPhong=0;
+static const char* flat_vs = R"GLSL(
+#version 120
+attribute vec3 inPos;
+#ifdef INSTANCED
+attribute vec3 inInstC0, inInstC1, inInstC2, inInstC3;
+attribute float inInstMaterial;
+varying float vMaterial;
+#endif
+uniform mat4 modelViewMatrix;     // view matrix only when INSTANCED
+uniform mat4 projectionMatrix;
+uniform vec3 posDecodeScale;
+uniform vec3 posDecodeOffset;
+varying vec3 vPosObj;
+varying vec3 vPosEye;
+void main(){
+    vPosObj = posDecodeOffset + posDecodeScale * inPos;
+#ifdef INSTANCED
+    // face normals (and their |fn| colors) are taken in world space for instances
+    vPosObj = mat3(inInstC0, inInstC1, inInstC2) * vPosObj + inInstC3;
+    vMaterial = inInstMaterial;
+#endif
+    vec4 posEye = modelViewMatrix * vec4(vPosObj, 1.0);
+    vPosEye = posEye.xyz;
+    gl_Position = projectionMatrix * posEye;
+}
+)GLSL";
+
+// Flat: the face normal comes from screen-space derivatives of the object-space position (it faces the viewer,
+// which matches the stored normal on every visible front face). Color |fn| lit like fixed-function LIGHT0 with
+// GL_COLOR_MATERIAL: 0.2 global ambient, infinite viewer, normals through faceNormalMatrix without renormalizing.
+// Unlike GL_FLAT, which lights the provoking vertex, the light direction is taken per fragment.
+static const char* flat_fs = R"GLSL(
+#version 120
+varying vec3 vPosObj;
+varying vec3 vPosEye;
+uniform mat3 faceNormalMatrix;
+#ifdef INSTANCED
+varying float vMaterial;
+uniform vec4 material_speculars[MATERIAL_COUNT];
+uniform float material_shininesses[MATERIAL_COUNT];
+#define material_specular material_speculars[materialId]
+#define material_shininess material_shininesses[materialId]
+#else
+uniform vec4 material_specular;
+uniform float material_shininess;
+#endif
+uniform vec3 light0_pos_eye;
+uniform vec4 light0_ambient;
+uniform vec4 light0_diffuse;
+uniform vec4 light0_specular;
+void main(){
+#ifdef INSTANCED
+    int materialId = int(vMaterial + 0.5);
+#endif
+    vec3 fn = normalize(cross(dFdx(vPosObj), dFdy(vPosObj)));
+    vec3 base = abs(fn);
+    vec3 N = faceNormalMatrix * fn;
+    vec3 L = normalize(light0_pos_eye - vPosEye);
+    float nL = dot(N, L);
+    vec3 H = normalize(L + vec3(0.0, 0.0, 1.0));
+    float s = (nL > 0.0) ? pow(max(dot(N, H), 0.0), material_shininess) : 0.0;
+    vec3 color = base * (0.2 + light0_ambient.rgb + max(nL, 0.0) * light0_diffuse.rgb) + s * light0_specular.rgb * material_specular.rgb;
+    gl_FragColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
+)GLSL";
+
+// Clustered point-light loop, prepended (with CLUSTERED and a stage-specific FETCH) to the light-rig programs.
+static const int MAX_CLUSTER_LIGHTS = 256;    // shader loop bound; a full cluster keeps its lowest-numbered lights
+static const char* cluster_glsl = R"GLSL(
+uniform sampler2D lightTex;      // column per light: row 0 (pos_eye.xyz, range), row 1 (color.rgb, specular scale)
+uniform sampler2D clusterTex;    // texel per cluster: (first index, count)
+uniform sampler2D indexTex;      // light indices, row-major
+uniform vec3 clusterGrid;        // clusters in x, y, z
+uniform vec2 clusterDepth;       // near plane, z slices per log unit of depth/near
+uniform vec2 viewportSize;
+uniform vec2 lightTexSize;
+uniform vec2 indexTexSize;
+vec4 fetchTexel(sampler2D t, vec2 texel, vec2 size){ return FETCH(t, (texel + 0.5) / size); }
+void clusterLights(vec3 P, vec3 N, vec3 V, vec2 px, float shininess, inout vec3 diffuse, inout vec3 specular){
+    vec2 cxy = clamp(floor(px / viewportSize * clusterGrid.xy), vec2(0.0), clusterGrid.xy - 1.0);
+    float cz = clamp(floor(log(max(-P.z, clusterDepth.x) / clusterDepth.x) * clusterDepth.y), 0.0, clusterGrid.z - 1.0);
+    vec4 cell = fetchTexel(clusterTex, vec2(cxy.x + cxy.y * clusterGrid.x, cz), vec2(clusterGrid.x * clusterGrid.y, clusterGrid.z));
+    int count = int(cell.y + 0.5);
+    for(int i = 0; i < MAX_CLUSTER_LIGHTS; ++i){
+        if(i >= count) break;
+        float k = cell.x + float(i);
+        float li = fetchTexel(indexTex, vec2(mod(k, indexTexSize.x), floor(k / indexTexSize.x)), indexTexSize).r;
+        vec4 lp = fetchTexel(lightTex, vec2(li, 0.0), lightTexSize);
+        vec3 Ld = lp.xyz - P;
+        float d = length(Ld);
+        if(d >= lp.w) continue;
+        vec4 lc = fetchTexel(lightTex, vec2(li, 1.0), lightTexSize);
+        Ld /= max(d, 1e-6);
+        float x = d / lp.w;
+        float att = (1.0 - x*x) * (1.0 - x*x);
+        float nL = max(dot(N, Ld), 0.0);
+        vec3 R = reflect(-Ld, N);
+        float s = (nL > 0.0) ? pow(max(dot(R, V), 0.0), shininess) : 0.0;
+        diffuse += lc.rgb * (nL * att);
+        specular += lc.rgb * (lc.a * s * att);
+    }
+}
+)GLSL";
+
+// -------- Program objects --------
+enum UniformId {
+    U_MODELVIEW, U_PROJECTION, U_NORMAL_MATRIX, U_DECODE_SCALE, U_DECODE_OFFSET, U_OCT_NORMALS,
+    U_MAT_AMBIENT, U_MAT_DIFFUSE, U_MAT_SPECULAR, U_MAT_SHININESS,
+    U_L0_POS, U_L0_AMBIENT, U_L0_DIFFUSE, U_L0_SPECULAR,
+    U_L1_POS, U_L1_AMBIENT, U_L1_DIFFUSE, U_L1_SPECULAR,
+    U_FACE_NORMAL_MATRIX,
+    U_MAT_AMBIENTS, U_MAT_DIFFUSES, U_MAT_SPECULARS, U_MAT_SHININESSES,   // instanced programs: the whole material table
+    U_LIGHT_TEX, U_CLUSTER_TEX, U_INDEX_TEX, U_CLUSTER_GRID, U_CLUSTER_DEPTH,  // light-rig programs
+    U_VIEWPORT_SIZE, U_LIGHT_TEX_SIZE, U_INDEX_TEX_SIZE,
+    U_COUNT
+};
+static const int MATERIAL_COUNT = 3;   // initMaterials()
+struct UniformDesc { const char* name; GLenum type; int floats; };
+static const UniformDesc uniformDescs[U_COUNT] = {
+    { "modelViewMatrix", GL_FLOAT_MAT4, 16 }, { "projectionMatrix", GL_FLOAT_MAT4, 16 }, { "normalMatrix", GL_FLOAT_MAT3, 9 },
+    { "posDecodeScale", GL_FLOAT_VEC3, 3 }, { "posDecodeOffset", GL_FLOAT_VEC3, 3 }, { "octNormals", GL_BOOL, 1 },
+    { "material_ambient", GL_FLOAT_VEC4, 4 }, { "material_diffuse", GL_FLOAT_VEC4, 4 },
+    { "material_specular", GL_FLOAT_VEC4, 4 }, { "material_shininess", GL_FLOAT, 1 },
+    { "light0_pos_eye", GL_FLOAT_VEC3, 3 }, { "light0_ambient", GL_FLOAT_VEC4, 4 },
+    { "light0_diffuse", GL_FLOAT_VEC4, 4 }, { "light0_specular", GL_FLOAT_VEC4, 4 },
+    { "light1_pos_eye", GL_FLOAT_VEC3, 3 }, { "light1_ambient", GL_FLOAT_VEC4, 4 },
+    { "light1_diffuse", GL_FLOAT_VEC4, 4 }, { "light1_specular", GL_FLOAT_VEC4, 4 },
+    { "faceNormalMatrix", GL_FLOAT_MAT3, 9 },
+    { "material_ambients", GL_FLOAT_VEC4, 4*MATERIAL_COUNT }, { "material_diffuses", GL_FLOAT_VEC4, 4*MATERIAL_COUNT },
+    { "material_speculars", GL_FLOAT_VEC4, 4*MATERIAL_COUNT }, { "material_shininesses", GL_FLOAT, MATERIAL_COUNT },
+    { "lightTex", GL_SAMPLER_2D, 1 }, { "clusterTex", GL_SAMPLER_2D, 1 }, { "indexTex", GL_SAMPLER_2D, 1 },
+    { "clusterGrid", GL_FLOAT_VEC3, 3 }, { "clusterDepth", GL_FLOAT_VEC2, 2 }, { "viewportSize", GL_FLOAT_VEC2, 2 },
+    { "lightTexSize", GL_FLOAT_VEC2, 2 }, { "indexTexSize", GL_FLOAT_VEC2, 2 },
+};
+
+// Linked program with every uniform location resolved once and a CPU copy of the last uploaded values;
+// set() only reaches the driver when a value actually changes. The program must be bound when calling set().
+struct ShaderProgram {
+    GLuint id = 0;
+    GLint loc[U_COUNT];
+    float value[U_COUNT][16];
+    bool uploaded[U_COUNT];
+
+    // `defines` go right after the #version line (e.g. "#define INSTANCED 1\n").
+    void link(const char* vsSrc, const char* fsSrc, const std::string &defines = std::string()){ link(vsSrc, fsSrc, defines, defines); }
+    void link(const char* vsSrc, const char* fsSrc, const std::string &vsDefines, const std::string &fsDefines){
+        GLuint vs = compileShader(GL_VERTEX_SHADER, withDefines(vsSrc, vsDefines).c_str());
+        GLuint fs = compileShader(GL_FRAGMENT_SHADER, withDefines(fsSrc, fsDefines).c_str());
+        id = glCreateProgram(); glAttachShader(id, vs); glAttachShader(id, fs);
+        glBindAttribLocation(id, ATTRIB_POS, "inPos");
+        glBindAttribLocation(id, ATTRIB_NORM, "inNorm");
+        for(int c=0;c<4;++c) glBindAttribLocation(id, ATTRIB_INST_C0 + c, ("inInstC" + std::to_string(c)).c_str());
+        glBindAttribLocation(id, ATTRIB_INST_MATERIAL, "inInstMaterial");
+        glBindAttribLocation(id, ATTRIB_AO, "inAO");
+        glBindAttribLocation(id, ATTRIB_SHADOW, "inShadow");
+        glLinkProgram(id);
+        GLint ok=0; glGetProgramiv(id, GL_LINK_STATUS, &ok);
+        if(!ok){ GLint len=0; glGetProgramiv(id, GL_INFO_LOG_LENGTH, &len); std::vector<char> log(len+1); glGetProgramInfoLog(id, len, NULL, log.data()); std::cerr<<"Program link error: "<<log.data()<<"\n"; }
+        glDeleteShader(vs); glDeleteShader(fs);
+        for(int u=0; u<U_COUNT; ++u){ loc[u] = glGetUniformLocation(id, uniformDescs[u].name); uploaded[u] = false; }
+    }
+    void set(UniformId u, const float* v){
+        if(loc[u] < 0) return;
+        size_t bytes = uniformDescs[u].floats * sizeof(float);
+        if(uploaded[u] && memcmp(value[u], v, bytes) == 0) return;
+        memcpy(value[u], v, bytes); uploaded[u] = true;
+        int n = uniformDescs[u].floats;
+        switch(uniformDescs[u].type){
+            case GL_FLOAT_MAT4: glUniformMatrix4fv(loc[u], n/16, GL_FALSE, v); break;
+            case GL_FLOAT_MAT3: glUniformMatrix3fv(loc[u], n/9, GL_FALSE, v); break;
+            case GL_FLOAT_VEC4: glUniform4fv(loc[u], n/4, v); break;
+            case GL_FLOAT_VEC3: glUniform3fv(loc[u], n/3, v); break;
+            case GL_FLOAT_VEC2: glUniform2fv(loc[u], n/2, v); break;
+            case GL_BOOL:       glUniform1i(loc[u], v[0] != 0.0f ? 1 : 0); break;
+            case GL_SAMPLER_2D: glUniform1i(loc[u], (GLint)v[0]); break;   // texture unit
+            default:            glUniform1fv(loc[u], n, v); break;
+        }
+    }
+    void set(UniformId u, float v){ set(u, &v); }
+};
+ShaderProgram progFlat, progGouraud, progPhong;
+ShaderProgram progFlatInst, progGouraudInst, progPhongInst;   // per-instance transform + material attributes
+ShaderProgram progGouraudRig, progPhongRig;                   // clustered light rig instead of light1
 
 void createPrograms(){
-    GLuint g_vs = compileShader(GL_VERTEX_SHADER, gouraud_vs);
-    GLuint g_fs = compileShader(GL_FRAGMENT_SHADER, gouraud_fs);
-    progGouraud = linkProgram(g_vs, g_fs);
-    GLuint p_vs = compileShader(GL_VERTEX_SHADER, phong_vs);
-    GLuint p_fs = compileShader(GL_FRAGMENT_SHADER, phong_fs);
-    progPhong = linkProgram(p_vs, p_fs);
-}
-
-// Utility: push current modelview & projection into program uniforms
-void setCommonUniforms(GLuint prog){
-    if(!prog) return;
-    GLfloat mv[16], proj[16];
-    glGetFloatv(GL_MODELVIEW_MATRIX, mv);
-    glGetFloatv(GL_PROJECTION_MATRIX, proj);
-    GLint loc = glGetUniformLocation(prog, "modelViewMatrix"); if(loc>=0) glUniformMatrix4fv(loc,1,GL_FALSE,mv);
-    loc = glGetUniformLocation(prog, "projectionMatrix"); if(loc>=0) glUniformMatrix4fv(loc,1,GL_FALSE,proj);
+    progFlat.link(flat_vs, flat_fs);
+    progGouraud.link(gouraud_vs, gouraud_fs);
+    progPhong.link(phong_vs, phong_fs);
+    std::string inst = "#define INSTANCED 1\n#define MATERIAL_COUNT " + std::to_string(MATERIAL_COUNT) + "\n";
+    progFlatInst.link(flat_vs, flat_fs, inst);
+    progGouraudInst.link(gouraud_vs, gouraud_fs, inst);
+    progPhongInst.link(phong_vs, phong_fs, inst);
+    // the light loop runs in whichever stage lights: vertex texture fetch needs an explicit LOD
+    std::string rig = "#define CLUSTERED 1\n#define MAX_CLUSTER_LIGHTS " + std::to_string(MAX_CLUSTER_LIGHTS) + "\n";
+    progGouraudRig.link(gouraud_vs, gouraud_fs, rig + "#define FETCH(t, uv) texture2DLod(t, uv, 0.0)\n" + cluster_glsl, rig);
+    progPhongRig.link(phong_vs, phong_fs, rig, rig + "#define FETCH(t, uv) texture2D(t, uv)\n" + cluster_glsl);
+}
+ShaderProgram &programFor(int shade, bool instanced, bool rig = false){
+    if(instanced) return shade==1 ? progFlatInst : shade==2 ? progGouraudInst : progPhongInst;
+    if(rig && shade != 1) return shade==2 ? progGouraudRig : progPhongRig;
+    return shade==1 ? progFlat : shade==2 ? progGouraud : progPhong;
+}
+
+// Matrices and vertex-format decode for the current frame, from the CPU-side camera (no glGetFloatv readback).
+void setCommonUniforms(ShaderProgram &prog, const Mat4 &mv, const Mat4 &proj, const VertexLayout &vl){
+    prog.set(U_MODELVIEW, mv.m);
+    prog.set(U_PROJECTION, proj.m);
     // normalMatrix 3x3
-    GLfloat nm[9] = { mv[0], mv[1], mv[2], mv[4], mv[5], mv[6], mv[8], mv[9], mv[10] };
-    loc = glGetUniformLocation(prog, "normalMatrix"); if(loc>=0) glUniformMatrix3fv(loc,1,GL_FALSE,nm);
+    const float* m = mv.m;
+    GLfloat nm[9] = { m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10] };
+    prog.set(U_NORMAL_MATRIX, nm);
+    // vertex format decode (identity for float layouts)
+    prog.set(U_DECODE_SCALE, vl.decodeScale);
+    prog.set(U_DECODE_OFFSET, vl.decodeOffset);
+    prog.set(U_OCT_NORMALS, vl.octNormals ? 1.0f : 0.0f);
 }
 
-// -------- Draw mesh (flat via fixed-function, or shader paths using VBOs) --------
+// Current values of the occlusion attributes for VAOs without those arrays. They are reset before every draw, since
+// some drivers alias generic attributes with fixed-function ones (ATTRIB_SHADOW with texture coordinate 0).
+static void resetOcclusionAttribs(){
+    glVertexAttrib1f(ATTRIB_AO, 1.0f);
+    glVertexAttrib1f(ATTRIB_SHADOW, 1.0f);
+}
+
+// Both lights; `mv` takes light1's (object) coordinates and, in flat mode, the face normals to eye space.
+void setLightUniforms(ShaderProgram &prog, const Mat4 &mv, const Vec3 &light1_obj, bool flat){
+    if(flat){
+        // Flat: fixed-function LIGHT0 semantics, the light was positioned under the view matrix
+        Vec3 l0 = transformPoint(cameraView, Vec3(light0PosEye[0], light0PosEye[1], light0PosEye[2]));
+        float light0_flat[3] = { l0.x, l0.y, l0.z };
+        prog.set(U_L0_POS, light0_flat);
+        Mat4 nrm = mat4NormalMatrix(mv);
+        GLfloat fnm[9] = { nrm.m[0], nrm.m[1], nrm.m[2], nrm.m[4], nrm.m[5], nrm.m[6], nrm.m[8], nrm.m[9], nrm.m[10] };
+        prog.set(U_FACE_NORMAL_MATRIX, fnm);
+    } else {
+        // Light0: camera-space near eye
+        prog.set(U_L0_POS, light0PosEye);
+    }
+    prog.set(U_L0_AMBIENT, light0Colors.ambient);
+    prog.set(U_L0_DIFFUSE, light0Colors.diffuse);
+    prog.set(U_L0_SPECULAR, light0Colors.specular);
+
+    // Light1: object-space light transformed to eye coords by the modelview
+    Vec3 l1 = transformPoint(mv, light1_obj);
+    float light1_eye[3] = { l1.x, l1.y, l1.z };
+    prog.set(U_L1_POS, light1_eye);
+    prog.set(U_L1_AMBIENT, light1Colors.ambient);
+    prog.set(U_L1_DIFFUSE, light1Colors.diffuse);
+    prog.set(U_L1_SPECULAR, light1Colors.specular);
+}
+
+// -------- Clustered point lights --------
+// `--lights=N` swaps light1 for a rig of N ranged point lights spread around the same cylinder (light0 stays). Every
+// frame the CPU bins each light's bounding sphere into a 16x9 screen-tile x 24 exponential depth-slice grid of
+// eye-space clusters; the Gouraud/Phong rig programs then shade only the lights of their own cluster. Light data,
+// cluster ranges and the light index list go to float textures (GL 2.1 has no storage buffers).
+static const int MAX_RIG_LIGHTS = 1024;
+static const int CLUSTER_X = 16, CLUSTER_Y = 9, CLUSTER_Z = 24, CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+static const int INDEX_TEX_WIDTH = 1024;
+struct RigLight { Vec3 pos; float range; float color[3]; float specular; };   // object coordinates, like light1
+int rigLightCount = 0;            // 0 = classic light0 + light1
+float rigLightRange = 0.0f;       // object units; 0 = derived from the count and lightRadius
+std::vector<RigLight> rigLights;
+struct ClusterStats { float avgLights; int maxLights; size_t indices; } clusterStats = { 0, 0, 0 };
+GLuint lightTex = 0, clusterTex = 0, indexTex = 0;
+int indexTexRows = 0;
+std::vector<float> lightTexels, clusterTexels, indexTexels;
+std::vector<uint32_t> clusterCounts;
+
+static void hsvToRgb(float h, float s, float v, float rgb[3]){
+    h = (h - floorf(h)) * 6.0f;
+    int i = (int)h; float f = h - i;
+    float p = v * (1 - s), q = v * (1 - s * f), t = v * (1 - s * (1 - f));
+    float c[6][3] = { {v,t,p}, {q,v,p}, {p,v,t}, {p,q,v}, {t,p,v}, {v,p,q} };
+    memcpy(rgb, c[i % 6], sizeof(c[0]));
+}
+
+// Light i sits at lightAngle + i/N of a turn; golden-ratio offsets spread radius, height and hue without clumping.
+// Light 0 coincides with light1. Total brightness grows like sqrt(N) rather than N.
+void placeRigLights(float angle, float radius, float height){
+    int n = rigLightCount;
+    rigLights.resize(n);
+    float range = rigLightRange > 0 ? rigLightRange : std::max(0.25f, 3.0f / cbrtf((float)n)) * radius;
+    float intensity = std::min(1.0f, 2.0f / sqrtf((float)n));
+    for(int i=0;i<n;++i){
+        float f1 = fmodf(i * 0.6180339887f, 1.0f), f2 = fmodf(i * 0.7548776662f, 1.0f);
+        RigLight &l = rigLights[i];
+        l.pos = cylinderLightPos(angle + 6.28318530718f * i / n, radius * (1.0f - 0.4f * f1),
+                                 height + 0.75f * radius * sinf(6.28318530718f * f2));
+        l.range = range;
+        hsvToRgb(0.083f + f1, 0.75f, intensity, l.color);
+        l.specular = intensity;
+    }
+}
+
+// Inclusive range of depth slices covering eye depths [z0, z1].
+static int clusterSlice(float z, float sliceScale){
+    return std::max(0, std::min(CLUSTER_Z - 1, (int)floorf(logf(std::max(z, CAMERA_NEAR) / CAMERA_NEAR) * sliceScale)));
+}
+
+// Bins the rig into the cluster grid for this frame (`mv` object -> eye) and uploads the three textures.
+void updateClusters(const Mat4 &mv, const Mat4 &proj){
+    int n = (int)rigLights.size();
+    float sliceScale = CLUSTER_Z / logf(CAMERA_FAR / CAMERA_NEAR);
+    struct Box { int x0, x1, y0, y1, z0, z1; };
+    std::vector<Box> boxes(n);
+    lightTexels.assign(MAX_RIG_LIGHTS * 2 * 4, 0.0f);
+    clusterCounts.assign(CLUSTER_COUNT, 0);
+    for(int i=0;i<n;++i){
+        const RigLight &l = rigLights[i];
+        Vec3 p = transformPoint(mv, l.pos);
+        float r = l.range * displayed.modelScale;
+        float* t0 = &lightTexels[i * 4]; float* t1 = &lightTexels[(MAX_RIG_LIGHTS + i) * 4];
+        t0[0] = p.x; t0[1] = p.y; t0[2] = p.z; t0[3] = r;
+        t1[0] = l.color[0]; t1[1] = l.color[1]; t1[2] = l.color[2]; t1[3] = l.specular;
+        Box &b = boxes[i];
+        float zNear = -p.z - r, zFar = -p.z + r;
+        if(zFar <= CAMERA_NEAR || zNear >= CAMERA_FAR){ b.x0 = 1; b.x1 = 0; continue; }   // empty box
+        b.z0 = clusterSlice(zNear, sliceScale); b.z1 = clusterSlice(zFar, sliceScale);
+        b.x0 = 0; b.x1 = CLUSTER_X - 1; b.y0 = 0; b.y1 = CLUSTER_Y - 1;
+        if(zNear > CAMERA_NEAR){
+            // screen rectangle of the sphere's eye-space box; spheres crossing the near plane cover the whole screen
+            float lo[2] = { 1e30f, 1e30f }, hi[2] = { -1e30f, -1e30f };
+            for(int c=0;c<8;++c){
+                Vec3 q(p.x + ((c&1) ? r : -r), p.y + ((c&2) ? r : -r), p.z + ((c&4) ? r : -r));
+                const float* m = proj.m;
+                float w = m[3]*q.x + m[7]*q.y + m[11]*q.z + m[15];
+                float ndc[2] = { (m[0]*q.x + m[4]*q.y + m[8]*q.z + m[12]) / w, (m[1]*q.x + m[5]*q.y + m[9]*q.z + m[13]) / w };
+                for(int k=0;k<2;++k){ lo[k] = std::min(lo[k], ndc[k]); hi[k] = std::max(hi[k], ndc[k]); }
+            }
+            if(hi[0] < -1 || lo[0] > 1 || hi[1] < -1 || lo[1] > 1){ b.x0 = 1; b.x1 = 0; continue; }
+            auto tile = [](float ndc, int cells){ return std::max(0, std::min(cells - 1, (int)floorf((ndc * 0.5f + 0.5f) * cells))); };
+            b.x0 = tile(lo[0], CLUSTER_X); b.x1 = tile(hi[0], CLUSTER_X);
+            b.y0 = tile(lo[1], CLUSTER_Y); b.y1 = tile(hi[1], CLUSTER_Y);
+        }
+        for(int z=b.z0; z<=b.z1; ++z) for(int y=b.y0; y<=b.y1; ++y) for(int x=b.x0; x<=b.x1; ++x){
+            uint32_t &c = clusterCounts[(z * CLUSTER_Y + y) * CLUSTER_X + x];
+            if(c < (uint32_t)MAX_CLUSTER_LIGHTS) ++c;
+        }
+    }
+    // prefix sum -> (offset, count) per cluster, then fill the index list in light order
+    clusterTexels.assign(CLUSTER_COUNT * 4, 0.0f);
+    size_t total = 0; int maxLights = 0;
+    for(int c=0;c<CLUSTER_COUNT;++c){
+        clusterTexels[c*4] = (float)total; clusterTexels[c*4+1] = (float)clusterCounts[c];
+        total += clusterCounts[c]; maxLights = std::max(maxLights, (int)clusterCounts[c]);
+        clusterCounts[c] = 0;
+    }
+    int rows = std::max(1, (int)((total + INDEX_TEX_WIDTH - 1) / INDEX_TEX_WIDTH));
+    indexTexels.assign((size_t)rows * INDEX_TEX_WIDTH, 0.0f);
+    for(int i=0;i<n;++i){
+        const Box &b = boxes[i];
+        if(b.x0 > b.x1) continue;
+        for(int z=b.z0; z<=b.z1; ++z) for(int y=b.y0; y<=b.y1; ++y) for(int x=b.x0; x<=b.x1; ++x){
+            int c = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+            if(clusterCounts[c] < (uint32_t)clusterTexels[c*4+1])
+                indexTexels[(size_t)clusterTexels[c*4] + clusterCounts[c]++] = (float)i;
+        }
+    }
+    clusterStats = { (float)total / CLUSTER_COUNT, maxLights, total };
+
+    auto makeTexture = [](GLuint &tex, GLenum internalFormat, GLenum format, int w, int h){
+        if(!tex) glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, GL_FLOAT, NULL);
+    };
+    if(!lightTex){
+        makeTexture(lightTex, GL_RGBA32F_ARB, GL_RGBA, MAX_RIG_LIGHTS, 2);
+        makeTexture(clusterTex, GL_RGBA32F_ARB, GL_RGBA, CLUSTER_X * CLUSTER_Y, CLUSTER_Z);
+    }
+    if(rows > indexTexRows){
+        indexTexRows = std::max(rows, indexTexRows * 2);
+        makeTexture(indexTex, GL_LUMINANCE32F_ARB, GL_LUMINANCE, INDEX_TEX_WIDTH, indexTexRows);
+    }
+    glBindTexture(GL_TEXTURE_2D, lightTex);
+    if(n > 0){
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, n, 1, GL_RGBA, GL_FLOAT, &lightTexels[0]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 1, n, 1, GL_RGBA, GL_FLOAT, &lightTexels[MAX_RIG_LIGHTS * 4]);
+    }
+    glBindTexture(GL_TEXTURE_2D, clusterTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_X * CLUSTER_Y, CLUSTER_Z, GL_RGBA, GL_FLOAT, clusterTexels.data());
+    glBindTexture(GL_TEXTURE_2D, indexTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, INDEX_TEX_WIDTH, rows, GL_LUMINANCE, GL_FLOAT, indexTexels.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Binds the cluster textures to units 1-3 and sets the grid uniforms of a rig program.
+void setClusterUniforms(ShaderProgram &prog){
+    GLuint tex[3] = { lightTex, clusterTex, indexTex };
+    for(int i=0;i<3;++i){ glActiveTexture(GL_TEXTURE1 + i); glBindTexture(GL_TEXTURE_2D, tex[i]); }
+    glActiveTexture(GL_TEXTURE0);
+    prog.set(U_LIGHT_TEX, 1.0f); prog.set(U_CLUSTER_TEX, 2.0f); prog.set(U_INDEX_TEX, 3.0f);
+    float grid[3] = { (float)CLUSTER_X, (float)CLUSTER_Y, (float)CLUSTER_Z };
+    float depth[2] = { CAMERA_NEAR, CLUSTER_Z / logf(CAMERA_FAR / CAMERA_NEAR) };
+    float viewport[2] = { (float)winW, (float)winH };
+    float lightSize[2] = { (float)MAX_RIG_LIGHTS, 2.0f }, indexSize[2] = { (float)INDEX_TEX_WIDTH, (float)indexTexRows };
+    prog.set(U_CLUSTER_GRID, grid); prog.set(U_CLUSTER_DEPTH, depth); prog.set(U_VIEWPORT_SIZE, viewport);
+    prog.set(U_LIGHT_TEX_SIZE, lightSize); prog.set(U_INDEX_TEX_SIZE, indexSize);
+}
+
+// -------- Meshlet culling --------
+size_t meshletsCulled = 0, meshletTrisCulled = 0;
+std::vector<GLsizei> meshletDrawCounts;
+std::vector<const void*> meshletDrawOffsets;
+
+// Object-space frustum planes (xyz normalized, dist = dot(n,p)+w) of proj*view*model, Gribb-Hartmann extraction.
+static void frustumPlanes(const Mat4 &m, float planes[6][4]){
+    for(int i=0;i<6;++i){
+        int axis = i/2; float s = (i&1) ? -1.0f : 1.0f;
+        float l = 0;
+        for(int c=0;c<4;++c){ planes[i][c] = m.m[c*4+3] + s*m.m[c*4+axis]; if(c<3) l += planes[i][c]*planes[i][c]; }
+        l = l > 0 ? 1.0f/sqrtf(l) : 0.0f;
+        for(int c=0;c<4;++c) planes[i][c] *= l;
+    }
+}
+
+// Tests every meshlet against the view frustum and its normal cone, then merges the survivors into contiguous
+// index ranges (byte offsets into the IBO) for glMultiDrawElements.
+void cullMeshlets(const ViewParams &vp, GLenum indexType){
+    meshletDrawCounts.clear(); meshletDrawOffsets.clear();
+    meshletsCulled = 0; meshletTrisCulled = 0;
+    const MeshletCullData &d = meshletCull;
+    if(d.count == 0) return;
+    Mat4 proj, view; cameraMatrices(vp, proj, view);
+    float planes[6][4]; frustumPlanes(proj * view * modelMatrix(displayed), planes);
+    // eye (perspective) or view direction (ortho) in object space
+    Vec3 eyeWorld(vp.camRadius * cosf(vp.camAngle), vp.camRadius * sinf(vp.camAngle), vp.camHeight);
+    Vec3 eye = (eyeWorld + displayed.centroid) * (1.0f / displayed.modelScale);
+    Vec3 dir = normalize(Vec3(0,0,0) - eyeWorld);
+    size_t indexBytes = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    const F4 zero = f4(0.0f);
+    for(size_t i=0;i<d.count;i+=4){
+        F4 cx = f4load(&d.cx[i]), cy = f4load(&d.cy[i]), cz = f4load(&d.cz[i]), r = f4load(&d.r[i]);
+        F4 negR = zero - r;
+        M4 out = f4lt(f4(planes[0][3]) + f4(planes[0][0])*cx + f4(planes[0][1])*cy + f4(planes[0][2])*cz, negR);
+        for(int p=1;p<6;++p)
+            out = out | f4lt(f4(planes[p][3]) + f4(planes[p][0])*cx + f4(planes[p][1])*cy + f4(planes[p][2])*cz, negR);
+        F4 ax = f4load(&d.ax[i]), ay = f4load(&d.ay[i]), az = f4load(&d.az[i]), cut = f4load(&d.cut[i]);
+        if(vp.perspective){
+            // whole cluster faces away: dot(c - eye, axis) >= cutoff*|c - eye| + r
+            F4 vx = cx - f4(eye.x), vy = cy - f4(eye.y), vz = cz - f4(eye.z);
+            F4 dist = f4sqrt(vx*vx + vy*vy + vz*vz);
+            out = out | f4ge(vx*ax + vy*ay + vz*az, cut*dist + r);
+        } else {
+            out = out | f4ge(f4(dir.x)*ax + f4(dir.y)*ay + f4(dir.z)*az, cut);
+        }
+        int bits = m4bits(out);
+        for(size_t k=i; k<std::min(i+4, d.count); ++k){
+            const Meshlet &m = displayed.meshlets[k];
+            if(bits & (1 << (k-i))){ ++meshletsCulled; meshletTrisCulled += m.indexCount/3; continue; }
+            if(!meshletDrawCounts.empty() && (const char*)meshletDrawOffsets.back() + meshletDrawCounts.back()*indexBytes == (const char*)(m.firstIndex*indexBytes))
+                meshletDrawCounts.back() += (GLsizei)m.indexCount;
+            else { meshletDrawCounts.push_back((GLsizei)m.indexCount); meshletDrawOffsets.push_back((const void*)(m.firstIndex*indexBytes)); }
+        }
+    }
+}
+
+// -------- Out-of-core chunked meshes (.smfc) --------
+// `--chunk=out.smfc` converts an .smf with convertToChunks() (mesh.h). Opening an .smfc streams it: chunks are paged in
+// on an I/O thread by visibility and distance, and prefetched along the camera's motion. The least recently used
+// chunks are evicted so the resident set stays under --mem-cap.
+size_t memCapBytes = 512u << 20;
+
+// Viewer side. The I/O thread only reads the file; GL objects and the LRU bookkeeping belong to the main thread.
+enum ChunkState { CHUNK_ABSENT, CHUNK_LOADING, CHUNK_RESIDENT };
+struct StreamChunk {
+    SMFCChunk info;
+    int state = CHUNK_ABSENT;
+    GLuint vbo = 0, ibo = 0, vao = 0;
+    uint64_t lastUsed = 0;    // frame number
+};
+struct ChunkData { uint32_t chunk; char* bytes; };
+static const int STREAM_MAX_INFLIGHT = 8;
+static const size_t STREAM_UPLOAD_BUDGET = 32u << 20;   // per frame
+static const float STREAM_PREFETCH_FRAMES = 20.0f;      // how far ahead the camera's motion is extrapolated
+struct StreamedMesh {
+    int fd = -1;
+    SMFCHeader hdr;
+    std::vector<StreamChunk> chunks;
+    SpscRing<uint32_t, 64> requests;
+    SpscRing<ChunkData, 64> arrived;
+    std::thread io;
+    int inflight = 0;
+    size_t residentBytes = 0, inflightBytes = 0;
+    uint64_t frame = 0;
+    bool havePrev = false;
+    ViewParams prev;
+    std::vector<uint32_t> visible;   // this frame's visible chunks, nearest first
+    size_t drawn = 0, missing = 0, evictions = 0, loads = 0;
+};
+StreamedMesh* streamMesh = nullptr;
+
+static void streamIoMain(StreamedMesh* S){
+    for(;;){
+        uint32_t c;
+        if(!S->requests.pop(c)){ std::this_thread::sleep_for(std::chrono::milliseconds(1)); continue; }
+        const SMFCChunk &info = S->chunks[c].info;
+        char* bytes = (char*)malloc(info.bytes);
+        if(bytes && pread(S->fd, bytes, info.bytes, (off_t)info.offset) != (ssize_t)info.bytes){ free(bytes); bytes = nullptr; }
+        while(!S->arrived.push({ c, bytes })) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+bool openStreamedMesh(const std::string &path){
+    StreamedMesh* S = new StreamedMesh();   // lives until exit, like its I/O thread
+    std::vector<SMFCChunk> table;
+    S->fd = openChunkFile(path, S->hdr, table);
+    if(S->fd < 0){ delete S; return false; }
+    size_t tooBig = 0;
+    S->chunks.resize(table.size());
+    for(size_t i=0;i<table.size();++i){ S->chunks[i].info = table[i]; tooBig += table[i].bytes > memCapBytes; }
+    if(tooBig) std::cerr << tooBig << " chunk(s) exceed --mem-cap and will never be drawn\n";
+    displayed.centroid = Vec3(S->hdr.centroid[0], S->hdr.centroid[1], S->hdr.centroid[2]);
+    displayed.modelScale = S->hdr.modelScale;
+    std::cout << "Streaming " << path << ": " << S->hdr.triCount << " tris in " << table.size() << " chunks, budget "
+              << memCapBytes / (1024*1024) << " MB\n";
+    S->io = std::thread(streamIoMain, S);
+    S->io.detach();
+    streamMesh = S;
+    return true;
+}
+
+static void evictChunk(StreamedMesh &S, StreamChunk &c){
+    glDeleteBuffers(1, &c.vbo); glDeleteBuffers(1, &c.ibo); glDeleteVertexArrays(1, &c.vao);
+    c.vbo = c.ibo = c.vao = 0;
+    c.state = CHUNK_ABSENT;
+    S.residentBytes -= c.info.bytes;
+    ++S.evictions;
+}
+
+// Object-space chunks visible from `vp`, nearest first.
+static void visibleChunks(const StreamedMesh &S, const ViewParams &vp, std::vector<std::pair<float, uint32_t>> &out){
+    out.clear();
+    Mat4 proj, view; cameraMatrices(vp, proj, view);
+    float planes[6][4]; frustumPlanes(proj * view * modelMatrix(displayed), planes);
+    Vec3 eyeWorld(vp.camRadius * cosf(vp.camAngle), vp.camRadius * sinf(vp.camAngle), vp.camHeight);
+    Vec3 eye = (eyeWorld + displayed.centroid) * (1.0f / displayed.modelScale);
+    for(uint32_t i=0;i<S.chunks.size();++i){
+        const SMFCChunk &c = S.chunks[i].info;
+        bool in = true;
+        for(int p=0;p<6 && in;++p) in = planes[p][0]*c.center[0] + planes[p][1]*c.center[1] + planes[p][2]*c.center[2] + planes[p][3] >= -c.radius;
+        if(in) out.push_back({ std::max(0.0f, len(Vec3(c.center[0], c.center[1], c.center[2]) - eye) - c.radius), i });
+    }
+    std::sort(out.begin(), out.end());
+}
+
+// Per frame: uploads arrived chunks, then requests what the current and the extrapolated view need, evicting the
+// least recently used chunks to stay under memCapBytes.
+void updateStream(const ViewParams &vp){
+    StreamedMesh &S = *streamMesh;
+    ++S.frame;
+    ChunkData d;
+    size_t uploaded = 0;
+    while(uploaded < STREAM_UPLOAD_BUDGET && S.arrived.pop(d)){
+        StreamChunk &c = S.chunks[d.chunk];
+        --S.inflight; S.inflightBytes -= c.info.bytes;
+        if(!d.bytes){ c.state = CHUNK_ABSENT; continue; }   // read failed; asked for again next frame
+        size_t vbytes = (size_t)c.info.vertexCount * 6 * sizeof(float);
+        size_t ioff = alignUp(c.info.offset + vbytes) - c.info.offset;
+        glGenBuffers(1, &c.vbo); glGenBuffers(1, &c.ibo);
+        glGenVertexArrays(1, &c.vao);
+        glBindVertexArray(c.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, c.vbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vbytes, d.bytes, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(ATTRIB_POS);
+        glVertexAttribPointer(ATTRIB_POS, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (void*)0);
+        glEnableVertexAttribArray(ATTRIB_NORM);
+        glVertexAttribPointer(ATTRIB_NORM, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (void*)(3*sizeof(float)));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, c.ibo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)c.info.indexCount * c.info.indexBytes, d.bytes + ioff, GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0); glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        free(d.bytes);
+        c.state = CHUNK_RESIDENT;
+        S.residentBytes += c.info.bytes;
+        uploaded += c.info.bytes;
+        ++S.loads;
+    }
+
+    std::vector<std::pair<float, uint32_t>> now, ahead;
+    visibleChunks(S, vp, now);
+    S.visible.clear();
+    for(auto &e : now){ S.visible.push_back(e.second); S.chunks[e.second].lastUsed = S.frame; }
+    if(S.havePrev){
+        ViewParams next = vp;
+        next.camAngle += (vp.camAngle - S.prev.camAngle) * STREAM_PREFETCH_FRAMES;
+        next.camRadius = std::max(0.2f, vp.camRadius + (vp.camRadius - S.prev.camRadius) * STREAM_PREFETCH_FRAMES);
+        next.camHeight += (vp.camHeight - S.prev.camHeight) * STREAM_PREFETCH_FRAMES;
+        if(next.camAngle != vp.camAngle || next.camRadius != vp.camRadius || next.camHeight != vp.camHeight) visibleChunks(S, next, ahead);
+    }
+    S.prev = vp; S.havePrev = true;
+
+    // visible chunks first (nearest first), then the prefetch set; stop at the first one that does not fit
+    auto want = [&](uint32_t i){
+        StreamChunk &c = S.chunks[i];
+        if(c.state != CHUNK_ABSENT) return true;
+        if(c.info.bytes > memCapBytes) return true;
+        if(S.inflight >= STREAM_MAX_INFLIGHT) return false;
+        while(S.residentBytes + S.inflightBytes + c.info.bytes > memCapBytes){
+            StreamChunk* lru = nullptr;
+            for(StreamChunk &o : S.chunks)
+                if(o.state == CHUNK_RESIDENT && o.lastUsed < S.frame && (!lru || o.lastUsed < lru->lastUsed)) lru = &o;
+            if(!lru) return false;
+            evictChunk(S, *lru);
+        }
+        if(!S.requests.push(i)) return false;
+        c.state = CHUNK_LOADING;
+        ++S.inflight; S.inflightBytes += c.info.bytes;
+        return true;
+    };
+    bool room = true;
+    for(size_t k=0; k<now.size() && room; ++k) room = want(now[k].second);
+    for(size_t k=0; k<ahead.size() && room; ++k){
+        if(S.chunks[ahead[k].second].state == CHUNK_RESIDENT) continue;
+        S.chunks[ahead[k].second].lastUsed = S.frame;   // keep prefetched chunks from being evicted right away
+        room = want(ahead[k].second);
+    }
+}
+
+// Draws the resident visible chunks with the program already bound.
+void drawStreamChunks(){
+    StreamedMesh &S = *streamMesh;
+    S.drawn = S.missing = 0;
+    for(uint32_t i : S.visible){
+        const StreamChunk &c = S.chunks[i];
+        if(c.state != CHUNK_RESIDENT){ ++S.missing; continue; }
+        glBindVertexArray(c.vao);
+        glDrawElements(GL_TRIANGLES, (GLsizei)c.info.indexCount, c.info.indexBytes == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)0);
+        ++S.drawn;
+        trisDrawn += c.info.indexCount / 3;
+    }
+    glBindVertexArray(0);
+}
+
+void streamHudLine(std::string &line){
+    const StreamedMesh &S = *streamMesh;
+    size_t resident = 0;
+    for(const StreamChunk &c : S.chunks) resident += c.state == CHUNK_RESIDENT;
+    char buf[192];
+    snprintf(buf, sizeof(buf), "Stream: %zu/%zu visible drawn (%zu missing), %zu/%zu resident, %.0f/%zu MB, peak RSS %.0f MB",
+             S.drawn, S.visible.size(), S.missing, resident, S.chunks.size(), S.residentBytes / (1024.0*1024.0),
+             memCapBytes / (1024*1024), peakRssMB());
+    line = buf;
+}
+
+// -------- Ray-traced light1 shadows --------
+// With --shadows, every vertex casts a ray towards light1 through the mesh BVH whenever the light or the mesh changed, and
+// the result feeds ATTRIB_SHADOW of the mesh VAO. The rays run on every core inside the frame, so their cost shows up
+// in the mesh phase of the profiler.
+GLuint vboShadow = 0;
+unsigned shadowGeneration = 0;      // meshGeneration the visibility was traced for (0: none yet)
+Vec3 shadowLight;
+std::vector<uint8_t> lightVisibility;
+double shadowTraceMs = 0;
+size_t shadowRays = 0;
+
+void updateShadows(const Vec3 &light1_obj){
+    if(!shadowsEnabled || !buffersReady || displayed.bvh.empty()) return;
+    bool newMesh = shadowGeneration != meshGeneration;
+    if(!newMesh && light1_obj.x == shadowLight.x && light1_obj.y == shadowLight.y && light1_obj.z == shadowLight.z) return;
+    auto t0 = std::chrono::steady_clock::now();
+    shadowRays = traceLightVisibility(meshView(displayed), displayed.modelScale, displayed.bvh, light1_obj, workerCount(), lightVisibility);
+    shadowTraceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    shadowLight = light1_obj;
+    if(!vboShadow) glGenBuffers(1, &vboShadow);
+    glBindBuffer(GL_ARRAY_BUFFER, vboShadow);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)lightVisibility.size(), lightVisibility.data(), GL_STREAM_DRAW);
+    if(newMesh){
+        glBindVertexArray(meshVao);
+        glEnableVertexAttribArray(ATTRIB_SHADOW);
+        glVertexAttribPointer(ATTRIB_SHADOW, 1, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void*)0);
+        glBindVertexArray(0);
+        shadowGeneration = meshGeneration;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool shadowHudLine(std::string &line){
+    if(!shadowsEnabled || shadowGeneration == 0) return false;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "Shadows: %zu rays in %.2f ms (%.1f Mrays/s)", shadowRays, shadowTraceMs,
+             shadowTraceMs > 0 ? shadowRays / shadowTraceMs / 1000.0 : 0.0);
+    line = buf;
+    return true;
+}
+
+// -------- Deformation (wave / sculpt) --------
+// G (or --deform) cycles off -> wave -> sculpt. The wave ripples a vertical column of the model that circles its
+// centroid. In sculpt mode, a left drag raises the surface under the cursor and Shift+drag digs in. MeshDeformer
+// (mesh.h) moves the vertices and refreshes face and vertex normals only around them. The mesh is then drawn from a
+// ring of DEFORM_RING_SLOTS {pos, normal} buffers that share the IBO and AO buffer. A frame with changes moves on
+// to the next slot and uploads only the vertex pages changed since that slot was last written. That slot was
+// last drawn slots-1 frames ago, so the upload need not wait for the GPU. GL 2.1 has no persistent mapping; the
+// uploads are glBufferSubData calls. Sculpted edits live until the model is reloaded.
+enum { DEFORM_OFF = 0, DEFORM_WAVE = 1, DEFORM_SCULPT = 2 };
+int deformMode = DEFORM_OFF;
+static const int DEFORM_RING_SLOTS = 3;
+struct DeformSlot { GLuint vbo = 0, vao = 0; std::vector<uint64_t> pending; };   // pending: dirty pages not yet in vbo
+struct DeformRing {
+    DeformSlot slots[DEFORM_RING_SLOTS];
+    int current = 0;
+    unsigned generation = 0;      // meshGeneration the ring was filled from (0: none)
+    VertexLayout layout;
+    bool live() const { return generation != 0 && generation == meshGeneration; }
+};
+DeformRing deformRing;
+MeshDeformer deformer;
+std::chrono::steady_clock::time_point deformStart = std::chrono::steady_clock::now();
+// left button state for the brush; the surface point under the cursor is read back from the previous frame's depth
+bool brushDown = false, brushDig = false, brushHit = false;
+int brushX = 0, brushY = 0;
+Vec3 brushPoint;
+struct DeformStats {
+    size_t moved = 0, normals = 0, ranges = 0, uploadBytes = 0;
+    double cpuMs = 0, uploadMs = 0;
+    size_t windowVerts = 0; double windowStart = 0, rate = 0;   // vertex updates/s over the last half second
+} deformStats;
+
+static void deleteDeformRing(){
+    for(DeformSlot &s : deformRing.slots){
+        if(s.vbo) glDeleteBuffers(1, &s.vbo);
+        if(s.vao) glDeleteVertexArrays(1, &s.vao);
+        s = DeformSlot();
+    }
+    deformRing.generation = 0;
+}
+
+// Fills every slot with the displayed mesh. Needs the CPU-side vertices and adjacency, which a cache load skips.
+static bool createDeformRing(){
+    if(!buffersReady || residentIndices < (size_t)triCount*3 || streamMesh) return false;
+    ensureCPUMesh(displayed);
+    if(displayed.vertexFaces.vertexCount() != displayed.vertices.size()) buildVertexAdjacency(displayed.vertexFaces, displayed.triangles, displayed.vertices.size());
+    deformer.reset(displayed.vertices, displayed.triangles.size());
+    VertexLayout &vl = deformRing.layout;
+    vl = VertexLayout();
+    vl.stride = sizeof(Vertex); vl.normOffset = offsetof(Vertex, n); vl.indexType = vboLayout.indexType;
+    bool ao = meshView(displayed).ao != nullptr;
+    for(DeformSlot &s : deformRing.slots){
+        glGenBuffers(1, &s.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, s.vbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(displayed.vertices.size()*sizeof(Vertex)), displayed.vertices.data(), GL_DYNAMIC_DRAW);
+        glGenVertexArrays(1, &s.vao);
+        glBindVertexArray(s.vao);
+        glEnableVertexAttribArray(ATTRIB_POS);
+        glVertexAttribPointer(ATTRIB_POS, 3, GL_FLOAT, GL_FALSE, vl.stride, (void*)vl.posOffset);
+        glEnableVertexAttribArray(ATTRIB_NORM);
+        glVertexAttribPointer(ATTRIB_NORM, 3, GL_FLOAT, GL_FALSE, vl.stride, (void*)vl.normOffset);
+        if(ao){
+            glBindBuffer(GL_ARRAY_BUFFER, vboAo);
+            glEnableVertexAttribArray(ATTRIB_AO);
+            glVertexAttribPointer(ATTRIB_AO, 1, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void*)0);
+        }
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        glBindVertexArray(0);
+        s.pending.assign(deformer.dirtyPages.size(), 0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0); glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    deformRing.current = 0;
+    deformRing.generation = meshGeneration;
+    return true;
+}
+
+// Applies this frame's wave or brush step and uploads the changes into the next slot. Returns the VAO to draw, or 0
+// for the static buffers (no deformation since the mesh was loaded).
+static GLuint updateDeformation(){
+    if(deformRing.generation != 0 && !deformRing.live()){ deleteDeformRing(); deformer.clear(); }   // the mesh was replaced
+    if(!deformRing.live() && (deformMode == DEFORM_OFF || !createDeformRing())) return 0;
+    DeformStats &d = deformStats;
+    auto t0 = std::chrono::steady_clock::now();
+    float radius = 1.0f / displayed.modelScale, t = std::chrono::duration<float>(t0 - deformStart).count();
+    if(deformMode == DEFORM_WAVE)
+        deformer.wave(displayed.vertices, waveCenter(displayed.centroid, radius, t), WAVE_RADIUS * radius, WAVE_AMPLITUDE * radius, WAVE_SPEED * t);
+    else deformer.relax(displayed.vertices);
+    if(deformMode == DEFORM_SCULPT && brushDown && brushHit)
+        deformer.brush(displayed.vertices, brushPoint, BRUSH_RADIUS * radius, (brushDig ? -BRUSH_STRENGTH : BRUSH_STRENGTH) * radius);
+    d.moved = deformer.moved.size();
+    deformer.updateNormals(displayed.vertices, displayed.triangles, displayed.vertexFaces, normalWeighting);
+    d.normals = deformer.touched.size();
+    auto t1 = std::chrono::steady_clock::now();
+    d.cpuMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    d.ranges = d.uploadBytes = 0;
+    std::vector<uint64_t> &dirty = deformer.dirtyPages;
+    if(std::any_of(dirty.begin(), dirty.end(), [](uint64_t w){ return w != 0; })){
+        for(DeformSlot &s : deformRing.slots)
+            for(size_t i=0;i<dirty.size();++i) s.pending[i] |= dirty[i];
+        std::fill(dirty.begin(), dirty.end(), 0);
+        deformRing.current = (deformRing.current + 1) % DEFORM_RING_SLOTS;
+        DeformSlot &s = deformRing.slots[deformRing.current];
+        static std::vector<std::pair<size_t, size_t>> runs;
+        dirtyVertexRuns(s.pending, displayed.vertices.size(), runs);
+        glBindBuffer(GL_ARRAY_BUFFER, s.vbo);
+        for(const auto &r : runs){
+            size_t bytes = (r.second - r.first) * sizeof(Vertex);
+            glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(r.first * sizeof(Vertex)), (GLsizeiptr)bytes, &displayed.vertices[r.first]);
+            d.uploadBytes += bytes;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        std::fill(s.pending.begin(), s.pending.end(), 0);
+        d.ranges = runs.size();
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    d.uploadMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    double now = std::chrono::duration<double>(t2 - deformStart).count();
+    d.windowVerts += d.moved;
+    if(now - d.windowStart >= 0.5){ d.rate = d.windowVerts / (now - d.windowStart); d.windowVerts = 0; d.windowStart = now; }
+    return deformRing.slots[deformRing.current].vao;
+}
+
+// Reads the depth under the cursor right after the mesh was drawn and unprojects it with the mesh's modelview.
+static void pickBrushPoint(const Mat4 &mv){
+    GLfloat z = 1.0f;
+    int wy = winH - 1 - brushY;
+    glReadPixels(brushX, wy, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &z);
+    brushHit = false;
+    if(z >= 1.0f) return;   // background
+    GLdouble M[16], P[16], x, y, oz;
+    GLint viewport[4] = { 0, 0, winW, winH };
+    for(int i=0;i<16;++i){ M[i] = mv.m[i]; P[i] = cameraProj.m[i]; }
+    if(gluUnProject(brushX + 0.5, wy + 0.5, z, M, P, viewport, &x, &y, &oz) == GL_TRUE){
+        brushPoint = Vec3((float)x, (float)y, (float)oz);
+        brushHit = true;
+    }
+}
+
+// -------- Draw mesh (flat, Gouraud and Phong programs over the shared VBOs) --------
 void drawMesh(){
     glPushMatrix();
-    glTranslatef(-centroid.x, -centroid.y, -centroid.z);
-    glScalef(modelScale, modelScale, modelScale);
+    glTranslatef(-displayed.centroid.x, -displayed.centroid.y, -displayed.centroid.z);
+    glScalef(displayed.modelScale, displayed.modelScale, displayed.modelScale);
 
     // compute object-space rotating light position using current lightAngle/radius/height
-    float la = lightAngle;
-    Vec3 light1_obj = Vec3(lightRadius * cosf(la), lightRadius * sinf(la), lightHeight);
-
-    if(shadeMode == 1){
-        // Flat shading with face normal color
-        glUseProgram(0);
-        glShadeModel(GL_FLAT);
-        glBegin(GL_TRIANGLES);
-        for(auto &t : triangles){
-            Vec3 fn = normalize(t.fn);
-            glColor3f(fabs(fn.x), fabs(fn.y), fabs(fn.z));
-            glNormal3f(fn.x, fn.y, fn.z);
-            Vec3 &A = vertices[t.a].p; glVertex3f(A.x, A.y, A.z);
-            Vec3 &B = vertices[t.b].p; glVertex3f(B.x, B.y, B.z);
-            Vec3 &C = vertices[t.c].p; glVertex3f(C.x, C.y, C.z);
+    Vec3 light1_obj = cylinderLightPos(lightAngle, lightRadius, lightHeight);
+
+    bool rig = rigLightCount > 0 && shadeMode != 1;
+    ShaderProgram &prog = programFor(shadeMode, false, rig);
+    glUseProgram(prog.id);
+    Mat4 mv = cameraView * modelMatrix(displayed);
+    if(rig){
+        placeRigLights(lightAngle, lightRadius, lightHeight);
+        updateClusters(mv, cameraProj);
+        setClusterUniforms(prog);
+    }
+    GLuint deformVao = updateDeformation();
+    const VertexLayout &vl = deformVao ? deformRing.layout : vboLayout;
+    setCommonUniforms(prog, mv, cameraProj, vl);
+    // material uniforms
+    Material &m = materials[materialIndex];
+    prog.set(U_MAT_AMBIENT, m.ambient);
+    prog.set(U_MAT_DIFFUSE, m.diffuse);
+    prog.set(U_MAT_SPECULAR, m.specular);
+    prog.set(U_MAT_SHININESS, m.shininess);
+
+    setLightUniforms(prog, mv, light1_obj, shadeMode == 1);
+    resetOcclusionAttribs();
+    if(!rig && shadeMode != 1) updateShadows(light1_obj);
+
+    trisDrawn = 0;
+    if(streamMesh){
+        updateStream(currentViewParams());
+        drawStreamChunks();
+    }
+    glBindVertexArray(deformVao ? deformVao : meshVao);
+    bool partial = residentIndices < (size_t)triCount*3;   // first load still uploading: draw what has arrived
+    // LOD errors and meshlet bounds describe the loaded shape, so a deformed mesh is drawn whole
+    activeLod = partial || deformVao ? 0 : selectLod(currentViewParams(), activeLod);
+    GLsizei count = triCount*3; size_t first = 0;
+    if(partial) count = (GLsizei)residentIndices;
+    else if(activeLod < (int)displayed.lodLevels.size()){ count = (GLsizei)displayed.lodLevels[activeLod].indexCount; first = displayed.lodLevels[activeLod].firstIndex; }
+    if(!buffersReady){
+        // nothing to draw from the shared VBOs (still loading, or an out-of-core model)
+    } else if(activeLod == 0 && meshletCull.count > 0 && !partial && !deformVao){
+        cullMeshlets(currentViewParams(), vl.indexType);
+        for(GLsizei n : meshletDrawCounts) trisDrawn += n / 3;
+        if(!meshletDrawCounts.empty())
+            glMultiDrawElements(GL_TRIANGLES, meshletDrawCounts.data(), vl.indexType, meshletDrawOffsets.data(), (GLsizei)meshletDrawCounts.size());
+    } else if(count > 0){
+        trisDrawn += count / 3;
+        glDrawElements(GL_TRIANGLES, count, vl.indexType, (void*)(first * (vl.indexType == GL_UNSIGNED_SHORT ? 2 : 4)));
+    }
+    glBindVertexArray(0);
+    glUseProgram(0);
+    if(deformVao && deformMode == DEFORM_SCULPT && brushDown) pickBrushPoint(mv);   // before the light marker writes depth
+
+    // Draw the light markers in object coordinates: a cube for light1, points for the rig
+    glDisable(GL_LIGHTING);
+    if(rig){
+        glPointSize(4.0f);
+        glBegin(GL_POINTS);
+        for(const RigLight &l : rigLights){   // full-brightness hue, whatever the intensity
+            glColor3f(l.color[0] / l.specular, l.color[1] / l.specular, l.color[2] / l.specular);
+            glVertex3f(l.pos.x, l.pos.y, l.pos.z);
         }
         glEnd();
     } else {
-        // Shader path (Gouraud or Phong)
-        GLuint prog = (shadeMode==2)?progGouraud:progPhong;
-        glUseProgram(prog);
-        setCommonUniforms(prog);
-        // material uniforms
-        Material &m = materials[materialIndex];
-        GLint loc;
-        loc = glGetUniformLocation(prog,"material_ambient"); if(loc>=0) glUniform4fv(loc,1,m.ambient);
-        loc = glGetUniformLocation(prog,"material_diffuse"); if(loc>=0) glUniform4fv(loc,1,m.diffuse);
-        loc = glGetUniformLocation(prog,"material_specular"); if(loc>=0) glUniform4fv(loc,1,m.specular);
-        loc = glGetUniformLocation(prog,"material_shininess"); if(loc>=0) glUniform1f(loc,m.shininess);
+        glPushMatrix();
+        glTranslatef(light1_obj.x, light1_obj.y, light1_obj.z);
+        float k = 0.03f / displayed.modelScale;
+        glScalef(k, k, k);
+        glColor3f(1.0f, 0.6f, 0.2f);
+        glutSolidCube(1.0);
+        glPopMatrix();
+    }
+    glEnable(GL_LIGHTING);
 
-        // Light0: camera-space near eye
-        float light0_eye[3] = { 0.0f, 0.0f, 1.5f };
-        loc = glGetUniformLocation(prog,"light0_pos_eye"); if(loc>=0) glUniform3fv(loc,1,light0_eye);
-        float l0amb[4]={0.2f,0.2f,0.2f,1.0f}, l0dif[4]={0.6f,0.6f,0.6f,1.0f}, l0spec[4]={1.0f,1.0f,1.0f,1.0f};
-        loc = glGetUniformLocation(prog,"light0_ambient"); if(loc>=0) glUniform4fv(loc,1,l0amb);
-        loc = glGetUniformLocation(prog,"light0_diffuse"); if(loc>=0) glUniform4fv(loc,1,l0dif);
-        loc = glGetUniformLocation(prog,"light0_specular"); if(loc>=0) glUniform4fv(loc,1,l0spec);
-
-        // Light1: object-space light transformed to eye coords using current MODELVIEW (we are in model transform now)
-        // get current modelview
-        GLfloat mv[16]; glGetFloatv(GL_MODELVIEW_MATRIX, mv);
-        // multiply mv * vec4(light1_obj, 1.0)
-        float lx = mv[0]*light1_obj.x + mv[4]*light1_obj.y + mv[8]*light1_obj.z + mv[12];
-        float ly = mv[1]*light1_obj.x + mv[5]*light1_obj.y + mv[9]*light1_obj.z + mv[13];
-        float lz = mv[2]*light1_obj.x + mv[6]*light1_obj.y + mv[10]*light1_obj.z + mv[14];
-        float light1_eye[3] = { lx, ly, lz };
-        loc = glGetUniformLocation(prog,"light1_pos_eye"); if(loc>=0) glUniform3fv(loc,1,light1_eye);
-        float l1amb[4]={0.0f,0.0f,0.0f,1.0f}, l1dif[4]={0.8f,0.5f,0.2f,1.0f}, l1spec[4]={0.8f,0.8f,0.8f,1.0f};
-        loc = glGetUniformLocation(prog,"light1_ambient"); if(loc>=0) glUniform4fv(loc,1,l1amb);
-        loc = glGetUniformLocation(prog,"light1_diffuse"); if(loc>=0) glUniform4fv(loc,1,l1dif);
-        loc = glGetUniformLocation(prog,"light1_specular"); if(loc>=0) glUniform4fv(loc,1,l1spec);
-
-        // attribute locations
-        GLint posLoc = glGetAttribLocation(prog, "inPos");
-        GLint normLoc = glGetAttribLocation(prog, "inNorm");
-
-        if(posLoc>=0){
-            glEnableVertexAttribArray((GLuint)posLoc);
-            glBindBuffer(GL_ARRAY_BUFFER, vboPos);
-            glVertexAttribPointer((GLuint)posLoc, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glPopMatrix();
+}
+
+// -------- Scenes (instanced) --------
+// A scene file lists meshes, each followed by its instances; every mesh is drawn with one instanced call.
+//   mesh PATH                                  (relative to the scene file)
+//   instance X Y Z [SCALE [ROTZ_DEG [MATERIAL]]]
+//   scatter COUNT EXTENT [MINSCALE MAXSCALE [SEED]]   random positions in [-EXTENT,EXTENT]^3, Z rotations, materials cycle
+// Instance transforms apply to the mesh after centering it and scaling it to unit radius.
+struct InstanceSpec { float pos[3], scale, rotZ; int material; };
+struct InstanceData { float c[4][3]; float material; };   // object -> world columns (normalization baked in)
+struct SceneMesh {
+    std::string path;
+    std::vector<InstanceSpec> specs;
+    GLuint vboPos=0, vboNorm=0, ibo=0, vao=0, instanceVbo=0;
+    VertexLayout layout;
+    GLsizei indexCount=0;
+};
+std::vector<SceneMesh> scene;
+size_t sceneInstances = 0, sceneTris = 0, sceneDrawCalls = 0;
+
+static uint32_t xorshift32(uint32_t &s){ s ^= s << 13; s ^= s >> 17; s ^= s << 5; return s; }
+static float randUnit(uint32_t &s){ return (xorshift32(s) >> 8) * (1.0f / 16777216.0f); }
+
+bool parseScene(const std::string &path, std::vector<SceneMesh> &out){
+    std::ifstream in(path);
+    if(!in){ std::cerr << "Cannot open scene " << path << "\n"; return false; }
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    std::string line;
+    int lineNo = 0;
+    while(std::getline(in, line)){
+        ++lineNo;
+        size_t hash = line.find('#');
+        if(hash != std::string::npos) line.erase(hash);
+        std::istringstream ls(line);
+        std::string cmd; if(!(ls >> cmd)) continue;
+        bool ok = true;
+        if(cmd == "mesh"){
+            std::string p; ok = (bool)(ls >> p);
+            if(ok){ SceneMesh m; m.path = (p[0] == '/' || dir.empty()) ? p : dir + p; out.push_back(m); }
+        } else if(out.empty()){
+            std::cerr << path << ":" << lineNo << ": '" << cmd << "' before any 'mesh'\n"; return false;
+        } else if(cmd == "instance"){
+            InstanceSpec s = { {0,0,0}, 1.0f, 0.0f, 0 };
+            ok = (bool)(ls >> s.pos[0] >> s.pos[1] >> s.pos[2]);
+            float scale, rotDeg; int material;   // optional trailing fields (a failed >> would zero the target)
+            if(ok && (ls >> scale)){ s.scale = scale; if(ls >> rotDeg){ s.rotZ = rotDeg * 3.14159265358979f / 180.0f; if(ls >> material) s.material = material; } }
+            ok = ok && s.material >= 0 && s.material < MATERIAL_COUNT;
+            if(ok) out.back().specs.push_back(s);
+        } else if(cmd == "scatter"){
+            long count = 0; float extent = 1.0f, smin = 0.05f, smax = 0.05f; uint32_t seed = 1;
+            ok = (bool)(ls >> count >> extent) && count > 0;
+            float lo, hi; uint32_t sd;
+            if(ok && (ls >> lo >> hi)){ smin = lo; smax = hi; if(ls >> sd) seed = sd; }
+            seed = seed * 2654435761u + 0x9E3779B9u;   // spread small seeds before xorshift
+            if(seed == 0) seed = 1;
+            for(long i=0; ok && i<count; ++i){
+                InstanceSpec s;
+                for(float &p : s.pos) p = (2.0f * randUnit(seed) - 1.0f) * extent;
+                s.scale = smin + (smax - smin) * randUnit(seed);
+                s.rotZ = 6.28318530718f * randUnit(seed);
+                s.material = (int)(out.back().specs.size() % MATERIAL_COUNT);
+                out.back().specs.push_back(s);
+            }
+        } else ok = false;
+        if(!ok){ std::cerr << path << ":" << lineNo << ": bad scene line: " << line << "\n"; return false; }
+    }
+    if(out.empty()){ std::cerr << "Scene " << path << " has no meshes\n"; return false; }
+    return true;
+}
+
+// Loads every mesh through the normal loader/buffer path, then takes over its GL objects and adds the
+// per-instance attribute buffer (divisor 1) to its VAO.
+bool loadSceneBuffers(std::vector<SceneMesh> &meshes){
+    sceneInstances = sceneTris = 0;
+    for(SceneMesh &m : meshes){
+        if(!loadMesh(m.path)) return false;
+        buildBuffers();
+        m.vboPos = vboPos; m.vboNorm = vboNorm; m.ibo = ibo; m.vao = meshVao;
+        m.layout = vboLayout; m.indexCount = triCount*3;
+        vboPos = vboNorm = ibo = meshVao = 0; buffersReady = false;
+
+        std::vector<InstanceData> data(m.specs.size());
+        for(size_t i=0;i<m.specs.size();++i){
+            const InstanceSpec &s = m.specs[i];
+            float k = s.scale * displayed.modelScale, cr = cosf(s.rotZ), sr = sinf(s.rotZ);
+            float cols[3][3] = { { cr*k, sr*k, 0 }, { -sr*k, cr*k, 0 }, { 0, 0, k } };
+            InstanceData &d = data[i];
+            for(int c=0;c<3;++c) for(int r=0;r<3;++r) d.c[c][r] = cols[c][r];
+            for(int r=0;r<3;++r) d.c[3][r] = s.pos[r] - (cols[0][r]*displayed.centroid.x + cols[1][r]*displayed.centroid.y + cols[2][r]*displayed.centroid.z);
+            d.material = (float)s.material;
         }
-        if(normLoc>=0){
-            glEnableVertexAttribArray((GLuint)normLoc);
-            glBindBuffer(GL_ARRAY_BUFFER, vboNorm);
-            glVertexAttribPointer((GLuint)normLoc, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+        glGenBuffers(1, &m.instanceVbo);
+        glBindVertexArray(m.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, m.instanceVbo);
+        glBufferData(GL_ARRAY_BUFFER, data.size()*sizeof(InstanceData), data.data(), GL_STATIC_DRAW);
+        for(int c=0;c<4;++c){
+            glEnableVertexAttribArray(ATTRIB_INST_C0 + c);
+            glVertexAttribPointer(ATTRIB_INST_C0 + c, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, c) + c*3*sizeof(float)));
+            glVertexAttribDivisorARB(ATTRIB_INST_C0 + c, 1);
         }
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-        glDrawElements(GL_TRIANGLES, triCount*3, GL_UNSIGNED_INT, (void*)0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glEnableVertexAttribArray(ATTRIB_INST_MATERIAL);
+        glVertexAttribPointer(ATTRIB_INST_MATERIAL, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, material));
+        glVertexAttribDivisorARB(ATTRIB_INST_MATERIAL, 1);
+        glBindVertexArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-        if(posLoc>=0) glDisableVertexAttribArray((GLuint)posLoc);
-        if(normLoc>=0) glDisableVertexAttribArray((GLuint)normLoc);
-        glUseProgram(0);
+        sceneInstances += m.specs.size();
+        sceneTris += m.specs.size() * (size_t)triCount;
+        std::cout << "Scene mesh " << m.path << ": " << m.specs.size() << " instances ("
+                  << data.size()*sizeof(InstanceData) / 1024.0 << " KB instance buffer)\n";
     }
+    return true;
+}
+
+void drawScene(){
+    ShaderProgram &prog = programFor(shadeMode, true);
+    glUseProgram(prog.id);
+    float amb[4*MATERIAL_COUNT], dif[4*MATERIAL_COUNT], spe[4*MATERIAL_COUNT], shi[MATERIAL_COUNT];
+    for(int i=0;i<MATERIAL_COUNT;++i){
+        const Material &m = materials[i];
+        memcpy(&amb[4*i], m.ambient, sizeof(m.ambient)); memcpy(&dif[4*i], m.diffuse, sizeof(m.diffuse));
+        memcpy(&spe[4*i], m.specular, sizeof(m.specular)); shi[i] = m.shininess;
+    }
+    prog.set(U_MAT_AMBIENTS, amb); prog.set(U_MAT_DIFFUSES, dif);
+    prog.set(U_MAT_SPECULARS, spe); prog.set(U_MAT_SHININESSES, shi);
+    // instances live in world space; light1 moves on its cylinder in world coordinates
+    Vec3 light1_world = cylinderLightPos(lightAngle, lightRadius, lightHeight);
+    setLightUniforms(prog, cameraView, light1_world, shadeMode == 1);
+    resetOcclusionAttribs();
+
+    sceneDrawCalls = 0;
+    trisDrawn = sceneTris;
+    for(const SceneMesh &m : scene){
+        if(m.specs.empty()) continue;
+        setCommonUniforms(prog, cameraView, cameraProj, m.layout);
+        glBindVertexArray(m.vao);
+        glDrawElementsInstancedARB(GL_TRIANGLES, m.indexCount, m.layout.indexType, (void*)0, (GLsizei)m.specs.size());
+        ++sceneDrawCalls;
+    }
+    glBindVertexArray(0);
+    glUseProgram(0);
 
-    // Draw the light marker cube in object coordinates
     glPushMatrix();
-        glTranslatef(light1_obj.x, light1_obj.y, light1_obj.z);
-        glScalef(0.03f / modelScale, 0.03f / modelScale, 0.03f / modelScale);
+        glTranslatef(light1_world.x, light1_world.y, light1_world.z);
+        glScalef(0.03f, 0.03f, 0.03f);
         glDisable(GL_LIGHTING);
         glColor3f(1.0f, 0.6f, 0.2f);
         glutSolidCube(1.0);
         glEnable(GL_LIGHTING);
     glPopMatrix();
-
-    glPopMatrix();
 }
 
 // -------- HUD overlay (translucent box + text) --------
-void drawOverlay(const std::vector<std::string> &lines){
-    // Save state
+// The GLUT bitmap font is rasterized once into a texture atlas (ASCII 32..126 in 24 px cells; the cell of 127 is solid
+// and textures the box). The whole overlay is one buffer of textured quads, rebuilt only when a line's text or the
+// window size changed and drawn with a single glDrawArrays. Lines are written into persistent strings, so a steady
+// HUD allocates and uploads nothing per frame.
+static const int GLYPH_FIRST = 32, GLYPH_COUNT = 96, GLYPH_COLS = 16;
+static const int GLYPH_CELL = 24, GLYPH_PAD = 3, GLYPH_BASELINE = 6;   // px; pen origin inside a cell
+static const int ATLAS_W = GLYPH_COLS * GLYPH_CELL, ATLAS_H = GLYPH_COUNT / GLYPH_COLS * GLYPH_CELL;
+static const double HUD_STATS_SECONDS = 0.5;   // FPS and profiler lines refresh this often, not every frame
+
+struct HudVertex { float x, y, u, v; uint8_t rgba[4]; };
+
+struct HudText {
+    GLuint atlas = 0, vbo = 0;
+    int advance[GLYPH_COUNT] = {};
+    std::vector<std::string> lines;   // this frame's text; slots are reused across frames
+    size_t used = 0;
+    bool dirty = true;
+    int layoutW = 0, layoutH = 0;     // window size the buffer was laid out for
+    std::vector<HudVertex> verts;
+    GLsizei vertexCount = 0;
+    // live stats, sampled every HUD_STATS_SECONDS
+    std::chrono::steady_clock::time_point statsStart = std::chrono::steady_clock::now();
+    unsigned statsFrames = 0;
+    bool statsFresh = true;           // the stats were resampled this frame
+    double fps = 0, frameMs = 0;
+
+    void begin(){
+        used = 0;
+        ++statsFrames;
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - statsStart).count();
+        statsFresh = s >= HUD_STATS_SECONDS;
+        if(statsFresh){
+            fps = statsFrames / s; frameMs = 1000.0 * s / statsFrames;
+            statsFrames = 0; statsStart = std::chrono::steady_clock::now();
+        }
+    }
+    void add(const char* s, size_t n){
+        if(used == lines.size()){ lines.emplace_back(); dirty = true; }
+        std::string &l = lines[used++];
+        if(l.size() != n || l.compare(0, n, s, n) != 0){ l.assign(s, n); dirty = true; }
+    }
+    void add(const char* s){ add(s, strlen(s)); }
+    void add(const std::string &s){ add(s.data(), s.size()); }
+    void addf(const char* fmt, ...){
+        char buf[256];
+        va_list ap; va_start(ap, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        add(buf, (size_t)std::min(std::max(n, 0), (int)sizeof(buf) - 1));
+    }
+    void end(){ if(used != lines.size()){ lines.resize(used); dirty = true; } }
+};
+HudText hud;
+
+// Draws every glyph into the bottom-left corner of the back buffer and copies that into the atlas. Called at the
+// start of a frame, before the clear; waits for a window at least as large as the atlas.
+bool buildGlyphAtlas(HudText &H){
+    if(winW < ATLAS_W || winH < ATLAS_H) return false;
+    glMatrixMode(GL_PROJECTION); glLoadMatrixf(mat4Ortho(0, (float)winW, 0, (float)winH, -1, 1).m);
+    glMatrixMode(GL_MODELVIEW); glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glColor3f(1.0f, 1.0f, 1.0f);
+    for(int i=0;i<GLYPH_COUNT;++i){
+        int x = i % GLYPH_COLS * GLYPH_CELL, y = i / GLYPH_COLS * GLYPH_CELL;
+        if(GLYPH_FIRST + i == 127){ glRecti(x, y, x + GLYPH_CELL, y + GLYPH_CELL); continue; }
+        glRasterPos2i(x + GLYPH_PAD, y + GLYPH_BASELINE);
+        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, GLYPH_FIRST + i);
+        H.advance[i] = glutBitmapWidth(GLUT_BITMAP_HELVETICA_18, GLYPH_FIRST + i);
+    }
+    glGenTextures(1, &H.atlas);
+    glBindTexture(GL_TEXTURE_2D, H.atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_INTENSITY8, 0, 0, ATLAS_W, ATLAS_H, 0);   // alpha = coverage
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenBuffers(1, &H.vbo);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_DEPTH_TEST);
+    H.dirty = true;
+    return true;
+}
+
+// Same placement as the former per-character path: box over 58..98% x 18..96% of the window, lines 5% apart.
+void layoutHud(HudText &H){
+    H.verts.clear();
+    auto quad = [&](float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const uint8_t* c){
+        HudVertex q[4] = { { x0, y0, u0, v0, {} }, { x1, y0, u1, v0, {} }, { x1, y1, u1, v1, {} }, { x0, y1, u0, v1, {} } };
+        for(HudVertex &v : q){ memcpy(v.rgba, c, 4); H.verts.push_back(v); }
+    };
+    static const uint8_t boxColor[4] = { 0, 0, 0, 158 }, textColor[4] = { 255, 255, 255, 255 };
+    const float du = (float)GLYPH_CELL / ATLAS_W, dv = (float)GLYPH_CELL / ATLAS_H;
+    float su = (127 - GLYPH_FIRST) % GLYPH_COLS * du + du * 0.5f, sv = (127 - GLYPH_FIRST) / GLYPH_COLS * dv + dv * 0.5f;
+    quad(0.58f*winW, 0.18f*winH, 0.98f*winW, 0.96f*winH, su, sv, su, sv, boxColor);
+    float y = 0.92f*winH;
+    for(const std::string &s : H.lines){
+        float pen = floorf(0.60f*winW), base = floorf(y);
+        for(unsigned char c : s){
+            int g = (c >= GLYPH_FIRST && c < 127 ? c : '?') - GLYPH_FIRST;
+            if(c != ' '){
+                float x0 = pen - GLYPH_PAD, y0 = base - GLYPH_BASELINE;
+                float u0 = g % GLYPH_COLS * du, v0 = g / GLYPH_COLS * dv;
+                quad(x0, y0, x0 + GLYPH_CELL, y0 + GLYPH_CELL, u0, v0, u0 + du, v0 + dv, textColor);
+            }
+            pen += H.advance[g];
+        }
+        y -= 0.05f*winH;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, H.vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(H.verts.size() * sizeof(HudVertex)), H.verts.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    H.vertexCount = (GLsizei)H.verts.size();
+    H.layoutW = winW; H.layoutH = winH;
+    H.dirty = false;
+}
+
+// Leaves an ortho projection loaded: setupCamera() reloads both matrices at the start of the next frame.
+void drawOverlay(HudText &H){
+    glMatrixMode(GL_PROJECTION); glLoadMatrixf(mat4Ortho(0, (float)winW, 0, (float)winH, -1, 1).m);
+    glMatrixMode(GL_MODELVIEW); glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    if(H.atlas){
+        if(H.dirty || H.layoutW != winW || H.layoutH != winH) layoutHud(H);
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, H.atlas);
+        glBindBuffer(GL_ARRAY_BUFFER, H.vbo);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(HudVertex), (void*)offsetof(HudVertex, x));
+        glTexCoordPointer(2, GL_FLOAT, sizeof(HudVertex), (void*)offsetof(HudVertex, u));
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(HudVertex), (void*)offsetof(HudVertex, rgba));
+        glDrawArrays(GL_QUADS, 0, H.vertexCount);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_TEXTURE_2D);
+    } else {   // window still smaller than the atlas: one glBitmap per character
+        glColor4f(0.0f, 0.0f, 0.0f, 0.62f);
+        glRectf(0.58f*winW, 0.18f*winH, 0.98f*winW, 0.96f*winH);
+        glColor3f(1.0f, 1.0f, 1.0f);
+        float y = 0.92f*winH;
+        for(const std::string &s : H.lines){
+            glRasterPos2f(0.60f*winW, y);
+            for(char c : s) glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
+            y -= 0.05f*winH;
+        }
+    }
+
+    glDisable(GL_BLEND);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_DEPTH_TEST);
+}
+
+// -------- Setup camera & projection --------
+// The CPU matrices are the single source of truth: fixed-function state is loaded from them and the shader
+// paths upload them directly.
+void setupCamera(){
+    cameraMatrices(currentViewParams(), cameraProj, cameraView);
+    glMatrixMode(GL_PROJECTION); glLoadMatrixf(cameraProj.m);
+    glMatrixMode(GL_MODELVIEW); glLoadMatrixf(cameraView.m);
+}
+
+// -------- Batch sweep rendering --------
+// Spec: entries separated by ';' or newlines, each "key=values". Values are a comma list or
+// "start:end:count" (count samples, both ends included). shade/material also accept "all".
+// Keys: camAngle camRadius camHeight lightAngle lightRadius lightHeight shade material.
+struct SweepAxis { std::string key; std::vector<float> values; };
+
+static bool parseSweepValues(const std::string &key, const std::string &text, std::vector<float> &out){
+    if(text == "all"){
+        if(key == "shade"){ out = { 1, 2, 3 }; return true; }
+        if(key == "material"){ for(size_t i=0;i<materials.size();++i) out.push_back((float)i); return true; }
+        return false;
+    }
+    float a, b; int n;
+    if(sscanf(text.c_str(), "%f:%f:%d", &a, &b, &n) == 3){
+        if(n < 1) return false;
+        for(int i=0;i<n;++i) out.push_back(n==1 ? a : a + (b-a)*i/(n-1));
+        return true;
+    }
+    std::stringstream ss(text); std::string item;
+    while(std::getline(ss, item, ',')){
+        if(key == "shade" && (item == "flat" || item == "gouraud" || item == "phong")){ out.push_back(item=="flat" ? 1.0f : item=="gouraud" ? 2.0f : 3.0f); continue; }
+        char* end = nullptr; float v = strtof(item.c_str(), &end);
+        if(end == item.c_str() || *end) return false;
+        out.push_back(v);
+    }
+    return !out.empty();
+}
+
+// `spec` is either the spec text itself or the path of a file containing it.
+bool parseSweepSpec(const std::string &spec, std::vector<SweepAxis> &axes){
+    static const char* keys[] = { "shade", "material", "camAngle", "camRadius", "camHeight", "lightAngle", "lightRadius", "lightHeight" };
+    std::string text = spec;
+    std::ifstream fin(spec);
+    if(fin.is_open()){ std::stringstream buf; buf << fin.rdbuf(); text = buf.str(); }
+    for(char &c : text) if(c == '\n') c = ';';
+    ViewParams vp = currentViewParams();
+    float defaults[] = { (float)vp.shadeMode, (float)vp.materialIndex, vp.camAngle, vp.camRadius, vp.camHeight, vp.lightAngle, vp.lightRadius, vp.lightHeight };
+    axes.clear();
+    for(int i=0;i<8;++i) axes.push_back({ keys[i], { defaults[i] } });
+    std::stringstream ss(text); std::string entry;
+    while(std::getline(ss, entry, ';')){
+        entry.erase(std::remove_if(entry.begin(), entry.end(), [](char c){ return isBlank(c); }), entry.end());
+        if(entry.empty() || entry[0] == '#') continue;
+        size_t eq = entry.find('=');
+        std::string key = entry.substr(0, eq);
+        auto it = std::find_if(axes.begin(), axes.end(), [&](const SweepAxis &ax){ return ax.key == key; });
+        std::vector<float> values;
+        if(eq == std::string::npos || it == axes.end() || !parseSweepValues(key, entry.substr(eq+1), values)){
+            std::cerr << "Bad sweep entry: " << entry << "\n"; return false;
+        }
+        for(float v : values)
+            if((key == "shade" && (v < 1 || v > 3)) || (key == "material" && (v < 0 || v >= (float)materials.size()))){
+                std::cerr << "Bad sweep entry: " << entry << "\n"; return false;
+            }
+        it->values = values;
+    }
+    return true;
+}
+
+// Per-worker deques: owners pop from the back, idle workers steal from the front of a victim's deque.
+// All jobs are queued before the workers start, so an empty sweep over every deque means the run is done.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned workers) : queues(workers) {}
+    void push(unsigned worker, size_t job){ queues[worker].jobs.push_back(job); }
+    template<class F> void run(F fn){
+        std::vector<std::thread> pool;
+        for(unsigned w=0; w<queues.size(); ++w) pool.emplace_back([this, w, &fn](){ size_t job; while(next(w, job)) fn(w, job); });
+        for(auto &t : pool) t.join();
+    }
+    size_t steals() const { return stealCount.load(); }
+private:
+    struct Queue { std::mutex lock; std::deque<size_t> jobs; };
+    std::vector<Queue> queues;
+    std::atomic<size_t> stealCount{0};
+    bool next(unsigned w, size_t &job){
+        { std::lock_guard<std::mutex> g(queues[w].lock);
+          if(!queues[w].jobs.empty()){ job = queues[w].jobs.back(); queues[w].jobs.pop_back(); return true; } }
+        for(size_t k=1; k<queues.size(); ++k){
+            Queue &victim = queues[(w + k) % queues.size()];
+            std::lock_guard<std::mutex> g(victim.lock);
+            if(!victim.jobs.empty()){ job = victim.jobs.front(); victim.jobs.pop_front(); ++stealCount; return true; }
+        }
+        return false;
+    }
+};
+
+// Bounded hand-off from render workers to the encoder/writer thread; bounds how many frames are in memory.
+struct FrameQueue {
+    struct Item { size_t index; SoftFramebuffer fb; };
+    std::mutex lock;
+    std::condition_variable notFull, notEmpty;
+    std::deque<Item> items;
+    size_t capacity = 4;
+    bool closed = false;
+    void push(Item &&it){
+        std::unique_lock<std::mutex> g(lock);
+        notFull.wait(g, [&]{ return items.size() < capacity; });
+        items.push_back(std::move(it));
+        notEmpty.notify_one();
+    }
+    bool pop(Item &it){
+        std::unique_lock<std::mutex> g(lock);
+        notEmpty.wait(g, [&]{ return !items.empty() || closed; });
+        if(items.empty()) return false;
+        it = std::move(items.front()); items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    void close(){ std::lock_guard<std::mutex> g(lock); closed = true; notEmpty.notify_all(); }
+};
+
+// Renders every combination of the sweep axes into outDir/NNNNN.ppm plus an index.csv of the parameters.
+bool runBatch(const std::vector<SweepAxis> &axes, const std::string &outDir, unsigned threads){
+    ensureCPUMesh(displayed);   // materialize once; the workers only read the mesh
+    size_t total = 1;
+    for(auto &ax : axes) total *= ax.values.size();
+    auto frameParams = [&](size_t index){
+        ViewParams vp = currentViewParams();
+        float* fields[] = { nullptr, nullptr, &vp.camAngle, &vp.camRadius, &vp.camHeight, &vp.lightAngle, &vp.lightRadius, &vp.lightHeight };
+        for(size_t a=axes.size(); a-- > 0; ){
+            const SweepAxis &ax = axes[a];
+            float v = ax.values[index % ax.values.size()]; index /= ax.values.size();
+            if(a == 0) vp.shadeMode = (int)v; else if(a == 1) vp.materialIndex = (int)v; else *fields[a] = v;
+        }
+        return vp;
+    };
+    mkdir(outDir.c_str(), 0755);
+    std::ofstream csv(outDir + "/index.csv");
+    if(!csv.is_open()){ std::cerr << "Cannot write " << outDir << "/index.csv\n"; return false; }
+    csv << "frame,shade,material,camAngle,camRadius,camHeight,lightAngle,lightRadius,lightHeight\n";
+    for(size_t i=0;i<total;++i){
+        ViewParams vp = frameParams(i);
+        csv << i << "," << vp.shadeMode << "," << vp.materialIndex << "," << vp.camAngle << "," << vp.camRadius << "," << vp.camHeight
+            << "," << vp.lightAngle << "," << vp.lightRadius << "," << vp.lightHeight << "\n";
+    }
+    csv.close();
+
+    WorkStealingPool pool(threads);
+    for(size_t i=0;i<total;++i) pool.push((unsigned)(i % threads), i);
+    FrameQueue queue; queue.capacity = 2*threads;
+    std::vector<double> renderSec(threads, 0.0), queueWaitSec(threads, 0.0);
+    double encodeSec = 0.0, writeSec = 0.0;
+    size_t written = 0; bool writeOk = true;
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::thread writer([&](){
+        FrameQueue::Item it;
+        std::vector<uint8_t> bytes;
+        while(queue.pop(it)){
+            auto a = std::chrono::steady_clock::now();
+            const SoftFramebuffer &fb = it.fb;
+            char head[64]; int hn = snprintf(head, sizeof(head), "P6\n%d %d\n255\n", fb.width, fb.height);
+            bytes.assign(head, head + hn);
+            for(int y=fb.height-1; y>=0; --y){ const uint8_t* row = &fb.rgb[(size_t)y*fb.stride*3]; bytes.insert(bytes.end(), row, row + (size_t)fb.width*3); }
+            auto b = std::chrono::steady_clock::now();
+            char name[32]; snprintf(name, sizeof(name), "/%05zu.ppm", it.index);
+            FILE* f = fopen((outDir + name).c_str(), "wb");
+            bool ok = f && fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+            if(f) ok = (fclose(f) == 0) && ok;
+            if(!ok){ std::cerr << "Cannot write " << outDir << name << "\n"; writeOk = false; }
+            auto c = std::chrono::steady_clock::now();
+            encodeSec += std::chrono::duration<double>(b - a).count();
+            writeSec += std::chrono::duration<double>(c - b).count();
+            ++written;
+        }
+    });
+    pool.run([&](unsigned w, size_t index){
+        auto a = std::chrono::steady_clock::now();
+        FrameQueue::Item it; it.index = index;
+        renderSoftware(displayed, frameParams(index), it.fb, 1);
+        auto b = std::chrono::steady_clock::now();
+        queue.push(std::move(it));
+        auto c = std::chrono::steady_clock::now();
+        renderSec[w] += std::chrono::duration<double>(b - a).count();
+        queueWaitSec[w] += std::chrono::duration<double>(c - b).count();
+    });
+    queue.close();
+    writer.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    double rs = 0, qs = 0;
+    for(unsigned w=0; w<threads; ++w){ rs += renderSec[w]; qs += queueWaitSec[w]; }
+    std::cout << "Batch: " << written << "/" << total << " frames in " << wall << " s ("
+              << (wall > 0 ? written / wall : 0.0) << " frames/s, " << threads << " render thread(s), " << pool.steals() << " steals)\n";
+    if(total){
+        std::cout << "  render       " << rs*1000.0/total << " ms/frame (thread time)\n";
+        std::cout << "  queue wait   " << qs*1000.0/total << " ms/frame (render blocked on writer)\n";
+        std::cout << "  encode       " << encodeSec*1000.0/total << " ms/frame\n";
+        std::cout << "  write        " << writeSec*1000.0/total << " ms/frame\n";
+    }
+    return writeOk && written == total;
+}
+
+// -------- Frame profiler --------
+// CPU wall time per display() phase plus GL_TIME_ELAPSED queries, read back PROF_QUERY_SETS frames late (and only
+// once available) so the profiler never waits on the GPU. When disabled every hook is a single branch.
+enum ProfPhase { PHASE_CAMERA, PHASE_MESH, PHASE_OVERLAY, PHASE_SWAP, PHASE_COUNT };
+static const char* phaseNames[PHASE_COUNT] = { "setupCamera", "drawMesh", "drawOverlay", "swapBuffers" };
+static const int PROF_HISTORY = 240;
+static const int PROF_QUERY_SETS = 2;
+
+struct FrameRecord {
+    uint64_t frame = 0;
+    double startMs = 0, frameMs = 0;            // start relative to profiler start; frameMs = interval since previous frame
+    double cpuStartMs[PHASE_COUNT] = {}, cpuMs[PHASE_COUNT] = {}, gpuMs[PHASE_COUNT] = {};
+    bool gpuValid = false;
+};
+
+struct FrameProfiler {
+    bool enabled = false;
+    std::string outPath;
+    FILE* out = nullptr;
+    bool chromeTrace = false, firstEvent = true;
+    std::chrono::steady_clock::time_point origin, phaseStart;
+    uint64_t frame = 0, recorded = 0;            // frame numbers run on across disable/enable; recorded = since last enable
+    double lastStartMs = -1;
+    bool started = false;
+    FrameRecord history[PROF_HISTORY];
+    GLuint queries[PROF_QUERY_SETS][PHASE_COUNT] = {};
+    bool queryPending[PROF_QUERY_SETS] = {};
+    uint64_t queryFrame[PROF_QUERY_SETS] = {};
+    bool haveQueries = false;
+    int activePhase = -1;
+
+    double nowMs() const { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - origin).count(); }
+    FrameRecord &record(uint64_t f){ return history[f % PROF_HISTORY]; }
+
+    bool openOutput(){
+        if(outPath.empty()) return true;
+        out = fopen(outPath.c_str(), "w");
+        if(!out){ std::cerr << "Cannot write profile to " << outPath << "\n"; return false; }
+        size_t n = outPath.size();
+        chromeTrace = n >= 5 && outPath.compare(n-5, 5, ".json") == 0;
+        if(chromeTrace) fputs("{\"traceEvents\":[\n", out);
+        else {
+            fputs("frame,start_ms,frame_ms", out);
+            for(int p=0;p<PHASE_COUNT;++p) fprintf(out, ",cpu_%s_ms", phaseNames[p]);
+            for(int p=0;p<PHASE_COUNT-1;++p) fprintf(out, ",gpu_%s_ms", phaseNames[p]);
+            fputs("\n", out);
+        }
+        return true;
+    }
+    void traceEvent(const char* name, int tid, double startMs, double durMs){
+        fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", firstEvent ? "" : ",\n",
+                name, tid, startMs*1000.0, durMs*1000.0);
+        firstEvent = false;
+    }
+    // Records go out once their GPU results are in (or known to be missing).
+    void writeRecord(const FrameRecord &r){
+        if(!out) return;
+        if(chromeTrace){
+            traceEvent("frame", 1, r.startMs, r.frameMs);
+            for(int p=0;p<PHASE_COUNT;++p) traceEvent(phaseNames[p], 1, r.cpuStartMs[p], r.cpuMs[p]);
+            // GL_TIME_ELAPSED gives durations only; GPU events are drawn on their own track at the CPU issue time
+            if(r.gpuValid) for(int p=0;p<PHASE_COUNT-1;++p) traceEvent(phaseNames[p], 2, r.cpuStartMs[p], r.gpuMs[p]);
+        } else {
+            fprintf(out, "%llu,%.4f,%.4f", (unsigned long long)r.frame, r.startMs, r.frameMs);
+            for(int p=0;p<PHASE_COUNT;++p) fprintf(out, ",%.4f", r.cpuMs[p]);
+            for(int p=0;p<PHASE_COUNT-1;++p){ if(r.gpuValid) fprintf(out, ",%.4f", r.gpuMs[p]); else fputs(",", out); }
+            fputs("\n", out);
+        }
+    }
+    void collect(int set, bool wait){
+        if(!queryPending[set]) return;
+        FrameRecord &r = record(queryFrame[set]);
+        GLint avail = 1;
+        if(!wait) glGetQueryObjectiv(queries[set][PHASE_COUNT-2], GL_QUERY_RESULT_AVAILABLE, &avail);
+        r.gpuValid = avail != 0;
+        if(r.gpuValid) for(int p=0;p<PHASE_COUNT-1;++p){
+            GLuint64 ns = 0; glGetQueryObjectui64vEXT(queries[set][p], GL_QUERY_RESULT, &ns); r.gpuMs[p] = ns / 1.0e6;
+        }
+        queryPending[set] = false;
+        writeRecord(r);
+    }
+
+    void beginFrame(){
+        if(!enabled) return;
+        if(!haveQueries){ glGenQueries(PROF_QUERY_SETS*PHASE_COUNT, &queries[0][0]); haveQueries = true; }
+        int set = (int)(frame % PROF_QUERY_SETS);
+        collect(set, false);
+        double t = nowMs();
+        FrameRecord &r = record(frame);
+        r = FrameRecord();
+        r.frame = frame; r.startMs = t; r.frameMs = lastStartMs >= 0 ? t - lastStartMs : 0.0;
+        lastStartMs = t;
+        queryFrame[set] = frame; queryPending[set] = true;
+    }
+    void beginPhase(int p){
+        if(!enabled) return;
+        activePhase = p;
+        phaseStart = std::chrono::steady_clock::now();
+        record(frame).cpuStartMs[p] = std::chrono::duration<double, std::milli>(phaseStart - origin).count();
+        if(p != PHASE_SWAP) glBeginQuery(GL_TIME_ELAPSED_EXT, queries[frame % PROF_QUERY_SETS][p]);
+    }
+    void endPhase(){
+        if(!enabled || activePhase < 0) return;
+        if(activePhase != PHASE_SWAP) glEndQuery(GL_TIME_ELAPSED_EXT);
+        record(frame).cpuMs[activePhase] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - phaseStart).count();
+        activePhase = -1;
+    }
+    void endFrame(){ if(enabled){ ++frame; ++recorded; } }
+
+    void setEnabled(bool on){
+        if(on == enabled) return;
+        if(on){
+            if(!started){ origin = std::chrono::steady_clock::now(); started = true; }
+            recorded = 0; lastStartMs = -1;
+        }
+        else flush();
+        enabled = on;
+    }
+    // Blocking readback of whatever is still in flight; used when profiling stops or at exit.
+    void flush(){
+        if(!enabled) return;
+        for(uint64_t f = frame - std::min<uint64_t>(recorded, PROF_QUERY_SETS); f < frame; ++f) collect((int)(f % PROF_QUERY_SETS), true);
+        if(out) fflush(out);
+    }
+    void close(){
+        flush();
+        if(!out) return;
+        if(chromeTrace) fputs("\n]}\n", out);
+        fclose(out); out = nullptr;
+    }
+
+    // Frame-time min/avg/p99 over the rolling history.
+    void stats(double &mn, double &avg, double &p99, double cpuAvg[PHASE_COUNT], double gpuAvg[PHASE_COUNT]) const {
+        std::vector<double> ft; ft.reserve(PROF_HISTORY);
+        int gpuN = 0;
+        for(int p=0;p<PHASE_COUNT;++p){ cpuAvg[p] = 0; gpuAvg[p] = 0; }
+        uint64_t n = std::min<uint64_t>(recorded, PROF_HISTORY);
+        for(uint64_t i=0;i<n;++i){
+            const FrameRecord &r = history[(frame-1-i) % PROF_HISTORY];
+            if(r.frameMs > 0) ft.push_back(r.frameMs);
+            for(int p=0;p<PHASE_COUNT;++p) cpuAvg[p] += r.cpuMs[p];
+            if(r.gpuValid){ ++gpuN; for(int p=0;p<PHASE_COUNT;++p) gpuAvg[p] += r.gpuMs[p]; }
+        }
+        for(int p=0;p<PHASE_COUNT;++p){ cpuAvg[p] = n ? cpuAvg[p]/n : 0; gpuAvg[p] = gpuN ? gpuAvg[p]/gpuN : 0; }
+        mn = avg = p99 = 0;
+        if(ft.empty()) return;
+        mn = *std::min_element(ft.begin(), ft.end());
+        for(double v : ft) avg += v;
+        avg /= ft.size();
+        size_t k = std::min(ft.size()-1, (size_t)ceil(0.99 * ft.size()) - 1);
+        std::nth_element(ft.begin(), ft.begin()+k, ft.end());
+        p99 = ft[k];
+    }
+};
+FrameProfiler profiler;
+
+struct ProfScope {
+    explicit ProfScope(int phase){ profiler.beginPhase(phase); }
+    ~ProfScope(){ profiler.endPhase(); }
+};
+
+static void profilerAtExit(){ profiler.close(); }
+
+// Reformatted only when the HUD stats refresh, so the overlay is not rebuilt every frame while profiling.
+void profilerHudLines(HudText &H){
+    static char lines[3][160];
+    if(H.statsFresh || !lines[0][0]){
+        double mn, avg, p99, cpu[PHASE_COUNT], gpu[PHASE_COUNT];
+        profiler.stats(mn, avg, p99, cpu, gpu);
+        snprintf(lines[0], sizeof(lines[0]), "Frame ms  min %.2f  avg %.2f  p99 %.2f", mn, avg, p99);
+        snprintf(lines[1], sizeof(lines[1]), "CPU cam %.2f mesh %.2f hud %.2f swap %.2f", cpu[PHASE_CAMERA], cpu[PHASE_MESH], cpu[PHASE_OVERLAY], cpu[PHASE_SWAP]);
+        snprintf(lines[2], sizeof(lines[2]), "GPU cam %.2f mesh %.2f hud %.2f", gpu[PHASE_CAMERA], gpu[PHASE_MESH], gpu[PHASE_OVERLAY]);
+    }
+    for(const char* l : lines) H.add(l);
+}
+
+// Rolling frame-time graph along the bottom-left; the guide line marks 16.7 ms (60 Hz).
+void drawProfilerGraph(){
+    uint64_t n = std::min<uint64_t>(profiler.recorded, PROF_HISTORY);
+    if(n < 2) return;
     glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity();
     gluOrtho2D(0,1,0,1);
     glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity();
-
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_LIGHTING);
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    // translucent box
+    const float x0 = 0.02f, x1 = 0.42f, y0 = 0.02f, y1 = 0.16f, scaleMs = 33.3f;
     glColor4f(0.0f, 0.0f, 0.0f, 0.62f);
     glBegin(GL_QUADS);
-        glVertex2f(0.58f, 0.96f); glVertex2f(0.98f, 0.96f);
-        glVertex2f(0.98f, 0.18f); glVertex2f(0.58f, 0.18f);
+        glVertex2f(x0, y1); glVertex2f(x1, y1); glVertex2f(x1, y0); glVertex2f(x0, y0);
     glEnd();
-
-    glColor3f(1.0f, 1.0f, 1.0f);
-    float y = 0.92f;
-    for(auto &s : lines){
-        glRasterPos2f(0.60f, y);
-        for(char c : s) glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
-        y -= 0.05f;
+    float guide = y0 + (y1 - y0) * (16.7f / scaleMs);
+    glColor3f(0.4f, 0.4f, 0.4f);
+    glBegin(GL_LINES); glVertex2f(x0, guide); glVertex2f(x1, guide); glEnd();
+    glColor3f(0.3f, 1.0f, 0.4f);
+    glBegin(GL_LINE_STRIP);
+    for(uint64_t i=0;i<n;++i){
+        const FrameRecord &r = profiler.history[(profiler.frame - n + i) % PROF_HISTORY];
+        float h = std::min(1.0f, (float)r.frameMs / scaleMs);
+        glVertex2f(x0 + (x1 - x0) * i / (PROF_HISTORY - 1), y0 + (y1 - y0) * h);
     }
+    glEnd();
 
     glDisable(GL_BLEND);
     glEnable(GL_LIGHTING);
     glEnable(GL_DEPTH_TEST);
-
     glPopMatrix();
     glMatrixMode(GL_PROJECTION); glPopMatrix();
     glMatrixMode(GL_MODELVIEW);
 }
 
-// -------- Setup camera & projection --------
-void setupCamera(){
-    glMatrixMode(GL_PROJECTION); glLoadIdentity();
-    float aspect = (winH==0) ? 1.0f : (float)winW / (float)winH;
-    if(perspectiveOn) gluPerspective(60.0, aspect, 0.1, 50.0);
-    else {
-        float s=1.8f;
-        glOrtho(-s*aspect, s*aspect, -s, s, 0.1, 50.0);
-    }
-    glMatrixMode(GL_MODELVIEW); glLoadIdentity();
-    float camX = camRadius * cosf(camAngle);
-    float camY = camRadius * sinf(camAngle);
-    float camZ = camHeight;
-    gluLookAt(camX, camY, camZ,  0.0,0.0,0.0,  0.0,0.0,1.0);
-}
-
 // -------- Display / idle / input --------
 void display(){
+    profiler.beginFrame();
+    profiler.beginPhase(PHASE_CAMERA);
+    if(!hud.atlas) buildGlyphAtlas(hud);   // draws into the back buffer, so before the clear
     glClearColor(0.06f,0.06f,0.06f,1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     setupCamera();
 
     // set fixed-function light0 (camera-space) to keep GL state consistent
-    GLfloat l0pos[4] = {0.0f, 0.0f, 1.5f, 1.0f};
-    GLfloat l0amb[4] = {0.2f,0.2f,0.2f,1.0f}, l0dif[4] = {0.6f,0.6f,0.6f,1.0f}, l0spec[4] = {1.0f,1.0f,1.0f,1.0f};
+    GLfloat l0pos[4] = { light0PosEye[0], light0PosEye[1], light0PosEye[2], 1.0f };
     glLightfv(GL_LIGHT0, GL_POSITION, l0pos);
-    glLightfv(GL_LIGHT0, GL_AMBIENT, l0amb);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, l0dif);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, l0spec);
+    glLightfv(GL_LIGHT0, GL_AMBIENT, light0Colors.ambient);
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, light0Colors.diffuse);
+    glLightfv(GL_LIGHT0, GL_SPECULAR, light0Colors.specular);
 
     // set material (for fixed-function fallback & cube)
     Material &mat = materials[materialIndex];
@@ -430,29 +2275,69 @@ void display(){
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, mat.specular);
     glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, mat.shininess);
 
+    profiler.endPhase();
+
     // draw model
-    drawMesh();
+    { ProfScope scope(PHASE_MESH); if(scene.empty()) drawMesh(); else drawScene(); }
 
+    profiler.beginPhase(PHASE_OVERLAY);
     // HUD lines (including light controls & current light params)
-    std::vector<std::string> lines;
-    lines.push_back("Material: " + materials[materialIndex].name);
-    lines.push_back(std::string("Shade: ") + (shadeMode==1?"Flat":shadeMode==2?"Gouraud":"Phong"));
-    lines.push_back("Controls:");
-    lines.push_back("A/D - orbit   W/S - height   Q/E - radius   P - projection");
-    lines.push_back("1-Flat  2-Gouraud  3-Phong   M - material");
-    lines.push_back("L - toggle auto-rotate light (default OFF)");
-    lines.push_back("Light1 (object coords): Z/X angle  C/V radius  B/N height");
+    HudText &H = hud;
+    H.begin();
+    H.addf("FPS: %.1f (%.2f ms)   Tris: %zu", H.fps, H.frameMs, trisDrawn);
+    H.addf("Material: %s", materials[materialIndex].name.c_str());
+    H.add(shadeMode==1 ? "Shade: Flat" : shadeMode==2 ? "Shade: Gouraud" : "Shade: Phong");
+    if(!scene.empty()){
+        H.addf("Scene: %zu meshes, %zu instances, %.1fM tris, %zu draws", scene.size(), sceneInstances,
+               sceneTris / 1.0e6, sceneDrawCalls);
+    } else if(buffersReady && activeLod < (int)displayed.lodLevels.size()){
+        H.addf("LOD %d/%d: %u tris", activeLod, (int)displayed.lodLevels.size()-1, displayed.lodLevels[activeLod].indexCount/3);
+    }
+    if(scene.empty() && activeLod == 0 && meshletCull.count > 0 && residentIndices == (size_t)triCount*3 && !deformRing.live()){
+        H.addf("Meshlets culled: %zu/%zu (%zu tris, %zu draws)", meshletsCulled, meshletCull.count,
+               meshletTrisCulled, meshletDrawCounts.size());
+    }
+    static std::string statusLine;
+    if(loaderHudLine(statusLine)) H.add(statusLine);
+    if(streamMesh){ streamHudLine(statusLine); H.add(statusLine); }
+    if(scene.empty() && shadowHudLine(statusLine)) H.add(statusLine);
+    if(scene.empty() && rigLightCount > 0){
+        if(shadeMode == 1) H.addf("Lights: %d clustered (Gouraud/Phong only)", rigLightCount);
+        else H.addf("Lights: %d clustered, %.1f avg / %d max per cluster", rigLightCount,
+                    clusterStats.avgLights, clusterStats.maxLights);
+    }
+    if(scene.empty() && deformRing.live()){
+        static const char* modes[] = { "off", "wave", "sculpt" };
+        const DeformStats &d = deformStats;
+        H.addf("Deform %s: %zu verts moved, %zu normals in %.2f ms, %.2f M vertex updates/s", modes[deformMode],
+               d.moved, d.normals, d.cpuMs, d.rate / 1.0e6);
+        H.addf("Deform upload: %zu ranges, %.2f MB in %.2f ms (ring of %d)", d.ranges, d.uploadBytes / (1024.0*1024.0),
+               d.uploadMs, DEFORM_RING_SLOTS);
+    }
+    H.add("Controls:");
+    H.add("A/D - orbit   W/S - height   Q/E - radius   P - projection");
+    H.add("1-Flat  2-Gouraud  3-Phong   M - material");
+    H.add("L - toggle auto-rotate light (default OFF)   F - profiler");
+    H.add("G - deform off/wave/sculpt (drag to sculpt, Shift digs)");
+    H.add("Light1 (object coords): Z/X angle  C/V radius  B/N height");
     // show numeric light params
-    char buf[128];
-    snprintf(buf, sizeof(buf), "Light angle: %.2f  radius: %.2f  height: %.2f", lightAngle, lightRadius, lightHeight);
-    lines.push_back(std::string(buf));
-    lines.push_back("R - reset   ESC - exit");
-    drawOverlay(lines);
+    H.addf("Light angle: %.2f  radius: %.2f  height: %.2f", lightAngle, lightRadius, lightHeight);
+    H.add("R - reset   ESC - exit");
+    if(profiler.enabled) profilerHudLines(H);
+    H.end();
+    drawOverlay(H);
+    if(profiler.enabled) drawProfilerGraph();
+    profiler.endPhase();
 
-    glutSwapBuffers();
+    { ProfScope scope(PHASE_SWAP); glutSwapBuffers(); }
+    profiler.endFrame();
 }
 
 void idle(){
+    if(pollMeshLoader()) glutPostRedisplay();
+    if(meshLoader && meshLoader->state != LOADER_IDLE) glutPostRedisplay();   // keep the HUD progress moving
+    if(profiler.enabled) glutPostRedisplay();   // keep frames coming so the timings reflect steady-state rendering
+    if(deformMode == DEFORM_WAVE || brushDown) glutPostRedisplay();
     if(autoRotateLight) {
         lightAngle += 0.01f;
         if(lightAngle > 6.28318530718f) lightAngle -= 6.28318530718f;
@@ -475,6 +2360,13 @@ void keyboard(unsigned char key, int x, int y){
         case '3': shadeMode = 3; break;
         case 'm': materialIndex = (materialIndex + 1) % materials.size(); break;
         case 'l': autoRotateLight = !autoRotateLight; break;
+        case 'f': profiler.setEnabled(!profiler.enabled); break;
+        case 'g':
+            if(shadowsEnabled || streamMesh || !scene.empty()){ std::cerr << "Deformation needs a single .smf model without --shadows\n"; break; }
+            deformMode = (deformMode + 1) % 3;
+            brushDown = false;
+            if(deformMode == DEFORM_WAVE) deformStart = std::chrono::steady_clock::now();
+            break;
         case 'r': camAngle=0; camRadius=3.0f; camHeight=0.0f; lightAngle=0.0f; lightRadius=1.2f; lightHeight=0.5f; break;
 
         // Light1 manual controls (object-space cylinder)
@@ -488,8 +2380,280 @@ void keyboard(unsigned char key, int x, int y){
     glutPostRedisplay();
 }
 
+// Left drag sculpts in DEFORM_SCULPT; the brush is applied in updateDeformation() once a frame.
+void mouse(int button, int state, int x, int y){
+    if(button != GLUT_LEFT_BUTTON) return;
+    brushDown = state == GLUT_DOWN && deformMode == DEFORM_SCULPT;
+    brushDig = (glutGetModifiers() & GLUT_ACTIVE_SHIFT) != 0;
+    brushHit = false;
+    brushX = x; brushY = y;
+    glutPostRedisplay();
+}
+void motion(int x, int y){ brushX = x; brushY = y; if(brushDown) glutPostRedisplay(); }
+
 void reshape(int w, int h){ winW=w; winH=h; glViewport(0,0,w,h); }
 
+// -------- Scripted benchmark --------
+// Every shade mode x material runs the same closed camera/light path for benchFrames frames (after a short
+// warm-up), either through the GL window or, with --headless, through the CPU rasterizer.
+struct BenchResult { std::string name; int frames; double fps, p50, p95, p99; size_t draws, instances; };
+int benchFrames = 0;                  // per configuration; 0 = not benchmarking
+static const int BENCH_WARMUP = 10;
+std::string benchBaselinePath, benchSavePath;
+float benchTolerance = 0.10f;         // allowed relative slowdown before a configuration counts as a regression
+
+// --bench-lights instead sweeps the clustered light rig: Gouraud and Phong x 2, 4, ... 1024 lights, first material.
+bool benchLights = false;
+static const int BENCH_LIGHT_STEPS = 10;   // 2^1 .. 2^10
+
+static int benchConfigCount(){ return benchLights ? 2 * BENCH_LIGHT_STEPS : 3 * (int)materials.size(); }
+static std::string benchConfigName(int config){
+    static const char* shades[] = { "flat", "gouraud", "phong" };
+    if(benchLights) return std::string(shades[1 + config / BENCH_LIGHT_STEPS]) + "/lights=" + std::to_string(2 << (config % BENCH_LIGHT_STEPS));
+    return std::string(shades[config / materials.size()]) + "/" + materials[config % materials.size()].name;
+}
+// Sets the UI state for frame `frame` of configuration `config`; negative frames are warm-up.
+static void applyBenchFrame(int config, int frame){
+    if(benchLights){
+        shadeMode = 2 + config / BENCH_LIGHT_STEPS;
+        materialIndex = 0;
+        rigLightCount = 2 << (config % BENCH_LIGHT_STEPS);
+    } else {
+        shadeMode = 1 + config / (int)materials.size();
+        materialIndex = config % (int)materials.size();
+    }
+    float t = (float)std::max(frame, 0) / (float)benchFrames, tau = 6.28318530718f;
+    camAngle = tau * t;
+    camRadius = 3.0f + 0.6f * sinf(tau * t);
+    camHeight = 0.8f * sinf(2.0f * tau * t);
+    lightAngle = fmodf(2.0f * tau * t, tau);
+}
+
+static double percentile(std::vector<double> v, double q){
+    if(v.empty()) return 0.0;
+    size_t k = std::min(v.size()-1, (size_t)ceil(q * v.size()) - (q > 0 ? 1 : 0));
+    std::nth_element(v.begin(), v.begin()+k, v.end());
+    return v[k];
+}
+static BenchResult benchSummary(int config, const std::vector<double> &latencyMs, double wallSec){
+    BenchResult r;
+    r.name = benchConfigName(config); r.frames = (int)latencyMs.size();
+    r.fps = wallSec > 0 ? latencyMs.size() / wallSec : 0.0;
+    r.p50 = percentile(latencyMs, 0.50); r.p95 = percentile(latencyMs, 0.95); r.p99 = percentile(latencyMs, 0.99);
+    r.draws = scene.empty() ? 1 : sceneDrawCalls;
+    r.instances = scene.empty() ? 1 : sceneInstances;
+    return r;
+}
+
+static bool writeBenchJSON(const std::string &path, const char* mode, const std::vector<BenchResult> &results){
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f){ std::cerr << "Cannot write " << path << "\n"; return false; }
+    fprintf(f, "{\n  \"mode\": \"%s\",\n  \"frames\": %d,\n  \"size\": \"%dx%d\",\n  \"configs\": [\n", mode, benchFrames, winW, winH);
+    for(size_t i=0;i<results.size();++i){
+        const BenchResult &r = results[i];
+        fprintf(f, "    { \"name\": \"%s\", \"fps\": %.3f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"draws\": %zu, \"instances_per_s\": %.0f }%s\n",
+                r.name.c_str(), r.fps, r.p50, r.p95, r.p99, r.draws, r.fps * r.instances, i+1 < results.size() ? "," : "");
+    }
+    fputs("  ]\n}\n", f);
+    return fclose(f) == 0;
+}
+
+// Reads back the files writeBenchJSON produces (one config object per line); not a general JSON parser.
+static bool readBenchJSON(const std::string &path, std::vector<BenchResult> &out){
+    std::ifstream in(path);
+    if(!in){ std::cerr << "Cannot open baseline " << path << "\n"; return false; }
+    std::string line;
+    auto number = [&](const char* key, double &v){
+        size_t p = line.find(key);
+        return p != std::string::npos && sscanf(line.c_str() + p + strlen(key), " : %lf", &v) == 1;
+    };
+    while(std::getline(in, line)){
+        size_t p = line.find("\"name\": \"");
+        if(p == std::string::npos) continue;
+        p += 9;
+        size_t e = line.find('"', p);
+        if(e == std::string::npos) continue;
+        BenchResult r; r.name = line.substr(p, e - p); r.frames = 0; r.draws = r.instances = 0;
+        if(!number("\"fps\"", r.fps) || !number("\"p50_ms\"", r.p50) || !number("\"p95_ms\"", r.p95) || !number("\"p99_ms\"", r.p99)){
+            std::cerr << "Malformed baseline entry in " << path << ": " << line << "\n";
+            return false;
+        }
+        out.push_back(r);
+    }
+    return true;
+}
+
+// Prints the results (and the comparison against --bench-baseline); returns the process exit code.
+static int reportBench(const char* mode, const std::vector<BenchResult> &results){
+    std::vector<BenchResult> base;
+    if(!benchBaselinePath.empty() && !readBenchJSON(benchBaselinePath, base)) return 1;
+    int regressions = 0;
+    printf("Benchmark (%s, %dx%d, %d frames/config)\n", mode, winW, winH, benchFrames);
+    if(!scene.empty()) printf("Scene: %zu meshes, %zu instances\n", scene.size(), sceneInstances);
+    printf("  %-26s %10s %9s %9s %9s %6s %12s\n", "config", "fps", "p50 ms", "p95 ms", "p99 ms", "draws", "instances/s");
+    for(const BenchResult &r : results){
+        printf("  %-26s %10.1f %9.3f %9.3f %9.3f %6zu %12.0f", r.name.c_str(), r.fps, r.p50, r.p95, r.p99, r.draws, r.fps * r.instances);
+        auto b = std::find_if(base.begin(), base.end(), [&](const BenchResult &x){ return x.name == r.name; });
+        if(b != base.end()){
+            bool slower = r.fps < b->fps * (1.0f - benchTolerance) || r.p99 > b->p99 * (1.0f + benchTolerance);
+            printf("   fps %+6.1f%%  p99 %+6.1f%%%s", b->fps > 0 ? 100.0*(r.fps/b->fps - 1.0) : 0.0,
+                   b->p99 > 0 ? 100.0*(r.p99/b->p99 - 1.0) : 0.0, slower ? "  REGRESSION" : "");
+            regressions += slower;
+        } else if(!base.empty()) printf("   (not in baseline)");
+        printf("\n");
+    }
+    if(!benchSavePath.empty()){
+        if(!writeBenchJSON(benchSavePath, mode, results)) return 1;
+        std::cout << "Wrote baseline " << benchSavePath << "\n";
+    }
+    if(regressions){ std::cerr << regressions << " configuration(s) regressed by more than " << benchTolerance*100.0f << "%\n"; return 1; }
+    return 0;
+}
+
+int runHeadlessBench(unsigned threads){
+    std::vector<BenchResult> results;
+    SoftFramebuffer fb;
+    for(int config=0; config<benchConfigCount(); ++config){
+        for(int f=-BENCH_WARMUP; f<0; ++f){ applyBenchFrame(config, f); renderSoftware(displayed, currentViewParams(), fb, threads); }
+        std::vector<double> lat; lat.reserve(benchFrames);
+        auto start = std::chrono::steady_clock::now();
+        for(int f=0; f<benchFrames; ++f){
+            auto a = std::chrono::steady_clock::now();
+            applyBenchFrame(config, f);
+            renderSoftware(displayed, currentViewParams(), fb, threads);
+            lat.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - a).count());
+        }
+        results.push_back(benchSummary(config, lat, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()));
+    }
+    return reportBench("cpu", results);
+}
+
+// --bench-rays: BVH build time and ray throughput on the CPU, for camera rays (one per pixel at --size, traced singly
+// and as 2x2 packets), the AO bake and light1 shadow rays. Each workload repeats for at least RAY_BENCH_SECONDS.
+bool benchRays = false;
+static const double RAY_BENCH_SECONDS = 0.5;
+
+// Object-space ray through the centre of pixel (px, py), matching cameraMatrices() and modelMatrix().
+static void cameraRay(const ViewParams &vp, float px, float py, float o[3], float d[3]){
+    float aspect = vp.height == 0 ? 1.0f : (float)vp.width / (float)vp.height;
+    Vec3 eye(vp.camRadius * cosf(vp.camAngle), vp.camRadius * sinf(vp.camAngle), vp.camHeight);
+    Vec3 f = normalize(Vec3(0,0,0) - eye), s = normalize(cross(f, Vec3(0,0,1))), u = cross(s, f);
+    float x = (px + 0.5f) / vp.width * 2.0f - 1.0f, y = (py + 0.5f) / vp.height * 2.0f - 1.0f;
+    Vec3 origin = eye, dir = f;
+    if(vp.perspective){ float th = tanf(30.0f * 3.14159265358979f / 180.0f); dir = normalize(f + s * (x * th * aspect) + u * (y * th)); }
+    else origin = eye + s * (x * 1.8f * aspect) + u * (y * 1.8f);
+    Vec3 oo = origin * (1.0f / displayed.modelScale) + displayed.centroid;
+    o[0] = oo.x; o[1] = oo.y; o[2] = oo.z; d[0] = dir.x; d[1] = dir.y; d[2] = dir.z;
+}
+
+int runRayBench(unsigned threads){
+    MeshView mv = meshView(displayed);
+    MeshBVH bvh;
+    buildBVH(mv, bvh, threads);
+    if(bvh.empty()){ std::cerr << "No triangles to trace\n"; return 1; }
+    ViewParams vp = currentViewParams();
+    int W = vp.width, H = vp.height;
+    Vec3 light1Obj = cylinderLightPos(vp.lightAngle, vp.lightRadius, vp.lightHeight);
+
+    struct RayResult { const char* name; size_t rays; double ms; size_t hits; };
+    std::vector<RayResult> results;
+    // runs `pass` (returning rays traced) until RAY_BENCH_SECONDS have passed; ms is per pass
+    auto measure = [&](const char* name, const std::function<size_t(size_t &hits)> &pass){
+        size_t rays = 0, hits = 0, passes = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        double sec = 0;
+        do { hits = 0; rays += pass(hits); ++passes; sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(); }
+        while(sec < RAY_BENCH_SECONDS);
+        results.push_back({ name, rays / passes, sec * 1000.0 / passes, hits });
+    };
+
+    // camera rays by rows of 2x2 quads; a quad is one packet or four single rays
+    auto primary = [&](bool packets, size_t &hits){
+        int qh = (H + 1) / 2;
+        std::vector<size_t> rowHits(qh, 0);
+        parallelRanges((size_t)qh, threads, [&](size_t b, size_t e, unsigned){
+            for(size_t qy=b; qy<e; ++qy){
+                size_t n = 0;
+                for(int qx=0; qx<W; qx+=2){
+                    float o[4][3], d[4][3];
+                    for(int k=0;k<4;++k) cameraRay(vp, (float)std::min(W-1, qx + (k & 1)), (float)std::min(H-1, 2*(int)qy + (k >> 1)), o[k], d[k]);
+                    if(packets){
+                        RayPacket rp;
+                        float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4];
+                        for(int k=0;k<4;++k){ ox[k] = o[k][0]; oy[k] = o[k][1]; oz[k] = o[k][2]; dx[k] = d[k][0]; dy[k] = d[k][1]; dz[k] = d[k][2]; }
+                        rp.o[0] = f4load(ox); rp.o[1] = f4load(oy); rp.o[2] = f4load(oz);
+                        rp.setDirections(dx, dy, dz);
+                        rp.tmin = f4(0.0f); rp.tmax = f4(INFINITY);
+                        int m = bvhTrace4(bvh, rp, true);
+                        n += (m & 1) + ((m >> 1) & 1) + ((m >> 2) & 1) + ((m >> 3) & 1);
+                    } else {
+                        for(int k=0;k<4;++k){ RayHit h; n += bvhTrace(bvh, o[k], d[k], 0.0f, INFINITY, &h); }
+                    }
+                }
+                rowHits[qy] = n;
+            }
+        });
+        for(size_t n : rowHits) hits += n;
+        return (size_t)qh * ((W + 1) / 2) * 4;
+    };
+    measure("primary (single)", [&](size_t &hits){ return primary(false, hits); });
+    measure("primary (packets)", [&](size_t &hits){ return primary(true, hits); });
+    int samples = aoSamples > 0 ? aoSamples : 64;   // what a plain --ao bakes
+    measure("ambient occlusion", [&](size_t &hits){
+        std::vector<uint8_t> ao;
+        return bakeAmbientOcclusion(mv, displayed.modelScale, bvh, samples, aoRadius, threads, ao, &hits);
+    });
+    measure("light1 shadows", [&](size_t &hits){
+        std::vector<uint8_t> vis;
+        return traceLightVisibility(mv, displayed.modelScale, bvh, light1Obj, threads, vis, &hits);
+    });
+
+    printf("Ray benchmark (%zu tris, %d threads, %dx%d camera rays, %d AO samples/vertex)\n", mv.triCount, threads, W, H, samples);
+    printf("  %-20s %12s %10s %10s %12s\n", "workload", "rays", "ms", "Mrays/s", "hits");
+    for(const RayResult &r : results)
+        printf("  %-20s %12zu %10.2f %10.2f %12zu\n", r.name, r.rays, r.ms, r.ms > 0 ? r.rays / r.ms / 1000.0 : 0.0, r.hits);
+    return 0;
+}
+
+// GL variant: benchDisplay() replaces display() and drives the script one frame per redisplay. glFinish() after
+// the swap makes each latency sample include the GPU work of that frame.
+struct GLBenchState {
+    int config = 0, frame = -BENCH_WARMUP;
+    std::vector<double> lat;
+    std::chrono::steady_clock::time_point start;
+    std::vector<BenchResult> results;
+};
+GLBenchState glBench;
+
+void benchDisplay(){
+    GLBenchState &b = glBench;
+    if(b.frame == 0) b.start = std::chrono::steady_clock::now();
+    auto a = std::chrono::steady_clock::now();
+    applyBenchFrame(b.config, b.frame);
+    display();
+    glFinish();
+    if(b.frame >= 0) b.lat.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - a).count());
+    if(++b.frame == benchFrames){
+        b.results.push_back(benchSummary(b.config, b.lat, std::chrono::duration<double>(std::chrono::steady_clock::now() - b.start).count()));
+        b.lat.clear(); b.frame = -BENCH_WARMUP;
+        if(++b.config == benchConfigCount()) exit(reportBench("gl", b.results));
+    }
+}
+void benchIdle(){ glutPostRedisplay(); }
+
+// Asks the driver not to wait for vblank; must run before the GL context exists (env vars) and after (CGL).
+static void disableVsync(bool contextReady){
+    if(!contextReady){
+        setenv("vblank_mode", "0", 1);            // Mesa
+        setenv("__GL_SYNC_TO_VBLANK", "0", 1);    // NVIDIA
+        return;
+    }
+#ifdef __APPLE__
+    GLint interval = 0;
+    CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &interval);
+#endif
+}
+
 // -------- GL init & main --------
 void initGL(){
     glEnable(GL_DEPTH_TEST);
@@ -500,11 +2664,142 @@ void initGL(){
     glClearDepth(1.0f);
 }
 
+static bool optValue(const std::string &arg, const char* key, std::string &value){
+    size_t n = strlen(key);
+    if(arg.compare(0, n, key) != 0) return false;
+    value = arg.substr(n);
+    return true;
+}
+
+static const char* usage =
+    "Usage: ./Assignment3 [options] models/your.smf   |   ./Assignment3 [options] --scene=scenes/file.scn\n"
+    "  --normals=uniform|area|angle   vertex normal weighting\n"
+    "  --vertex-format=float|interleaved|quantized   GPU vertex layout\n"
+    "  --optimize                     reorder triangles/vertices for vertex cache, overdraw and fetch locality\n"
+    "  --no-lod  --lod-error=PX       disable the LOD chain / max projected LOD error in pixels (default 1)\n"
+    "  --no-meshlets                  draw the full-detail mesh without per-meshlet culling\n"
+    "  --no-watch                     do not reload the model when the .smf changes on disk\n"
+    "  --chunk=out.smfc               convert the model to a chunked out-of-core file and exit; open .smfc files to stream them\n"
+    "  --mem-cap=MB                   memory cap for --chunk (whole process) and for resident chunks when streaming (default 512)\n"
+    "  --render=out.ppm               render one frame on the CPU and exit (no window/GPU needed)\n"
+    "  --size=WxH  --shade=flat|gouraud|phong  --material=N  --ortho\n"
+    "  --cam=angle,radius,height  --light=angle,radius,height  --threads=N\n"
+    "  --sweep=spec|file --out=dir    render every combination of a parameter sweep and exit\n"
+    "  --profile  --profile-out=F     start with the frame profiler on / also log frames to F (.csv or Chrome .json)\n"
+    "  --scene=FILE                   draw instanced copies of several meshes described in a scene file\n"
+    "  --bench[=FRAMES]  --headless   scripted benchmark of every shade x material (GL window, or CPU rasterizer)\n"
+    "  --bench-save=F.json  --bench-baseline=F.json  --bench-tolerance=PCT   store / compare against a baseline\n"
+    "  --lights=N  --light-range=R    replace light1 with N clustered point lights (max 1024) of range R (object units)\n"
+    "  --bench-lights                 benchmark Gouraud/Phong with 2..1024 clustered lights (GL only)\n"
+    "  --ao[=SAMPLES]  --ao-radius=R  bake per-vertex ambient occlusion (default 64 rays, radius 0.5 of the model)\n"
+    "  --shadows                      ray-traced light1 shadows per vertex\n"
+    "  --bench-rays                   BVH build time and Mrays/s for camera, AO and shadow rays on the CPU, then exit\n"
+    "  --deform=wave|sculpt           start with the procedural wave / sculpt brush (G cycles off/wave/sculpt)\n";
+
 int main(int argc, char** argv){
-    if(argc < 2){ std::cerr << "Usage: ./Assignment3 models/your.smf\n"; return 1; }
-    if(!loadSMF(argv[1])) return 1;
+    std::string modelPath, renderPath, sweepSpec, scenePath, chunkPath, outDir = "frames", v;
+    unsigned threads = workerCount();
+    bool startProfiling = false, headless = false, watchModel = true;
+    initMaterials();   // before parsing, so --material is checked against the real list
+    for(int i=1;i<argc;++i){
+        std::string a = argv[i];
+        bool ok = true;
+        if(a == "--normals=uniform") normalWeighting = NORMAL_UNIFORM;
+        else if(a == "--normals=area") normalWeighting = NORMAL_AREA;
+        else if(a == "--normals=angle") normalWeighting = NORMAL_ANGLE;
+        else if(optValue(a, "--vertex-format=", v)){ vertexFormat = v=="float" ? VF_FLOAT : v=="interleaved" ? VF_INTERLEAVED : v=="quantized" ? VF_QUANTIZED : -1; ok = vertexFormat >= 0; }
+        else if(a == "--optimize") optimizeMeshOrder = true;
+        else if(a == "--no-lod") generateLods = false;
+        else if(a == "--no-meshlets") buildMeshletsEnabled = false;
+        else if(optValue(a, "--lod-error=", v)) ok = sscanf(v.c_str(), "%f", &lodPixelError) == 1 && lodPixelError > 0;
+        else if(optValue(a, "--render=", v)) renderPath = v;
+        else if(optValue(a, "--sweep=", v)) sweepSpec = v;
+        else if(optValue(a, "--out=", v)) outDir = v;
+        else if(optValue(a, "--size=", v)) ok = sscanf(v.c_str(), "%dx%d", &winW, &winH) == 2 && winW > 0 && winH > 0;
+        else if(optValue(a, "--shade=", v)){ shadeMode = v=="flat" ? 1 : v=="gouraud" ? 2 : v=="phong" ? 3 : 0; ok = shadeMode != 0; }
+        else if(optValue(a, "--material=", v)) ok = sscanf(v.c_str(), "%d", &materialIndex) == 1 && materialIndex >= 0 && materialIndex < (int)materials.size();
+        else if(optValue(a, "--cam=", v)) ok = sscanf(v.c_str(), "%f,%f,%f", &camAngle, &camRadius, &camHeight) == 3;
+        else if(optValue(a, "--light=", v)) ok = sscanf(v.c_str(), "%f,%f,%f", &lightAngle, &lightRadius, &lightHeight) == 3;
+        else if(optValue(a, "--threads=", v)) ok = sscanf(v.c_str(), "%u", &threads) == 1 && threads > 0;
+        else if(a == "--ortho") perspectiveOn = false;
+        else if(a == "--profile") startProfiling = true;
+        else if(a == "--bench") benchFrames = 120;
+        else if(optValue(a, "--bench=", v)) ok = sscanf(v.c_str(), "%d", &benchFrames) == 1 && benchFrames > 0;
+        else if(a == "--headless") headless = true;
+        else if(a == "--no-watch") watchModel = false;
+        else if(optValue(a, "--chunk=", v)) chunkPath = v;
+        else if(optValue(a, "--mem-cap=", v)){ unsigned mb = 0; ok = sscanf(v.c_str(), "%u", &mb) == 1 && mb >= 16; memCapBytes = (size_t)mb << 20; }
+        else if(optValue(a, "--scene=", v)) scenePath = v;
+        else if(optValue(a, "--bench-baseline=", v)) benchBaselinePath = v;
+        else if(optValue(a, "--bench-save=", v)) benchSavePath = v;
+        else if(optValue(a, "--bench-tolerance=", v)){ ok = sscanf(v.c_str(), "%f", &benchTolerance) == 1 && benchTolerance >= 0; benchTolerance /= 100.0f; }
+        else if(optValue(a, "--profile-out=", v)){ profiler.outPath = v; startProfiling = true; }
+        else if(optValue(a, "--lights=", v)) ok = sscanf(v.c_str(), "%d", &rigLightCount) == 1 && rigLightCount >= 0 && rigLightCount <= MAX_RIG_LIGHTS;
+        else if(optValue(a, "--light-range=", v)) ok = sscanf(v.c_str(), "%f", &rigLightRange) == 1 && rigLightRange > 0;
+        else if(a == "--bench-lights"){ benchLights = true; if(benchFrames == 0) benchFrames = 120; }
+        else if(a == "--ao") aoSamples = 64;
+        else if(optValue(a, "--ao=", v)) ok = sscanf(v.c_str(), "%d", &aoSamples) == 1 && aoSamples > 0 && aoSamples <= 4096;
+        else if(optValue(a, "--ao-radius=", v)) ok = sscanf(v.c_str(), "%f", &aoRadius) == 1 && aoRadius > 0;
+        else if(a == "--shadows") shadowsEnabled = true;
+        else if(a == "--bench-rays") benchRays = true;
+        else if(optValue(a, "--deform=", v)){ deformMode = v=="wave" ? DEFORM_WAVE : v=="sculpt" ? DEFORM_SCULPT : -1; ok = deformMode >= 0; }
+        else if(a.compare(0, 2, "--") != 0 && modelPath.empty()) modelPath = a;
+        if(!ok){ std::cerr << "Bad option " << a << "\n" << usage; return 1; }
+    }
+    if((rigLightCount > 0 || benchLights) && (!scenePath.empty() || !renderPath.empty() || !sweepSpec.empty() || headless)){
+        std::cerr << "--lights/--bench-lights need the GL viewer with a single model (no --scene/--render/--sweep/--headless)\n";
+        return 1;
+    }
+    if(!scenePath.empty()){
+        if(!renderPath.empty() || !sweepSpec.empty() || headless){ std::cerr << "--scene needs the GL viewer (no --render/--sweep/--headless)\n"; return 1; }
+        if(!parseScene(scenePath, scene)) return 1;
+    }
+    if(!chunkPath.empty()){
+        if(modelPath.empty()){ std::cerr << usage; return 1; }
+        return convertToChunks(modelPath, chunkPath, memCapBytes) ? 0 : 1;
+    }
+    bool outOfCore = modelPath.size() >= 5 && modelPath.compare(modelPath.size()-5, 5, ".smfc") == 0;
+    if(outOfCore && (!scenePath.empty() || !renderPath.empty() || !sweepSpec.empty() || headless)){
+        std::cerr << "Chunked .smfc models need the GL viewer (no --scene/--render/--sweep/--headless)\n";
+        return 1;
+    }
+    if(deformMode != DEFORM_OFF && (shadowsEnabled || !scenePath.empty() || outOfCore || !renderPath.empty() || !sweepSpec.empty() || headless || benchRays)){
+        std::cerr << "--deform needs the GL viewer with a single .smf model (no --shadows/--scene/.smfc/--render/--sweep/--headless)\n";
+        return 1;
+    }
+    if((aoSamples > 0 || shadowsEnabled || benchRays) && (!scenePath.empty() || outOfCore)){
+        std::cerr << "--ao/--shadows/--bench-rays need a single .smf model (no --scene or .smfc)\n";
+        return 1;
+    }
+    if(outOfCore && !openStreamedMesh(modelPath)) return 1;
+    // the interactive viewer opens its window right away and loads in the background; everything else needs the mesh now
+    bool asyncLoad = scenePath.empty() && renderPath.empty() && sweepSpec.empty() && benchFrames == 0 && !benchRays && !outOfCore;
+    if(scenePath.empty() && !outOfCore){
+        if(modelPath.empty()){ std::cerr << usage; return 1; }
+        struct stat st;
+        if(asyncLoad && stat(modelPath.c_str(), &st) != 0){ std::cerr << "Cannot open " << modelPath << "\n"; return 1; }
+        if(!asyncLoad && !loadMesh(modelPath)) return 1;
+    }
 
-    initMaterials();
+    if(benchRays) return runRayBench(threads);
+    if(!sweepSpec.empty()){
+        std::vector<SweepAxis> axes;
+        if(!parseSweepSpec(sweepSpec, axes)) return 1;
+        return runBatch(axes, outDir, threads) ? 0 : 1;
+    }
+    if(benchFrames > 0 && headless){
+        return runHeadlessBench(threads);
+    }
+    if(!renderPath.empty()){
+        SoftFramebuffer fb;
+        auto t0 = std::chrono::steady_clock::now();
+        renderSoftware(displayed, currentViewParams(), fb, threads);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        std::cout << "Rendered " << fb.width << "x" << fb.height << " on " << threads << " thread(s) in " << ms << " ms\n";
+        return writePPM(renderPath, fb) ? 0 : 1;
+    }
+
+    if(benchFrames > 0) disableVsync(false);
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
     glutInitWindowSize(winW, winH);
@@ -512,16 +2807,27 @@ int main(int argc, char** argv){
 
     initGL();
     createPrograms();
-    buildBuffers();
+    if(asyncLoad) startMeshLoader(modelPath, watchModel);
+    else if(outOfCore){}   // no whole-mesh buffers: drawStreamChunks() uploads chunks as the I/O thread pages them in
+    else if(!scene.empty()){ if(!loadSceneBuffers(scene)) return 1; }
+    else buildBuffers();
 
     // default: light does NOT auto-rotate (user must change it or toggle auto-rotate)
     autoRotateLight = false;
 
-    glutDisplayFunc(display);
-    glutIdleFunc(idle);
+    if(!profiler.openOutput()) return 1;
+    atexit(profilerAtExit);
+    profiler.setEnabled(startProfiling);
+
+    if(benchFrames > 0) disableVsync(true);
+    glutDisplayFunc(benchFrames > 0 ? benchDisplay : display);
+    glutIdleFunc(benchFrames > 0 ? benchIdle : idle);
     glutKeyboardFunc(keyboard);
+    glutMouseFunc(mouse);
+    glutMotionFunc(motion);
     glutReshapeFunc(reshape);
 
     glutMainLoop();
     return 0;
 }
+
@@ -0,0 +1,1832 @@
+// mesh.cpp
+// GL-free mesh pipeline (see mesh.h): everything between the .smf on disk and the bytes handed to the GPU.
+
+#include "mesh.h"
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <queue>
+#include <memory>
+#include <functional>
+#include <cstdio>
+
+// -------- Vertex -> triangle adjacency (CSR) --------
+
+// Parallel counting sort of triangle corners by vertex.
+void buildVertexAdjacency(VertexAdjacency &adj, const std::vector<Tri> &tris, size_t nv){
+    unsigned workers = workerCount();
+    std::vector<uint32_t> count(nv, 0);
+    parallelRanges(tris.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t i=b;i<e;++i){
+            const Tri &t = tris[i];
+            __atomic_fetch_add(&count[t.a], 1u, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&count[t.b], 1u, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&count[t.c], 1u, __ATOMIC_RELAXED);
+        }
+    });
+    // exclusive scan: per-range sums, then a second sweep adds each range's base
+    adj.offsets.assign(nv+1, 0);
+    std::vector<uint32_t> rangeSum(workers+1, 0);
+    parallelRanges(nv, workers, [&](size_t b, size_t e, unsigned w){
+        uint32_t s = 0; for(size_t v=b; v<e; ++v) s += count[v]; rangeSum[w+1] = s;
+    });
+    for(unsigned w=0; w<workers; ++w) rangeSum[w+1] += rangeSum[w];
+    parallelRanges(nv, workers, [&](size_t b, size_t e, unsigned w){
+        uint32_t s = rangeSum[w];
+        for(size_t v=b; v<e; ++v){ adj.offsets[v] = s; s += count[v]; count[v] = adj.offsets[v]; }
+    });
+    adj.offsets[nv] = (uint32_t)(tris.size()*3);
+    // scatter; count[] is reused as the per-vertex write cursor
+    adj.tris.resize(tris.size()*3);
+    parallelRanges(tris.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t i=b;i<e;++i){
+            const Tri &t = tris[i];
+            adj.tris[__atomic_fetch_add(&count[t.a], 1u, __ATOMIC_RELAXED)] = (uint32_t)i;
+            adj.tris[__atomic_fetch_add(&count[t.b], 1u, __ATOMIC_RELAXED)] = (uint32_t)i;
+            adj.tris[__atomic_fetch_add(&count[t.c], 1u, __ATOMIC_RELAXED)] = (uint32_t)i;
+        }
+    });
+    // the scatter order depends on thread timing; sorting each short list makes the result deterministic
+    parallelRanges(nv, workers, [&](size_t b, size_t e, unsigned){
+        for(size_t v=b; v<e; ++v) std::sort(adj.tris.begin()+adj.offsets[v], adj.tris.begin()+adj.offsets[v+1]);
+    });
+}
+
+// -------- Vertex normals & bounds --------
+int normalWeighting = NORMAL_UNIFORM;
+
+float cornerAngle(const Vec3 &p, const Vec3 &q, const Vec3 &r){
+    Vec3 u = normalize(q - p), v = normalize(r - p);
+    float d = std::max(-1.0f, std::min(1.0f, u.x*v.x + u.y*v.y + u.z*v.z));
+    return acosf(d);
+}
+
+// Weighted sum of the face normals around `v`, in adjacency order.
+static Vec3 gatherVertexNormal(const std::vector<Vertex> &verts, const std::vector<Tri> &tris, const VertexAdjacency &adj,
+                               int weighting, size_t v){
+    Vec3 n(0,0,0);
+    for(uint32_t k=adj.offsets[v]; k<adj.offsets[v+1]; ++k){
+        const Tri &t = tris[adj.tris[k]];
+        if(weighting == NORMAL_UNIFORM){ n = n + t.fn; continue; }
+        const Vec3 &A = verts[t.a].p, &B = verts[t.b].p, &C = verts[t.c].p;
+        if(weighting == NORMAL_AREA) n = n + cross(B - A, C - A); // |cross| = 2*area
+        else if((size_t)t.a == v) n = n + t.fn * cornerAngle(A, B, C);
+        else if((size_t)t.b == v) n = n + t.fn * cornerAngle(B, C, A);
+        else n = n + t.fn * cornerAngle(C, A, B);
+    }
+    return normalize(n);
+}
+
+// Gathers adjacent face normals per vertex; each vertex is written by exactly one thread.
+void computeVertexNormals(std::vector<Vertex> &verts, const std::vector<Tri> &tris, const VertexAdjacency &adj, int weighting){
+    parallelRanges(verts.size(), workerCount(), [&](size_t b, size_t e, unsigned){
+        for(size_t v=b; v<e; ++v) verts[v].n = gatherVertexNormal(verts, tris, adj, weighting, v);
+    });
+}
+
+// Centroid and bounding radius as parallel reductions (partial sums in double).
+void computeBounds(const std::vector<Vertex> &verts, Vec3 &center, float &radius){
+    unsigned workers = workerCount();
+    std::vector<double> sum(3*workers, 0.0);
+    parallelRanges(verts.size(), workers, [&](size_t b, size_t e, unsigned w){
+        double x=0, y=0, z=0;
+        for(size_t i=b;i<e;++i){ x += verts[i].p.x; y += verts[i].p.y; z += verts[i].p.z; }
+        sum[3*w] = x; sum[3*w+1] = y; sum[3*w+2] = z;
+    });
+    double x=0, y=0, z=0;
+    for(unsigned w=0; w<workers; ++w){ x += sum[3*w]; y += sum[3*w+1]; z += sum[3*w+2]; }
+    double inv = verts.empty() ? 0.0 : 1.0 / (double)verts.size();
+    center = Vec3((float)(x*inv), (float)(y*inv), (float)(z*inv));
+    std::vector<float> maxd(workers, 0.0f);
+    parallelRanges(verts.size(), workers, [&](size_t b, size_t e, unsigned w){
+        float m = 0.0f;
+        for(size_t i=b;i<e;++i) m = std::max(m, len(verts[i].p - center));
+        maxd[w] = m;
+    });
+    radius = *std::max_element(maxd.begin(), maxd.end());
+}
+
+// -------- Triangle order optimization --------
+// Tipsify (Sander et al. 2007) for post-transform cache reuse, clusters sorted by a view-independent
+// occlusion heuristic for overdraw, then vertices renumbered in first-use order for fetch locality.
+bool optimizeMeshOrder = false;
+static const int VCACHE_SIZE = 32;      // FIFO size used for both the optimizer and the ACMR/ATVR report
+
+// ACMR = vertex transforms per triangle, ATVR = transforms per vertex, simulating a FIFO post-transform cache.
+void vertexCacheStats(const std::vector<Tri> &tris, size_t nv, int cacheSize, double &acmr, double &atvr){
+    std::vector<uint64_t> stamp(nv, 0);
+    uint64_t clock = (uint64_t)cacheSize + 1, misses = 0;
+    for(const Tri &t : tris){
+        const int idx[3] = { t.a, t.b, t.c };
+        for(int v : idx) if(clock - stamp[v] > (uint64_t)cacheSize){ stamp[v] = clock++; ++misses; }
+    }
+    acmr = tris.empty() ? 0.0 : (double)misses / tris.size();
+    atvr = nv == 0 ? 0.0 : (double)misses / nv;
+}
+
+// Returns the new triangle order and the start offset of each cluster (a cluster ends where the cache had to restart).
+static void tipsify(const std::vector<Tri> &tris, size_t nv, const VertexAdjacency &adj, int k,
+                    std::vector<uint32_t> &order, std::vector<size_t> &clusterStart){
+    std::vector<uint32_t> live(nv);
+    for(size_t v=0; v<nv; ++v) live[v] = adj.offsets[v+1] - adj.offsets[v];
+    std::vector<int64_t> cacheTime(nv, 0);
+    std::vector<char> emitted(tris.size(), 0);
+    std::vector<uint32_t> deadEnd, candidates;
+    order.clear(); order.reserve(tris.size());
+    clusterStart.clear();
+    int64_t s = k + 1;
+    size_t cursor = 0;
+    int64_t f = nv ? 0 : -1;
+    bool restarted = true;
+    while(f >= 0){
+        if(restarted){ clusterStart.push_back(order.size()); restarted = false; }
+        candidates.clear();
+        for(uint32_t j=adj.offsets[f]; j<adj.offsets[f+1]; ++j){
+            uint32_t t = adj.tris[j];
+            if(emitted[t]) continue;
+            emitted[t] = 1; order.push_back(t);
+            const int idx[3] = { tris[t].a, tris[t].b, tris[t].c };
+            for(int v : idx){
+                deadEnd.push_back((uint32_t)v); candidates.push_back((uint32_t)v);
+                --live[v];
+                if(s - cacheTime[v] > k){ cacheTime[v] = s; ++s; }
+            }
+        }
+        // prefer a candidate still in cache that will not be evicted before its fan is done
+        int64_t best = -1, bestScore = -1;
+        for(uint32_t v : candidates){
+            if(live[v] == 0) continue;
+            int64_t score = 0;
+            if(s - cacheTime[v] + 2*(int64_t)live[v] <= k) score = s - cacheTime[v];
+            if(score > bestScore){ bestScore = score; best = v; }
+        }
+        if(best < 0){
+            restarted = true;
+            while(!deadEnd.empty() && best < 0){ uint32_t v = deadEnd.back(); deadEnd.pop_back(); if(live[v] > 0) best = v; }
+            while(best < 0 && cursor < nv){ if(live[cursor] > 0) best = (int64_t)cursor; ++cursor; }
+        }
+        f = best;
+    }
+}
+
+// Reorders triangles (and renumbers vertices) in place; rebuilds `adj` for the new numbering.
+void optimizeTriangleOrder(std::vector<Vertex> &verts, std::vector<Tri> &tris, VertexAdjacency &adj){
+    if(tris.empty()) return;
+    double acmr0, atvr0, acmr1, atvr1;
+    vertexCacheStats(tris, verts.size(), VCACHE_SIZE, acmr0, atvr0);
+    auto t0 = std::chrono::steady_clock::now();
+
+    std::vector<uint32_t> order; std::vector<size_t> clusterStart;
+    tipsify(tris, verts.size(), adj, VCACHE_SIZE, order, clusterStart);
+    clusterStart.push_back(order.size());
+
+    // overdraw: clusters further out along their own normal tend to occlude the rest, so they go first
+    Vec3 meshCenter; float radius;
+    computeBounds(verts, meshCenter, radius);
+    size_t nc = clusterStart.size() - 1;
+    std::vector<float> key(nc);
+    parallelRanges(nc, workerCount(), [&](size_t b, size_t e, unsigned){
+        for(size_t c=b; c<e; ++c){
+            Vec3 C(0,0,0), N(0,0,0); float area = 0;
+            for(size_t i=clusterStart[c]; i<clusterStart[c+1]; ++i){
+                const Tri &t = tris[order[i]];
+                const Vec3 &A = verts[t.a].p, &B = verts[t.b].p, &D = verts[t.c].p;
+                Vec3 n = cross(B - A, D - A); float a = len(n);
+                C = C + (A + B + D) * (a / 3.0f); N = N + n; area += a;
+            }
+            if(area > 0) C = C * (1.0f / area);
+            key[c] = dot(C - meshCenter, normalize(N));
+        }
+    });
+    std::vector<uint32_t> clusters(nc);
+    for(size_t c=0; c<nc; ++c) clusters[c] = (uint32_t)c;
+    std::stable_sort(clusters.begin(), clusters.end(), [&](uint32_t a, uint32_t b){ return key[a] > key[b]; });
+    std::vector<Tri> sorted; sorted.reserve(tris.size());
+    for(uint32_t c : clusters) for(size_t i=clusterStart[c]; i<clusterStart[c+1]; ++i) sorted.push_back(tris[order[i]]);
+
+    // vertex fetch: renumber vertices by first use; unreferenced vertices keep their relative order at the end
+    std::vector<int> remap(verts.size(), -1);
+    int next = 0;
+    for(Tri &t : sorted){
+        int* idx[3] = { &t.a, &t.b, &t.c };
+        for(int* v : idx){ if(remap[*v] < 0) remap[*v] = next++; *v = remap[*v]; }
+    }
+    for(size_t v=0; v<verts.size(); ++v) if(remap[v] < 0) remap[v] = next++;
+    std::vector<Vertex> reordered(verts.size());
+    for(size_t v=0; v<verts.size(); ++v) reordered[remap[v]] = verts[v];
+    verts.swap(reordered);
+    tris.swap(sorted);
+    buildVertexAdjacency(adj, tris, verts.size());
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    vertexCacheStats(tris, verts.size(), VCACHE_SIZE, acmr1, atvr1);
+    std::cout << "Reordered " << tris.size() << " tris in " << nc << " clusters (" << ms << " ms). FIFO " << VCACHE_SIZE
+              << ": ACMR " << acmr0 << " -> " << acmr1 << ", ATVR " << atvr0 << " -> " << atvr1 << "\n";
+}
+
+// -------- Mesh simplification & LOD --------
+// Quadric error metric (Garland & Heckbert) with half-edge collapses: a vertex always collapses onto one of
+// its neighbours, so every LOD indexes the same vertex buffer and lives as a sub-range of one index buffer.
+bool generateLods = true;
+static const float lodTargets[] = { 0.5f, 0.25f, 0.10f, 0.02f };
+
+struct Quadric {
+    double q[10] = {0};   // a2 ab ac ad b2 bc bd c2 cd d2
+    double weight = 0;    // sum of plane weights, turns the cost into a mean squared distance
+    void addPlane(double a, double b, double c, double d, double w){
+        weight += w;
+        q[0]+=w*a*a; q[1]+=w*a*b; q[2]+=w*a*c; q[3]+=w*a*d; q[4]+=w*b*b;
+        q[5]+=w*b*c; q[6]+=w*b*d; q[7]+=w*c*c; q[8]+=w*c*d; q[9]+=w*d*d;
+    }
+    void add(const Quadric &o){ for(int i=0;i<10;++i) q[i] += o.q[i]; weight += o.weight; }
+    double eval(const Vec3 &p) const {
+        double x=p.x, y=p.y, z=p.z;
+        return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y + q[7]*z*z + 2*q[8]*z + q[9];
+    }
+};
+
+// Flat and near-planar regions cost (almost) nothing to collapse; the shorter edge goes first on a tie so collapses
+// spread over the region instead of chaining onto one vertex, and MAX_COLLAPSE_VALENCE caps what chaining remains.
+// The key packs the float bits of (cost, squared length): both are non-negative, so one integer compare orders by
+// cost and then by length, and costs within float precision of each other count as tied.
+static const size_t MAX_COLLAPSE_VALENCE = 24;   // triangles around the surviving vertex after a collapse
+struct CollapseCandidate { uint64_t key; uint32_t from, to, stampFrom, stampTo; };
+struct CollapseOrder { bool operator()(const CollapseCandidate &a, const CollapseCandidate &b) const { return a.key > b.key; } };
+static uint64_t collapseKey(double cost, float length2){
+    float c = (float)std::max(0.0, cost);
+    uint32_t hi, lo;
+    memcpy(&hi, &c, 4); memcpy(&lo, &length2, 4);
+    return (uint64_t)hi << 32 | lo;
+}
+static float collapseCost(uint64_t key){ uint32_t hi = (uint32_t)(key >> 32); float c; memcpy(&c, &hi, 4); return c; }
+
+// Simplifies `tris` and appends one index list per target to `out`. A level's error is the largest RMS plane
+// distance of any collapse made so far, in object units.
+void simplifyMesh(const std::vector<Vertex> &verts, const std::vector<Tri> &tris, const float* targets, int nTargets,
+                  std::vector<std::vector<uint32_t>> &outIndices, std::vector<float> &outError){
+    const size_t nv = verts.size(), nt = tris.size();
+    std::vector<uint32_t> idx(nt*3);
+    for(size_t t=0;t<nt;++t){ idx[3*t] = (uint32_t)tris[t].a; idx[3*t+1] = (uint32_t)tris[t].b; idx[3*t+2] = (uint32_t)tris[t].c; }
+    std::vector<char> alive(nt, 1);
+    std::vector<std::vector<uint32_t>> vtris(nv);
+    for(size_t t=0;t<nt;++t) for(int k=0;k<3;++k) vtris[idx[3*t+k]].push_back((uint32_t)t);
+
+    // area-weighted face planes, plus perpendicular planes on boundary edges so borders do not erode
+    std::vector<Quadric> Q(nv);
+    std::vector<uint64_t> edges; edges.reserve(nt*3);
+    for(size_t t=0;t<nt;++t){
+        const Vec3 &A = verts[idx[3*t]].p, &B = verts[idx[3*t+1]].p, &C = verts[idx[3*t+2]].p;
+        Vec3 n = cross(B - A, C - A); float a2 = len(n);
+        if(a2 <= 0) continue;
+        n = n * (1.0f / a2);
+        for(int k=0;k<3;++k) Q[idx[3*t+k]].addPlane(n.x, n.y, n.z, -dot(n, A), a2 * 0.5);
+        for(int k=0;k<3;++k){ uint32_t u = idx[3*t+k], v = idx[3*t+(k+1)%3]; edges.push_back(((uint64_t)std::min(u,v) << 32) | std::max(u,v)); }
+    }
+    std::sort(edges.begin(), edges.end());
+    for(size_t i=0;i<edges.size();){
+        size_t j = i; while(j < edges.size() && edges[j] == edges[i]) ++j;
+        if(j - i == 1){
+            uint32_t u = (uint32_t)(edges[i] >> 32), v = (uint32_t)edges[i];
+            for(uint32_t t : vtris[u]){
+                const uint32_t* f = &idx[3*t];
+                if(f[0] != v && f[1] != v && f[2] != v) continue;
+                const Vec3 &A = verts[f[0]].p, &B = verts[f[1]].p, &C = verts[f[2]].p;
+                Vec3 fn = normalize(cross(B - A, C - A));
+                Vec3 e = verts[v].p - verts[u].p;
+                Vec3 bn = normalize(cross(e, fn));
+                double w = 10.0 * dot(e, e);
+                Q[u].addPlane(bn.x, bn.y, bn.z, -dot(bn, verts[u].p), w);
+                Q[v].addPlane(bn.x, bn.y, bn.z, -dot(bn, verts[u].p), w);
+            }
+        }
+        i = j;
+    }
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    // binary heap in a plain vector (std::push_heap/pop_heap) so stale entries can be compacted away
+    std::vector<uint32_t> stamp(nv, 0);
+    std::vector<CollapseCandidate> heap;
+    CollapseOrder order;
+    auto pushEdge = [&](uint32_t a, uint32_t b){
+        Quadric q = Q[a]; q.add(Q[b]);
+        double ca = q.eval(verts[b].p), cb = q.eval(verts[a].p);   // ca: a moves onto b
+        Vec3 d = verts[b].p - verts[a].p;
+        if(ca <= cb) heap.push_back({ collapseKey(ca, dot(d, d)), a, b, stamp[a], stamp[b] });
+        else heap.push_back({ collapseKey(cb, dot(d, d)), b, a, stamp[b], stamp[a] });
+        std::push_heap(heap.begin(), heap.end(), order);
+    };
+    auto stale = [&](const CollapseCandidate &c){ return stamp[c.from] != c.stampFrom || stamp[c.to] != c.stampTo; };
+    heap.reserve(edges.size());
+    for(uint64_t e : edges) pushEdge((uint32_t)(e >> 32), (uint32_t)e);
+    size_t compactAt = 2 * edges.size() + 1024;
+    edges.clear(); edges.shrink_to_fit();
+
+    size_t liveTris = 0; for(size_t t=0;t<nt;++t) liveTris += alive[t] ? 1 : 0;
+    double maxErr2 = 0.0;
+    int target = 0;
+    std::vector<uint32_t> neighbours;
+    auto snapshot = [&](){
+        std::vector<uint32_t> list; list.reserve(liveTris*3);
+        for(size_t t=0;t<nt;++t) if(alive[t]) list.insert(list.end(), &idx[3*t], &idx[3*t]+3);
+        outIndices.push_back(std::move(list));
+        outError.push_back((float)sqrt(maxErr2));
+    };
+    while(target < nTargets){
+        if(liveTris <= (size_t)(targets[target] * nt)){ snapshot(); ++target; continue; }
+        if(heap.empty()){ snapshot(); ++target; continue; }   // cannot simplify further; repeat the last level
+        if(heap.size() > compactAt){
+            // every collapse requeues the edges around v and strands the old ones; drop those before the heap outgrows the mesh
+            heap.erase(std::remove_if(heap.begin(), heap.end(), stale), heap.end());
+            std::make_heap(heap.begin(), heap.end(), order);
+            compactAt = 2 * heap.size() + 1024;
+        }
+        std::pop_heap(heap.begin(), heap.end(), order);
+        CollapseCandidate c = heap.back(); heap.pop_back();
+        uint32_t u = c.from, v = c.to;
+        if(stale(c)) continue;
+        // reject collapses that flip or degenerate a surviving triangle, or leave v with too many triangles
+        bool ok = true;
+        size_t valence = 0;
+        for(uint32_t t : vtris[v]) valence += alive[t] ? 1 : 0;
+        for(uint32_t t : vtris[u]){
+            if(!alive[t]) continue;
+            const uint32_t* f = &idx[3*t];
+            if(f[0] == v || f[1] == v || f[2] == v){ --valence; continue; }
+            ++valence;
+            Vec3 p[3], q[3];
+            for(int k=0;k<3;++k){ p[k] = verts[f[k]].p; q[k] = (f[k] == u) ? verts[v].p : p[k]; }
+            Vec3 n0 = cross(p[1] - p[0], p[2] - p[0]), n1 = cross(q[1] - q[0], q[2] - q[0]);
+            if(dot(n0, n1) <= 0.0f || len(n1) < 1e-3f * len(n0)){ ok = false; break; }
+        }
+        if(!ok || valence > MAX_COLLAPSE_VALENCE) continue;
+        Q[v].add(Q[u]);
+        if(Q[v].weight > 0) maxErr2 = std::max(maxErr2, collapseCost(c.key) / Q[v].weight);
+        for(uint32_t t : vtris[u]){
+            if(!alive[t]) continue;
+            uint32_t* f = &idx[3*t];
+            for(int k=0;k<3;++k) if(f[k] == u) f[k] = v;
+            if(f[0] == f[1] || f[1] == f[2] || f[0] == f[2]){ alive[t] = 0; --liveTris; }
+            else vtris[v].push_back(t);
+        }
+        vtris[u].clear(); vtris[u].shrink_to_fit();
+        ++stamp[u]; ++stamp[v];
+        // drop dead/duplicate entries and requeue the edges around v
+        std::vector<uint32_t> &vt = vtris[v];
+        vt.erase(std::remove_if(vt.begin(), vt.end(), [&](uint32_t t){ return !alive[t]; }), vt.end());
+        std::sort(vt.begin(), vt.end()); vt.erase(std::unique(vt.begin(), vt.end()), vt.end());
+        neighbours.clear();
+        for(uint32_t t : vt) for(int k=0;k<3;++k) if(idx[3*t+k] != v) neighbours.push_back(idx[3*t+k]);
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        // only edges touching v changed cost; entries for u's and v's old edges are now stale by stamp
+        for(uint32_t w : neighbours) pushEdge(v, w);
+    }
+}
+
+// Builds LOD 1.. of `verts`/`tris` into `levels` (level 0 = the full mesh) and `indices`; `scale` only feeds the log.
+void buildLodChain(const std::vector<Vertex> &vertices, const std::vector<Tri> &triangles, float scale,
+                   std::vector<LodLevel> &lodLevels, std::vector<uint32_t> &lodIndices){
+    lodLevels.clear(); lodIndices.clear();
+    lodLevels.push_back({ 0, (uint32_t)(triangles.size()*3), 0.0f, 0 });
+    if(!generateLods || triangles.empty()) return;
+    auto t0 = std::chrono::steady_clock::now();
+    const int n = (int)(sizeof(lodTargets)/sizeof(lodTargets[0]));
+    std::vector<std::vector<uint32_t>> lists; std::vector<float> errors;
+    simplifyMesh(vertices, triangles, lodTargets, n, lists, errors);
+    uint32_t first = (uint32_t)(triangles.size()*3);
+    for(size_t l=0; l<lists.size(); ++l){
+        std::vector<uint32_t> &list = lists[l];
+        if(optimizeMeshOrder && !list.empty()){
+            // keep coarse levels vertex-cache friendly too
+            std::vector<Tri> lt(list.size()/3);
+            for(size_t t=0;t<lt.size();++t){ lt[t].a = (int)list[3*t]; lt[t].b = (int)list[3*t+1]; lt[t].c = (int)list[3*t+2]; }
+            VertexAdjacency la; buildVertexAdjacency(la, lt, vertices.size());
+            std::vector<uint32_t> order; std::vector<size_t> starts;
+            tipsify(lt, vertices.size(), la, VCACHE_SIZE, order, starts);
+            for(size_t t=0;t<order.size();++t){ const Tri &s = lt[order[t]]; list[3*t] = (uint32_t)s.a; list[3*t+1] = (uint32_t)s.b; list[3*t+2] = (uint32_t)s.c; }
+        }
+        lodLevels.push_back({ first, (uint32_t)list.size(), errors[l], 0 });
+        lodIndices.insert(lodIndices.end(), list.begin(), list.end());
+        first += (uint32_t)list.size();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << "LOD chain (" << ms << " ms):";
+    for(size_t l=0; l<lodLevels.size(); ++l) std::cout << " " << lodLevels[l].indexCount/3 << " tris (err " << lodLevels[l].error*scale << ")";
+    std::cout << "\n";
+}
+
+
+// -------- Meshlets --------
+// Clusters of up to MESHLET_MAX_TRIS connected, similarly oriented triangles, stored as contiguous index
+// ranges of the full mesh, each with a bounding sphere and a normal cone for per-frame culling.
+bool buildMeshletsEnabled = true;
+static const int MESHLET_MAX_TRIS = 128;
+static const int MESHLET_MAX_VERTS = 64;        // ends a run of the optimized order before it strays across the mesh
+static const float MESHLET_NORMAL_COS = 0.7f;   // triangles facing further from the meshlet's seed (or mean, for runs) start a new one
+
+// True when every edge is shared by exactly two triangles. Anything else has holes or seams that back faces show
+// through, and drawMesh() does not cull back faces, so the normal cones must not either.
+static bool isClosedMesh(const std::vector<Tri> &tris, const VertexAdjacency &adj){
+    std::atomic<bool> open(false);
+    parallelRanges(tris.size(), workerCount(), [&](size_t b, size_t e, unsigned){
+        for(size_t t=b; t<e && !open.load(std::memory_order_relaxed); ++t){
+            const int idx[3] = { tris[t].a, tris[t].b, tris[t].c };
+            for(int k=0;k<3;++k){
+                int u = idx[k], v = idx[(k+1)%3], shared = 0;
+                for(uint32_t j=adj.offsets[u]; j<adj.offsets[u+1]; ++j){ const Tri &o = tris[adj.tris[j]]; if(o.a == v || o.b == v || o.c == v) ++shared; }
+                if(shared != 2){ open = true; break; }
+            }
+        }
+    });
+    return !open;
+}
+
+// After optimizeTriangleOrder() meshlets are cut as runs of that order, so its vertex cache, overdraw and fetch order
+// are what gets drawn and cached. Otherwise they are grown breadth-first over shared vertices, `tris` is reordered so
+// each meshlet is contiguous, and `adj` is rebuilt for the new triangle numbering.
+void buildMeshlets(const std::vector<Vertex> &verts, std::vector<Tri> &tris, VertexAdjacency &adj, std::vector<Meshlet> &out){
+    out.clear();
+    if(tris.empty()) return;
+    if(optimizeMeshOrder){
+        std::vector<uint32_t> owner(verts.size(), UINT32_MAX);   // last meshlet that used each vertex
+        Meshlet m; m.firstIndex = 0;
+        size_t count = 0, used = 0;
+        Vec3 axis;   // sum of the run's face normals
+        for(size_t t=0;t<tris.size();++t){
+            const int idx[3] = { tris[t].a, tris[t].b, tris[t].c };
+            uint32_t id = (uint32_t)out.size();
+            size_t fresh = 0;
+            for(int v : idx) fresh += owner[v] != id ? 1 : 0;
+            if(count > 0 && (count == (size_t)MESHLET_MAX_TRIS || used + fresh > (size_t)MESHLET_MAX_VERTS ||
+                             dot(tris[t].fn, normalize(axis)) < MESHLET_NORMAL_COS)){
+                m.indexCount = (uint32_t)(count*3);
+                out.push_back(m);
+                m.firstIndex = (uint32_t)(t*3); count = 0; used = 0; id = (uint32_t)out.size();
+            }
+            if(count == 0) axis = Vec3(0,0,0);
+            axis = axis + tris[t].fn;
+            for(int v : idx) if(owner[v] != id){ owner[v] = id; ++used; }
+            ++count;
+        }
+        m.indexCount = (uint32_t)(count*3);
+        out.push_back(m);
+    } else {
+        std::vector<char> assigned(tris.size(), 0);
+        std::vector<uint32_t> order; order.reserve(tris.size());
+        std::deque<uint32_t> frontier;
+        for(size_t seed=0; seed<tris.size(); ++seed){
+            if(assigned[seed]) continue;
+            Meshlet m; m.firstIndex = (uint32_t)(order.size()*3);
+            Vec3 seedN = tris[seed].fn;
+            size_t count = 0;
+            frontier.clear(); frontier.push_back((uint32_t)seed);
+            while(!frontier.empty() && count < (size_t)MESHLET_MAX_TRIS){
+                uint32_t t = frontier.front(); frontier.pop_front();
+                if(assigned[t]) continue;
+                if(count > 0 && dot(tris[t].fn, seedN) < MESHLET_NORMAL_COS) continue;
+                assigned[t] = 1; order.push_back(t); ++count;
+                const int idx[3] = { tris[t].a, tris[t].b, tris[t].c };
+                for(int v : idx) for(uint32_t k=adj.offsets[v]; k<adj.offsets[v+1]; ++k) if(!assigned[adj.tris[k]]) frontier.push_back(adj.tris[k]);
+            }
+            m.indexCount = (uint32_t)(count*3);
+            out.push_back(m);
+        }
+        std::vector<Tri> sorted(tris.size());
+        for(size_t i=0;i<order.size();++i) sorted[i] = tris[order[i]];
+        tris.swap(sorted);
+        buildVertexAdjacency(adj, tris, verts.size());
+    }
+
+    bool closed = isClosedMesh(tris, adj);
+    parallelRanges(out.size(), workerCount(), [&](size_t b, size_t e, unsigned){
+        for(size_t mi=b; mi<e; ++mi){
+            Meshlet &m = out[mi];
+            size_t t0 = m.firstIndex/3, t1 = t0 + m.indexCount/3;
+            Vec3 lo(INFINITY, INFINITY, INFINITY), hi(-INFINITY, -INFINITY, -INFINITY), axis(0,0,0);
+            for(size_t t=t0; t<t1; ++t){
+                const int idx[3] = { tris[t].a, tris[t].b, tris[t].c };
+                for(int v : idx){ const Vec3 &p = verts[v].p; lo = Vec3(std::min(lo.x,p.x), std::min(lo.y,p.y), std::min(lo.z,p.z)); hi = Vec3(std::max(hi.x,p.x), std::max(hi.y,p.y), std::max(hi.z,p.z)); }
+                axis = axis + tris[t].fn;
+            }
+            Vec3 c = (lo + hi) * 0.5f; float r = 0;
+            for(size_t t=t0; t<t1; ++t){ const int idx[3] = { tris[t].a, tris[t].b, tris[t].c }; for(int v : idx) r = std::max(r, len(verts[v].p - c)); }
+            axis = normalize(axis);
+            // cone half-angle from the widest normal; cutoff = sin(angle), 1 disables backface culling
+            float minDot = 1.0f;
+            for(size_t t=t0; t<t1; ++t) if(len(tris[t].fn) > 0) minDot = std::min(minDot, dot(axis, tris[t].fn));
+            m.center[0] = c.x; m.center[1] = c.y; m.center[2] = c.z; m.radius = r;
+            m.axis[0] = axis.x; m.axis[1] = axis.y; m.axis[2] = axis.z;
+            m.cutoff = (closed && len(axis) > 0 && minDot > 0.1f) ? sqrtf(1.0f - minDot*minDot) : 1.0f;
+        }
+    });
+    double acmr, atvr;
+    vertexCacheStats(tris, verts.size(), VCACHE_SIZE, acmr, atvr);
+    std::cout << "Built " << out.size() << " meshlets (avg " << (double)tris.size() / out.size() << " tris"
+              << (closed ? "" : ", open mesh: no normal-cone culling") << "). Drawn order, FIFO " << VCACHE_SIZE
+              << ": ACMR " << acmr << ", ATVR " << atvr << "\n";
+}
+
+
+// -------- Bounding volume hierarchy & ray queries --------
+// Binary BVH over the triangles, built top-down with binned SAH; the upper levels split across threads. A leaf holds up
+// to 4 triangles transposed into one TriPack, so a single ray meets the whole leaf in one 4-wide Moller-Trumbore test.
+// Packets of 4 rays share every box test and take a leaf's triangles one at a time across their lanes, which pays off
+// for coherent rays (the AO samples of one vertex, shadow rays of neighbouring vertices, 2x2 pixel quads).
+static const int BVH_BINS = 16;
+static const int BVH_MAX_DEPTH = 64;          // deeper splits use the object median, which bounds the traversal stack
+static const int BVH_STACK = 128;
+static const size_t BVH_PARALLEL_MIN = 1u << 15;   // smaller nodes are binned and recursed on one thread
+
+int aoSamples = 0;                 // rays per vertex for the baked ambient occlusion; 0 = none
+float aoRadius = 0.5f;             // occluders further away than this do not count (model radius = 1)
+bool shadowsEnabled = false;       // trace light1 visibility per vertex
+
+struct BVHBox {
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    void grow(const float* p){ for(int k=0;k<3;++k){ lo[k] = std::min(lo[k], p[k]); hi[k] = std::max(hi[k], p[k]); } }
+    void grow(const BVHBox &b){ for(int k=0;k<3;++k){ lo[k] = std::min(lo[k], b.lo[k]); hi[k] = std::max(hi[k], b.hi[k]); } }
+    float area() const {
+        float d[3]; for(int k=0;k<3;++k) d[k] = std::max(0.0f, hi[k] - lo[k]);
+        return d[0]*d[1] + d[1]*d[2] + d[2]*d[0];
+    }
+};
+
+struct BVHBuilder {
+    const MeshView &mv;
+    unsigned workers;
+    std::vector<BVHBox> box;         // per triangle
+    std::vector<float> cen;          // box centres, 3 per triangle
+    std::vector<uint32_t> order;     // triangle ids, partitioned in place; subtrees own disjoint ranges
+    std::unique_ptr<BVHNode[]> nodes;
+    std::unique_ptr<TriPack[]> packs;   // worst-case capacity, only the used prefix is ever touched
+    std::atomic<uint32_t> nodeCount{1}, packCount{0};
+    BVHBuilder(const MeshView &m, unsigned w) : mv(m), workers(w) {}
+
+    struct Bin { BVHBox box; uint32_t count = 0; };
+    // Node and centroid bounds of order[b, e), split over `threads`.
+    void bounds(size_t b, size_t e, unsigned threads, BVHBox &nb, BVHBox &cb){
+        if(e - b < BVH_PARALLEL_MIN) threads = 1;
+        std::vector<BVHBox> pn(threads), pc(threads);
+        parallelRanges(e - b, threads, [&](size_t rb, size_t re, unsigned w){
+            for(size_t i=b+rb; i<b+re; ++i){ uint32_t t = order[i]; pn[w].grow(box[t]); pc[w].grow(&cen[3*t]); }
+        });
+        for(unsigned w=0; w<threads; ++w){ nb.grow(pn[w]); cb.grow(pc[w]); }
+    }
+    // Best SAH split of order[b, e) over BVH_BINS centroid bins per axis; false when every centroid coincides.
+    bool findSplit(size_t b, size_t e, const BVHBox &cb, unsigned threads, int &axis, int &split){
+        if(e - b < BVH_PARALLEL_MIN) threads = 1;
+        float scale[3];
+        for(int k=0;k<3;++k){ float ext = cb.hi[k] - cb.lo[k]; scale[k] = ext > 0 ? BVH_BINS / ext : 0.0f; }
+        if(scale[0] == 0 && scale[1] == 0 && scale[2] == 0) return false;
+        std::vector<Bin> bins((size_t)threads * 3 * BVH_BINS);
+        parallelRanges(e - b, threads, [&](size_t rb, size_t re, unsigned w){
+            Bin* mine = &bins[(size_t)w * 3 * BVH_BINS];
+            for(size_t i=b+rb; i<b+re; ++i){
+                uint32_t t = order[i];
+                for(int k=0;k<3;++k){
+                    if(scale[k] == 0) continue;
+                    int bi = std::min(BVH_BINS-1, (int)((cen[3*t+k] - cb.lo[k]) * scale[k]));
+                    Bin &bin = mine[k*BVH_BINS + bi]; bin.box.grow(box[t]); ++bin.count;
+                }
+            }
+        });
+        for(unsigned w=1; w<threads; ++w)
+            for(int i=0; i<3*BVH_BINS; ++i){ Bin &d = bins[i], &s = bins[(size_t)w*3*BVH_BINS + i]; d.box.grow(s.box); d.count += s.count; }
+        float best = INFINITY;
+        for(int k=0;k<3;++k){
+            if(scale[k] == 0) continue;
+            const Bin* bk = &bins[k*BVH_BINS];
+            // sweep from the right for the suffix costs, then from the left
+            float rightCost[BVH_BINS]; BVHBox acc; uint32_t n = 0;
+            for(int i=BVH_BINS-1; i>0; --i){ acc.grow(bk[i].box); n += bk[i].count; rightCost[i] = n ? acc.area() * n : 0.0f; }
+            acc = BVHBox(); n = 0;
+            for(int i=1; i<BVH_BINS; ++i){
+                acc.grow(bk[i-1].box); n += bk[i-1].count;
+                float cost = (n ? acc.area() * n : 0.0f) + rightCost[i];
+                if(cost < best){ best = cost; axis = k; split = i; }
+            }
+        }
+        return best < INFINITY;
+    }
+    void makeLeaf(BVHNode &node, size_t b, size_t e){
+        uint32_t pi = packCount.fetch_add(1);
+        TriPack &p = packs[pi];
+        memset(&p, 0, sizeof(p));
+        for(size_t k=0; k<4; ++k){
+            if(b + k >= e){ p.tri[k] = UINT32_MAX; continue; }
+            uint32_t t = order[b+k];
+            const uint32_t* I = mv.I(t);
+            const float *a = mv.P(I[0]), *q = mv.P(I[1]), *c = mv.P(I[2]);
+            for(int j=0;j<3;++j){ p.v0[j][k] = a[j]; p.e1[j][k] = q[j] - a[j]; p.e2[j][k] = c[j] - a[j]; }
+            p.tri[k] = t;
+        }
+        node.first = pi; node.count = (uint32_t)(e - b);
+    }
+    void build(uint32_t ni, size_t b, size_t e, int depth){
+        // the top levels share the workers between them; one thread per subtree below that
+        unsigned threads = depth < 31 ? std::max(1u, workers >> depth) : 1u;
+        BVHBox nb, cb;
+        bounds(b, e, threads, nb, cb);
+        BVHNode &node = nodes[ni];
+        for(int k=0;k<3;++k){ node.lo[k] = nb.lo[k]; node.hi[k] = nb.hi[k]; }
+        if(e - b <= 4){ makeLeaf(node, b, e); return; }
+        int axis = -1, split = 0;
+        size_t mid = b;
+        if(depth < BVH_MAX_DEPTH && findSplit(b, e, cb, threads, axis, split)){
+            float lo = cb.lo[axis], scale = BVH_BINS / (cb.hi[axis] - cb.lo[axis]);
+            mid = std::partition(order.begin()+b, order.begin()+e, [&](uint32_t t){
+                return std::min(BVH_BINS-1, (int)((cen[3*t+axis] - lo) * scale)) < split;
+            }) - order.begin();
+        }
+        if(mid == b || mid == e){
+            // no usable SAH split: object median along the widest centroid extent
+            int ax = 0;
+            for(int k=1;k<3;++k) if(cb.hi[k] - cb.lo[k] > cb.hi[ax] - cb.lo[ax]) ax = k;
+            mid = b + (e - b) / 2;
+            std::nth_element(order.begin()+b, order.begin()+mid, order.begin()+e,
+                             [&](uint32_t x, uint32_t y){ return cen[3*x+ax] < cen[3*y+ax]; });
+        }
+        uint32_t c = nodeCount.fetch_add(2);
+        node.first = c; node.count = 0;
+        if(threads > 1 && e - b >= BVH_PARALLEL_MIN){
+            std::thread left([=]{ build(c, b, mid, depth+1); });
+            build(c+1, mid, e, depth+1);
+            left.join();
+        } else {
+            build(c, b, mid, depth+1);
+            build(c+1, mid, e, depth+1);
+        }
+    }
+};
+
+void buildBVH(const MeshView &mv, MeshBVH &out, unsigned workers){
+    out = MeshBVH();
+    size_t n = mv.triCount;
+    if(n == 0) return;
+    auto t0 = std::chrono::steady_clock::now();
+    BVHBuilder B(mv, workers);
+    B.box.resize(n); B.cen.resize(3*n); B.order.resize(n);
+    parallelRanges(n, workers, [&](size_t b, size_t e, unsigned){
+        for(size_t t=b; t<e; ++t){
+            const uint32_t* I = mv.I(t);
+            BVHBox &bb = B.box[t]; bb = BVHBox();
+            for(int j=0;j<3;++j) bb.grow(mv.P(I[j]));
+            for(int k=0;k<3;++k) B.cen[3*t+k] = 0.5f * (bb.lo[k] + bb.hi[k]);
+            B.order[t] = (uint32_t)t;
+        }
+    });
+    B.nodes.reset(new BVHNode[2*n]);
+    B.packs.reset(new TriPack[n]);
+    B.build(0, 0, n, 0);
+    out.nodes.assign(B.nodes.get(), B.nodes.get() + B.nodeCount.load());
+    out.packs.assign(B.packs.get(), B.packs.get() + B.packCount.load());
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    // SAH cost relative to the root box: one unit per box visited, one per triangle tested
+    double rootArea = BVHBox{ { out.nodes[0].lo[0], out.nodes[0].lo[1], out.nodes[0].lo[2] },
+                              { out.nodes[0].hi[0], out.nodes[0].hi[1], out.nodes[0].hi[2] } }.area(), cost = 0;
+    for(const BVHNode &nd : out.nodes){
+        BVHBox bb{ { nd.lo[0], nd.lo[1], nd.lo[2] }, { nd.hi[0], nd.hi[1], nd.hi[2] } };
+        cost += bb.area() * (nd.count ? nd.count : 1);
+    }
+    std::cout << "Built BVH: " << out.nodes.size() << " nodes, " << out.packs.size() << " leaves ("
+              << (double)n / out.packs.size() << " tris/leaf), SAH cost " << (rootArea > 0 ? cost / rootArea : 0.0)
+              << ", " << ms << " ms on " << workers << " thread(s)\n";
+}
+
+// Moller-Trumbore over 4 lanes: 4 rays against one triangle, or one ray against 4 (the caller broadcasts the other
+// side). Degenerate triangles give det = 0 and fail the barycentric tests through inf/NaN.
+static inline M4 rayTri4(const F4 o[3], const F4 d[3], const F4 v0[3], const F4 e1[3], const F4 e2[3], F4 tmin, F4 tmax, F4 &t){
+    F4 px = d[1]*e2[2] - d[2]*e2[1], py = d[2]*e2[0] - d[0]*e2[2], pz = d[0]*e2[1] - d[1]*e2[0];
+    F4 inv = f4(1.0f) / (e1[0]*px + e1[1]*py + e1[2]*pz);
+    F4 sx = o[0] - v0[0], sy = o[1] - v0[1], sz = o[2] - v0[2];
+    F4 u = (sx*px + sy*py + sz*pz) * inv;
+    F4 qx = sy*e1[2] - sz*e1[1], qy = sz*e1[0] - sx*e1[2], qz = sx*e1[1] - sy*e1[0];
+    F4 v = (d[0]*qx + d[1]*qy + d[2]*qz) * inv;
+    t = (e2[0]*qx + e2[1]*qy + e2[2]*qz) * inv;
+    F4 zero = f4(0.0f);
+    return f4ge(u, zero) & f4ge(v, zero) & f4ge(f4(1.0f), u + v) & f4lt(tmin, t) & f4lt(t, tmax);
+}
+
+// Single ray o + t*d, t in (tmin, tmax). Returns the closest hit in `hit`, or with hit == nullptr stops at the first
+// one (occlusion).
+bool bvhTrace(const MeshBVH &bvh, const float o[3], const float d[3], float tmin, float tmax, RayHit* hit){
+    if(bvh.empty()) return false;
+    float inv[3] = { safeInverse(d[0]), safeInverse(d[1]), safeInverse(d[2]) };
+    F4 O[3] = { f4(o[0]), f4(o[1]), f4(o[2]) }, D[3] = { f4(d[0]), f4(d[1]), f4(d[2]) };
+    uint32_t stack[BVH_STACK]; int sp = 0;
+    stack[sp++] = 0;
+    bool found = false;
+    while(sp){
+        const BVHNode &n = bvh.nodes[stack[--sp]];
+        float t0 = tmin, t1 = tmax;
+        for(int k=0;k<3;++k){
+            float a = (n.lo[k] - o[k]) * inv[k], b = (n.hi[k] - o[k]) * inv[k];
+            t0 = std::max(t0, std::min(a, b)); t1 = std::min(t1, std::max(a, b));
+        }
+        if(t0 > t1) continue;
+        if(n.count){
+            const TriPack &p = bvh.packs[n.first];
+            F4 v0[3] = { f4load(p.v0[0]), f4load(p.v0[1]), f4load(p.v0[2]) };
+            F4 e1[3] = { f4load(p.e1[0]), f4load(p.e1[1]), f4load(p.e1[2]) };
+            F4 e2[3] = { f4load(p.e2[0]), f4load(p.e2[1]), f4load(p.e2[2]) };
+            F4 t;
+            int bits = m4bits(rayTri4(O, D, v0, e1, e2, f4(tmin), f4(tmax), t));
+            if(!bits) continue;
+            if(!hit) return true;
+            float tl[4]; f4lanes(t, tl);
+            for(int k=0;k<4;++k) if((bits & (1<<k)) && tl[k] < tmax){ tmax = tl[k]; hit->t = tmax; hit->tri = p.tri[k]; }
+            found = true;
+        } else {
+            // push the far child first so the near one is visited next
+            const BVHNode &a = bvh.nodes[n.first], &b = bvh.nodes[n.first+1];
+            float ab = 0;
+            for(int k=0;k<3;++k) ab += (a.lo[k] + a.hi[k] - b.lo[k] - b.hi[k]) * d[k];
+            stack[sp++] = ab > 0 ? n.first : n.first+1;
+            stack[sp++] = ab > 0 ? n.first+1 : n.first;
+        }
+    }
+    return found;
+}
+
+// Returns the mask of lanes that hit something. With `closest`, tmax/tri of the hitting lanes hold the nearest hit;
+// otherwise a lane retires at its first hit (occlusion) and the packet stops once every lane has.
+int bvhTrace4(const MeshBVH &bvh, RayPacket &r, bool closest){
+    if(bvh.empty()) return 0;
+    int live = m4bits(f4lt(r.tmin, r.tmax)), hits = 0;
+    if(!live) return 0;
+    F4 tmax = r.tmax, retired = f4(-INFINITY);
+    float dsum[3];
+    for(int k=0;k<3;++k){ float l[4]; f4lanes(r.d[k], l); dsum[k] = l[0] + l[1] + l[2] + l[3]; }
+    for(int k=0;k<4;++k) r.tri[k] = UINT32_MAX;
+    uint32_t stack[BVH_STACK]; int sp = 0;
+    stack[sp++] = 0;
+    while(sp){
+        const BVHNode &n = bvh.nodes[stack[--sp]];
+        F4 ta = (f4(n.lo[0]) - r.o[0]) * r.inv[0], tb = (f4(n.hi[0]) - r.o[0]) * r.inv[0];
+        F4 t0 = f4max(r.tmin, f4min(ta, tb)), t1 = f4min(tmax, f4max(ta, tb));
+        for(int k=1;k<3;++k){
+            ta = (f4(n.lo[k]) - r.o[k]) * r.inv[k]; tb = (f4(n.hi[k]) - r.o[k]) * r.inv[k];
+            t0 = f4max(t0, f4min(ta, tb)); t1 = f4min(t1, f4max(ta, tb));
+        }
+        if(!(m4bits(f4ge(t1, t0)) & live)) continue;
+        if(n.count){
+            const TriPack &p = bvh.packs[n.first];
+            for(uint32_t k=0; k<n.count; ++k){
+                F4 v0[3] = { f4(p.v0[0][k]), f4(p.v0[1][k]), f4(p.v0[2][k]) };
+                F4 e1[3] = { f4(p.e1[0][k]), f4(p.e1[1][k]), f4(p.e1[2][k]) };
+                F4 e2[3] = { f4(p.e2[0][k]), f4(p.e2[1][k]), f4(p.e2[2][k]) };
+                F4 t;
+                M4 m = rayTri4(r.o, r.d, v0, e1, e2, r.tmin, tmax, t);
+                int bits = m4bits(m) & live;
+                if(!bits) continue;
+                hits |= bits;
+                if(closest){
+                    tmax = f4select(m, t, tmax);
+                    for(int l=0;l<4;++l) if(bits & (1<<l)) r.tri[l] = p.tri[k];
+                } else {
+                    live &= ~bits;
+                    if(!live) return hits;
+                    tmax = f4select(m, retired, tmax);
+                }
+            }
+        } else {
+            const BVHNode &a = bvh.nodes[n.first], &b = bvh.nodes[n.first+1];
+            float ab = 0;
+            for(int k=0;k<3;++k) ab += (a.lo[k] + a.hi[k] - b.lo[k] - b.hi[k]) * dsum[k];
+            stack[sp++] = ab > 0 ? n.first : n.first+1;
+            stack[sp++] = ab > 0 ? n.first+1 : n.first;
+        }
+    }
+    if(closest) r.tmax = tmax;
+    return hits;
+}
+
+// Orthonormal tangent frame around a unit normal (Duff et al. 2017), branch-free apart from the sign.
+static void tangentFrame(const Vec3 &n, Vec3 &t, Vec3 &b){
+    float s = n.z >= 0 ? 1.0f : -1.0f, a = -1.0f / (s + n.z), c = n.x * n.y * a;
+    t = Vec3(1.0f + s * n.x * n.x * a, s * c, -s * n.x);
+    b = Vec3(c, s + n.y * n.y * a, -n.y);
+}
+
+static float radicalInverse(uint32_t i){
+    i = (i << 16) | (i >> 16);
+    i = ((i & 0x55555555u) << 1) | ((i & 0xAAAAAAAAu) >> 1);
+    i = ((i & 0x33333333u) << 2) | ((i & 0xCCCCCCCCu) >> 2);
+    i = ((i & 0x0F0F0F0Fu) << 4) | ((i & 0xF0F0F0F0u) >> 4);
+    i = ((i & 0x00FF00FFu) << 8) | ((i & 0xFF00FF00u) >> 8);
+    return (float)(i * 2.3283064365386963e-10);
+}
+
+// Ambient occlusion per vertex as 0..255, the share of `samples` cosine-weighted hemisphere rays that travel `radius`
+// (model radius = 1) without hitting the mesh. The samples are one Hammersley set, turned about the normal by a
+// per-vertex angle so the error shows as noise instead of banding. Threads take vertices in blocks of 256, since
+// open and enclosed regions differ widely in cost. Returns the number of rays traced; `blocked` counts the hits.
+size_t bakeAmbientOcclusion(const MeshView &mv, float scale, const MeshBVH &bvh, int samples, float radius, unsigned workers,
+                            std::vector<uint8_t> &ao, size_t* blocked){
+    size_t nv = mv.vertexCount;
+    ao.assign(nv, 255);
+    if(samples <= 0 || bvh.empty()) return 0;
+    // tangent-plane radius, normal component and azimuth of each sample
+    std::vector<float> sr(samples), sz(samples), sc(samples), ss(samples);
+    for(int s=0; s<samples; ++s){
+        float u = (s + 0.5f) / samples, phi = 6.28318530718f * radicalInverse((uint32_t)s);
+        sr[s] = sqrtf(u); sz[s] = sqrtf(1.0f - u); sc[s] = cosf(phi); ss[s] = sinf(phi);
+    }
+    const size_t BLOCK = 256;
+    float eps = RAY_EPSILON / scale, reach = radius / scale;
+    std::atomic<size_t> next(0), rays(0), hits(0);
+    parallelRanges(workers, workers, [&](size_t, size_t, unsigned){
+        size_t traced = 0, hit = 0;
+        for(size_t blk; (blk = next.fetch_add(1)) * BLOCK < nv; ){
+            for(size_t i=blk*BLOCK, end=std::min(nv, i+BLOCK); i<end; ++i){
+                const float* p = mv.P(i); const float* nn = mv.N(i);
+                Vec3 N(nn[0], nn[1], nn[2]);
+                if(len(N) < 0.5f) continue;   // no normal (isolated vertex): leave it open
+                N = normalize(N);
+                Vec3 T, Bt; tangentFrame(N, T, Bt);
+                uint32_t h = (uint32_t)i * 0x9E3779B1u; h ^= h >> 15; h *= 0x85EBCA77u; h ^= h >> 13;
+                float rot = 6.28318530718f * (h >> 8) / 16777216.0f, rc = cosf(rot), rs = sinf(rot);
+                RayPacket rp;
+                for(int k=0;k<3;++k) rp.o[k] = f4(p[k] + (&N.x)[k] * eps);
+                rp.tmin = f4(0.0f);
+                int open = 0;
+                for(int s=0; s<samples; s+=4){
+                    float dx[4], dy[4], dz[4], tm[4];
+                    for(int k=0;k<4;++k){
+                        int j = std::min(s+k, samples-1);
+                        tm[k] = s + k < samples ? reach : -1.0f;
+                        float c = sc[j]*rc - ss[j]*rs, sn = ss[j]*rc + sc[j]*rs;   // azimuth + rot
+                        Vec3 dir = T * (sr[j] * c) + Bt * (sr[j] * sn) + N * sz[j];
+                        dx[k] = dir.x; dy[k] = dir.y; dz[k] = dir.z;
+                    }
+                    rp.setDirections(dx, dy, dz);
+                    rp.tmax = f4load(tm);
+                    int lanes = std::min(4, samples - s);
+                    int mask = bvhTrace4(bvh, rp, false);
+                    for(int k=0;k<lanes;++k) if(!(mask & (1<<k))) ++open;
+                    traced += lanes;
+                }
+                hit += samples - open;
+                ao[i] = (uint8_t)lrintf(255.0f * open / samples);
+            }
+        }
+        rays += traced; hits += hit;
+    });
+    if(blocked) *blocked = hits.load();
+    return rays.load();
+}
+
+// light1 visibility per vertex (255 lit, 0 shadowed) for a light at `light` in object space. Vertices facing away
+// from the light stay dark without a ray. Four neighbouring vertices go out as one packet, as their rays converge on
+// the light. Returns the number of rays traced; `blocked` counts the hits.
+size_t traceLightVisibility(const MeshView &mv, float scale, const MeshBVH &bvh, const Vec3 &light, unsigned workers,
+                            std::vector<uint8_t> &vis, size_t* blocked){
+    size_t nv = mv.vertexCount;
+    vis.assign(nv, 255);
+    if(bvh.empty()) return 0;
+    float eps = RAY_EPSILON / scale;
+    std::vector<size_t> rays(std::max(1u, workers), 0), hits(rays.size(), 0);
+    parallelRanges((nv + 3) / 4, workers, [&](size_t b, size_t e, unsigned w){
+        RayPacket rp;
+        rp.tmin = f4(0.0f);
+        for(size_t q=b; q<e; ++q){
+            float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], tm[4];
+            int lanes = 0;
+            for(int k=0;k<4;++k){
+                size_t i = 4*q + k;
+                ox[k] = oy[k] = oz[k] = 0; dx[k] = dy[k] = 0; dz[k] = 1; tm[k] = -1.0f;
+                if(i >= nv) continue;
+                const float* p = mv.P(i); const float* nn = mv.N(i);
+                Vec3 N = normalize(Vec3(nn[0], nn[1], nn[2]));
+                Vec3 o = Vec3(p[0], p[1], p[2]) + N * eps, L = light - o;
+                float dist = len(L);
+                if(dist <= eps || dot(N, L) <= 0){ vis[i] = 0; continue; }
+                L = L * (1.0f / dist);
+                ox[k] = o.x; oy[k] = o.y; oz[k] = o.z; dx[k] = L.x; dy[k] = L.y; dz[k] = L.z; tm[k] = dist - eps;
+                ++lanes;
+            }
+            if(!lanes) continue;
+            rp.o[0] = f4load(ox); rp.o[1] = f4load(oy); rp.o[2] = f4load(oz);
+            rp.setDirections(dx, dy, dz);
+            rp.tmax = f4load(tm);
+            int mask = bvhTrace4(bvh, rp, false);
+            for(int k=0;k<4;++k) if(mask & (1<<k)){ vis[4*q + k] = 0; ++hits[w]; }
+            rays[w] += lanes;
+        }
+    });
+    size_t total = 0, hit = 0;
+    for(size_t w=0; w<rays.size(); ++w){ total += rays[w]; hit += hits[w]; }
+    if(blocked) *blocked = hit;
+    return total;
+}
+
+// -------- Mesh state --------
+MeshView meshView(const MeshData &m){
+    if(m.cache.loaded()){
+        const SMFBHeader &h = *m.cache.hdr;
+        return { m.cache.pos, m.cache.norm, 3, h.vertexCount, m.cache.idx, 3, h.triCount,
+                 m.cache.idx + (size_t)h.triCount*3, (size_t)(h.indexCount - (uint64_t)h.triCount*3), m.cache.ao };
+    }
+    static_assert(sizeof(Vertex) == 6*sizeof(float) && sizeof(Tri) == 6*sizeof(int), "Vertex/Tri must be tightly packed");
+    return { m.vertices.empty() ? nullptr : &m.vertices[0].p.x, m.vertices.empty() ? nullptr : &m.vertices[0].n.x, 6, m.vertices.size(),
+             m.triangles.empty() ? nullptr : (const uint32_t*)&m.triangles[0].a, 6, m.triangles.size(),
+             m.lodIndices.data(), m.lodIndices.size(), m.ao.empty() ? nullptr : m.ao.data() };
+}
+
+// -------- SMF loader & normal averaging --------
+struct SMFChunk { const char* begin; const char* end; size_t nv=0, nf=0, vOff=0, fOff=0; };
+
+bool parseSMF(const std::string &path, MeshData &m, SMFParseStats* stats){
+    auto t0 = std::chrono::steady_clock::now();
+    MappedFile file;
+    if(!file.open(path)){ std::cerr << "Cannot open " << path << "\n"; return false; }
+    const char* data = file.data;
+    const char* end = data + file.size;
+
+    // split at line boundaries; small files are not worth the thread start-up
+    unsigned workers = (file.size < (1u<<20)) ? 1u : workerCount();
+    std::vector<SMFChunk> chunks(workers);
+    const char* cur = data;
+    for(unsigned i=0;i<workers;++i){
+        const char* stop = (i+1==workers) ? end : data + file.size*(i+1)/workers;
+        if(stop < cur) stop = cur;
+        if(stop < end){ const char* nl = (const char*)memchr(stop, '\n', end-stop); stop = nl ? nl+1 : end; }
+        chunks[i].begin = cur; chunks[i].end = stop; cur = stop;
+    }
+
+    // pass 1: count records per chunk so the output arrays are sized exactly once
+    parallelRanges(chunks.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t ci=b; ci<e; ++ci){
+            SMFChunk &ch = chunks[ci];
+            for(const char* p=ch.begin; p<ch.end; ){
+                const char* eol = (const char*)memchr(p, '\n', ch.end-p); if(!eol) eol = ch.end;
+                char rt = recordType(p, eol);
+                if(rt=='v') ++ch.nv; else if(rt=='f') ++ch.nf;
+                p = eol + 1;
+            }
+        }
+    });
+    size_t nv=0, nf=0;
+    for(auto &ch : chunks){ ch.vOff = nv; ch.fOff = nf; nv += ch.nv; nf += ch.nf; }
+
+    std::vector<Vertex> verts(nv);
+    std::vector<Tri> tris(nf);
+
+    // pass 2: parse each chunk straight into its slice of the merged arrays
+    std::vector<size_t> badFaces(workers, 0);
+    parallelRanges(chunks.size(), workers, [&](size_t b, size_t e, unsigned w){
+        for(size_t ci=b; ci<e; ++ci){
+            SMFChunk &ch = chunks[ci];
+            Vertex* vo = verts.data() + ch.vOff;
+            Tri* fo = tris.data() + ch.fOff;
+            for(const char* p=ch.begin; p<ch.end; ){
+                const char* eol = (const char*)memchr(p, '\n', ch.end-p); if(!eol) eol = ch.end;
+                char rt = recordType(p, eol);
+                if(rt=='v'){
+                    Vec3 &v = (vo++)->p; const char* q = p;
+                    if(q) q = scanFloat(q, eol, v.x);
+                    if(q) q = scanFloat(q, eol, v.y);
+                    if(q) q = scanFloat(q, eol, v.z);
+                } else if(rt=='f'){
+                    Tri &t = *fo++; const char* q = p; int a=0,b2=0,c2=0;
+                    if(q) q = scanInt(q, eol, a);
+                    if(q) q = scanInt(q, eol, b2);
+                    if(q) q = scanInt(q, eol, c2);
+                    t.a = a-1; t.b = b2-1; t.c = c2-1;
+                    if(!q || t.a<0 || t.b<0 || t.c<0 || (size_t)t.a>=nv || (size_t)t.b>=nv || (size_t)t.c>=nv){ t.a = -1; ++badFaces[w]; }
+                }
+                p = eol + 1;
+            }
+        }
+    });
+    size_t bad = 0; for(size_t n : badFaces) bad += n;
+    if(bad){
+        std::cerr << "Skipping " << bad << " malformed face(s) in " << path << "\n";
+        tris.erase(std::remove_if(tris.begin(), tris.end(), [](const Tri &t){ return t.a < 0; }), tris.end());
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    // face normals (needs all vertices, so it runs after the chunks are merged)
+    parallelRanges(tris.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t i=b; i<e; ++i){
+            Tri &t = tris[i];
+            Vec3 u = verts[t.b].p - verts[t.a].p; Vec3 v = verts[t.c].p - verts[t.a].p;
+            t.fn = normalize(cross(u,v));
+        }
+    });
+    m.vertices.swap(verts);
+    m.triangles.swap(tris);
+    if(stats){ stats->bytes = file.size; stats->seconds = std::chrono::duration<double>(t1 - t0).count(); stats->workers = workers; }
+    return true;
+}
+
+void processMesh(MeshData &m){
+    buildVertexAdjacency(m.vertexFaces, m.triangles, m.vertices.size());
+    computeVertexNormals(m.vertices, m.triangles, m.vertexFaces, normalWeighting);
+    if(optimizeMeshOrder) optimizeTriangleOrder(m.vertices, m.triangles, m.vertexFaces);
+    if(buildMeshletsEnabled) buildMeshlets(m.vertices, m.triangles, m.vertexFaces, m.meshlets);
+    else m.meshlets.clear();
+    // centroid & scale
+    float maxd = 0.0f;
+    computeBounds(m.vertices, m.centroid, maxd);
+    if(maxd < 1e-6f) maxd = 1.0f;
+    m.modelScale = 1.0f / maxd;
+    buildLodChain(m.vertices, m.triangles, m.modelScale, m.lodLevels, m.lodIndices);
+}
+
+bool loadSMF(const std::string &path, MeshData &m){
+    SMFParseStats st;
+    if(!parseSMF(path, m, &st)) return false;
+    processMesh(m);
+    double mb = (double)st.bytes / (1024.0*1024.0);
+    std::cout << "Loaded " << m.vertices.size() << " verts, " << m.triangles.size() << " tris.\n";
+    std::cout << "Parsed " << mb << " MB in " << st.seconds*1000.0 << " ms ("
+              << (st.seconds > 0.0 ? mb/st.seconds : 0.0) << " MB/s, " << st.workers << " thread(s))\n";
+    return true;
+}
+
+// -------- Binary mesh cache files --------
+
+static std::string cachePathFor(const std::string &path){
+    size_t n = path.size();
+    if(n >= 4 && path.compare(n-4, 4, ".smf") == 0) return path + "b";
+    return path + ".smfb";
+}
+
+static uint64_t hashBytes(const char* p, size_t n, uint64_t h){
+    const uint64_t K = 0x9E3779B97F4A7C15ull;
+    size_t i = 0;
+    for(; i+8 <= n; i += 8){ uint64_t w; memcpy(&w, p+i, 8); h = (h ^ w) * K; h ^= h >> 29; }
+    for(; i < n; ++i) h = (h ^ (uint8_t)p[i]) * 0x100000001B3ull;
+    return h;
+}
+
+// Hashes fixed 4 MB blocks in parallel and folds them in order, so the result does not depend on thread count.
+static bool hashFile(const std::string &path, uint64_t &hash, uint64_t &size){
+    MappedFile f;
+    if(!f.open(path)) return false;
+    const size_t block = 4u<<20;
+    size_t nb = (f.size + block - 1) / block;
+    std::vector<uint64_t> partial(nb);
+    parallelRanges(nb, workerCount(), [&](size_t b, size_t e, unsigned){
+        for(size_t i=b; i<e; ++i){
+            size_t off = i*block;
+            partial[i] = hashBytes(f.data + off, std::min(block, f.size - off), 0xCBF29CE484222325ull);
+        }
+    });
+    uint64_t h = 0xCBF29CE484222325ull ^ (uint64_t)f.size;
+    for(uint64_t ph : partial) h = hashBytes((const char*)&ph, sizeof(ph), h);
+    hash = h; size = f.size;
+    return true;
+}
+
+static uint32_t expectedCacheFlags(){
+    return (optimizeMeshOrder ? SMFB_OPTIMIZED : 0u) | (generateLods ? SMFB_LODS : 0u) | (buildMeshletsEnabled ? SMFB_MESHLETS : 0u) |
+           (aoSamples > 0 ? SMFB_AO : 0u);
+}
+
+bool loadMeshCache(const std::string &cachePath, uint64_t srcHash, uint64_t srcSize, MeshData &m){
+    MeshCache &mc = m.cache;
+    if(!mc.file.open(cachePath) || mc.file.size < sizeof(SMFBHeader)) return false;
+    const SMFBHeader* h = (const SMFBHeader*)mc.file.data;
+    bool ok = memcmp(h->magic, "SMFB", 4) == 0 && h->version == SMFB_VERSION &&
+              h->sourceHash == srcHash && h->sourceSize == srcSize && h->fileSize == mc.file.size &&
+              h->normalWeight == (uint32_t)normalWeighting && h->flags == expectedCacheFlags() &&
+              h->indexCount >= (uint64_t)h->triCount*3 && h->lodCount >= 1 &&
+              h->posOffset  + (uint64_t)h->vertexCount*3*sizeof(float)    <= mc.file.size &&
+              h->normOffset + (uint64_t)h->vertexCount*3*sizeof(float)    <= mc.file.size &&
+              h->idxOffset  + h->indexCount*sizeof(uint32_t)              <= mc.file.size &&
+              h->lodOffset  + (uint64_t)h->lodCount*sizeof(LodLevel)      <= mc.file.size &&
+              h->meshletOffset + (uint64_t)h->meshletCount*sizeof(Meshlet) <= mc.file.size &&
+              (aoSamples == 0 || (h->aoSamples == (uint32_t)aoSamples && h->aoRadius == aoRadius &&
+                                  h->aoOffset + h->vertexCount <= mc.file.size));
+    if(!ok){ std::cout << "Mesh cache " << cachePath << " is stale, rebuilding.\n"; mc.reset(); return false; }
+    mc.hdr  = h;
+    mc.pos  = (const float*)(mc.file.data + h->posOffset);
+    mc.norm = (const float*)(mc.file.data + h->normOffset);
+    mc.idx  = (const uint32_t*)(mc.file.data + h->idxOffset);
+    mc.lods = (const LodLevel*)(mc.file.data + h->lodOffset);
+    mc.ao   = (h->flags & SMFB_AO) ? (const uint8_t*)(mc.file.data + h->aoOffset) : nullptr;
+    m.lodLevels.assign(mc.lods, mc.lods + h->lodCount);
+    const Meshlet* ml = (const Meshlet*)(mc.file.data + h->meshletOffset);
+    m.meshlets.assign(ml, ml + h->meshletCount);
+    m.lodIndices.clear();
+    m.centroid = Vec3(h->centroid[0], h->centroid[1], h->centroid[2]);
+    m.modelScale = h->modelScale;
+    std::cout << "Loaded " << h->vertexCount << " verts, " << h->triCount << " tris from cache " << cachePath << ".\n";
+    return true;
+}
+
+bool writeMeshCache(const std::string &cachePath, uint64_t srcHash, uint64_t srcSize, const MeshData &m){
+    SMFBHeader h; memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "SMFB", 4);
+    h.version = SMFB_VERSION;
+    h.sourceHash = srcHash; h.sourceSize = srcSize;
+    h.vertexCount = (uint32_t)m.vertices.size(); h.triCount = (uint32_t)m.triangles.size();
+    h.normalWeight = (uint32_t)normalWeighting;
+    h.flags = expectedCacheFlags();
+    h.centroid[0] = m.centroid.x; h.centroid[1] = m.centroid.y; h.centroid[2] = m.centroid.z;
+    h.modelScale = m.modelScale;
+    h.posOffset  = alignUp(sizeof(SMFBHeader));
+    h.normOffset = alignUp(h.posOffset + (uint64_t)h.vertexCount*3*sizeof(float));
+    h.idxOffset  = alignUp(h.normOffset + (uint64_t)h.vertexCount*3*sizeof(float));
+    h.indexCount = (uint64_t)h.triCount*3 + m.lodIndices.size();
+    h.lodCount   = (uint32_t)m.lodLevels.size();
+    h.lodOffset  = alignUp(h.idxOffset + h.indexCount*sizeof(uint32_t));
+    h.meshletCount  = (uint32_t)m.meshlets.size();
+    h.meshletOffset = alignUp(h.lodOffset + (uint64_t)h.lodCount*sizeof(LodLevel));
+    h.aoOffset   = alignUp(h.meshletOffset + (uint64_t)h.meshletCount*sizeof(Meshlet));
+    if(!m.ao.empty()){ h.aoSamples = (uint32_t)aoSamples; h.aoRadius = aoRadius; }
+    h.fileSize   = h.aoOffset + m.ao.size();
+
+    // write to a temp file and rename, so a crash never leaves a half-written cache behind
+    std::string tmp = cachePath + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if(!f){ std::cerr << "Cannot write mesh cache " << cachePath << "\n"; return false; }
+    bool ok = true;
+    auto pad = [&](uint64_t to){ static const char zeros[16] = {0}; long at = ftell(f); if(at >= 0 && (uint64_t)at < to) ok = ok && fwrite(zeros, 1, (size_t)(to - at), f) == (size_t)(to - at); };
+    ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    // stream the AoS vertex data through a small block instead of staging whole arrays
+    float blk[3*4096];
+    for(int pass=0; pass<2 && ok; ++pass){
+        pad(pass==0 ? h.posOffset : h.normOffset);
+        for(size_t i=0; i<m.vertices.size() && ok; ){
+            size_t n = std::min<size_t>(4096, m.vertices.size()-i);
+            for(size_t k=0;k<n;++k){ const Vec3 &v = pass==0 ? m.vertices[i+k].p : m.vertices[i+k].n; blk[3*k]=v.x; blk[3*k+1]=v.y; blk[3*k+2]=v.z; }
+            ok = fwrite(blk, sizeof(float), 3*n, f) == 3*n;
+            i += n;
+        }
+    }
+    pad(h.idxOffset);
+    uint32_t iblk[3*4096];
+    for(size_t i=0; i<m.triangles.size() && ok; ){
+        size_t n = std::min<size_t>(4096, m.triangles.size()-i);
+        for(size_t k=0;k<n;++k){ const Tri &t = m.triangles[i+k]; iblk[3*k]=(uint32_t)t.a; iblk[3*k+1]=(uint32_t)t.b; iblk[3*k+2]=(uint32_t)t.c; }
+        ok = fwrite(iblk, sizeof(uint32_t), 3*n, f) == 3*n;
+        i += n;
+    }
+    if(ok && !m.lodIndices.empty()) ok = fwrite(m.lodIndices.data(), sizeof(uint32_t), m.lodIndices.size(), f) == m.lodIndices.size();
+    pad(h.lodOffset);
+    if(ok && !m.lodLevels.empty()) ok = fwrite(m.lodLevels.data(), sizeof(LodLevel), m.lodLevels.size(), f) == m.lodLevels.size();
+    pad(h.meshletOffset);
+    if(ok && !m.meshlets.empty()) ok = fwrite(m.meshlets.data(), sizeof(Meshlet), m.meshlets.size(), f) == m.meshlets.size();
+    pad(h.aoOffset);
+    if(ok && !m.ao.empty()) ok = fwrite(m.ao.data(), 1, m.ao.size(), f) == m.ao.size();
+    ok = (fclose(f) == 0) && ok;
+    if(!ok || rename(tmp.c_str(), cachePath.c_str()) != 0){
+        std::cerr << "Cannot write mesh cache " << cachePath << "\n";
+        remove(tmp.c_str());
+        return false;
+    }
+    std::cout << "Wrote mesh cache " << cachePath << "\n";
+    return true;
+}
+
+// Builds the BVH when AO or shadows need it and bakes the AO unless the mesh already carries it (from the cache).
+static void prepareRayQueries(MeshData &m){
+    if(aoSamples == 0 && !shadowsEnabled) return;
+    MeshView mv = meshView(m);
+    unsigned workers = workerCount();
+    if(m.bvh.empty() && (shadowsEnabled || !mv.ao)) buildBVH(mv, m.bvh, workers);
+    if(aoSamples > 0 && !mv.ao){
+        auto t0 = std::chrono::steady_clock::now();
+        size_t rays = bakeAmbientOcclusion(mv, m.modelScale, m.bvh, aoSamples, aoRadius, workers, m.ao);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        std::cout << "Baked AO: " << mv.vertexCount << " verts x " << aoSamples << " rays in " << ms << " ms ("
+                  << (ms > 0 ? rays / ms / 1000.0 : 0.0) << " Mrays/s, " << workers << " thread(s))\n";
+        if(!shadowsEnabled) m.bvh = MeshBVH();   // only needed for the bake
+    }
+}
+
+// Loads from the .smfb next to `path` when it matches the source, otherwise parses and (re)writes it.
+bool loadMesh(const std::string &path, MeshData &m){
+    uint64_t srcHash=0, srcSize=0;
+    if(!hashFile(path, srcHash, srcSize)){ std::cerr << "Cannot open " << path << "\n"; return false; }
+    std::string cachePath = cachePathFor(path);
+    if(loadMeshCache(cachePath, srcHash, srcSize, m)){ prepareRayQueries(m); return true; }
+    m.cache.reset();
+    if(!loadSMF(path, m)) return false;
+    prepareRayQueries(m);
+    writeMeshCache(cachePath, srcHash, srcSize, m);
+    return true;
+}
+
+void ensureCPUMesh(MeshData &m){
+    if(!m.cache.loaded() || !m.triangles.empty()) return;
+    const SMFBHeader &h = *m.cache.hdr;
+    const float* P = m.cache.pos; const float* N = m.cache.norm; const uint32_t* I = m.cache.idx;
+    m.vertices.resize(h.vertexCount);
+    m.triangles.resize(h.triCount);
+    unsigned workers = workerCount();
+    parallelRanges(m.vertices.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t i=b;i<e;++i){ m.vertices[i].p = Vec3(P[3*i],P[3*i+1],P[3*i+2]); m.vertices[i].n = Vec3(N[3*i],N[3*i+1],N[3*i+2]); }
+    });
+    parallelRanges(m.triangles.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t i=b;i<e;++i){
+            Tri &t = m.triangles[i]; t.a = (int)I[3*i]; t.b = (int)I[3*i+1]; t.c = (int)I[3*i+2];
+            t.fn = normalize(cross(m.vertices[t.b].p - m.vertices[t.a].p, m.vertices[t.c].p - m.vertices[t.a].p));
+        }
+    });
+}
+
+// -------- Out-of-core chunked meshes (.smfc) --------
+static const size_t CHUNK_TARGET_TRIS = 32768;
+static const int CHUNK_MAX_GRID = 32;
+
+// Array of float3 in a scratch file with at most `slots` blocks resident; CLOCK (second chance) replacement.
+struct Float3File {
+    static const size_t BLOCK = 4096;                       // float3 per block
+    int fd = -1; std::string path;
+    std::vector<int32_t> slotOf;                           // block -> slot or -1
+    std::vector<int64_t> blockIn;                          // slot -> block or -1
+    std::vector<float> data;                               // slots * BLOCK * 3
+    std::vector<char> dirty, referenced;
+    size_t hand = 0;
+    size_t misses = 0;
+    bool failed = false;                                   // a block could not be written back or read in
+    Float3File(){}
+    Float3File(const Float3File&) = delete;
+    Float3File& operator=(const Float3File&) = delete;
+    ~Float3File(){ if(fd >= 0){ ::close(fd); unlink(path.c_str()); } }
+    // `keep` reuses what is already in the file (it is still resized to `count`)
+    bool open(const std::string &p, size_t count, size_t budgetBytes, bool keep){
+        path = p;
+        fd = ::open(p.c_str(), O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), 0644);
+        if(fd < 0 || ftruncate(fd, (off_t)(count * 3 * sizeof(float))) != 0) return false;
+        size_t blocks = (count + BLOCK - 1) / BLOCK;
+        size_t slots = std::max<size_t>(2, std::min(blocks, budgetBytes / (BLOCK * 3 * sizeof(float))));
+        slotOf.assign(blocks, -1); blockIn.assign(slots, -1);
+        data.assign(slots * BLOCK * 3, 0.0f);
+        dirty.assign(slots, 0); referenced.assign(slots, 0);
+        return true;
+    }
+    float* get(size_t i, bool write){
+        size_t b = i / BLOCK;
+        int32_t s = slotOf[b];
+        if(s < 0){
+            ++misses;
+            while(referenced[hand]){ referenced[hand] = 0; hand = (hand + 1) % blockIn.size(); }
+            s = (int32_t)hand; hand = (hand + 1) % blockIn.size();
+            float* d = &data[(size_t)s * BLOCK * 3];
+            if(blockIn[s] >= 0){
+                if(dirty[s] && pwrite(fd, d, BLOCK * 3 * sizeof(float), (off_t)(blockIn[s] * BLOCK * 3 * sizeof(float))) != (ssize_t)(BLOCK * 3 * sizeof(float))) failed = true;
+                slotOf[blockIn[s]] = -1;
+            }
+            ssize_t got = pread(fd, d, BLOCK * 3 * sizeof(float), (off_t)(b * BLOCK * 3 * sizeof(float)));
+            if(got < 0) failed = true;
+            if(got < (ssize_t)(BLOCK * 3 * sizeof(float))) memset((char*)d + std::max<ssize_t>(got, 0), 0, BLOCK * 3 * sizeof(float) - std::max<ssize_t>(got, 0));
+            blockIn[s] = (int64_t)b; slotOf[b] = s; dirty[s] = 0;
+        }
+        referenced[s] = 1;
+        if(write) dirty[s] = 1;
+        return &data[((size_t)s * BLOCK + i % BLOCK) * 3];
+    }
+};
+
+// Calls fn(p, eol) for every line of `path`, reading through a fixed buffer instead of mapping the whole file.
+template<class F> static bool forEachLine(const std::string &path, F fn){
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f) return false;
+    std::vector<char> buf(4u << 20);
+    size_t have = 0;
+    for(;;){
+        size_t n = fread(buf.data() + have, 1, buf.size() - have, f);
+        bool eof = n == 0;
+        have += n;
+        const char* p = buf.data(); const char* end = buf.data() + have;
+        for(;;){
+            const char* eol = (const char*)memchr(p, '\n', end - p);
+            if(!eol){ if(eof && p < end){ fn(p, end); p = end; } break; }
+            fn(p, eol);
+            p = eol + 1;
+        }
+        have = end - p;
+        memmove(buf.data(), p, have);
+        if(eof) break;
+        if(have == buf.size()) buf.resize(buf.size() * 2);   // a single line longer than the buffer
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+// Removes an intermediate file when the conversion returns, on success and on every error path alike.
+struct ScratchPath {
+    std::string path;
+    explicit ScratchPath(const std::string &p) : path(p) {}
+    ScratchPath(const ScratchPath&) = delete;
+    ScratchPath& operator=(const ScratchPath&) = delete;
+    ~ScratchPath(){ remove(path.c_str()); }
+};
+
+bool convertToChunks(const std::string &src, const std::string &dst, size_t memCap){
+    auto t0 = std::chrono::steady_clock::now();
+    std::string scratch = dst + ".tmp";
+    // the cap covers the whole process: what is already resident (code, libraries) is taken off the top, then a
+    // quarter each goes to the position and normal-sum caches and the rest to line/scatter buffers and chunk output
+    size_t base = (size_t)(peakRssMB() * 1024 * 1024);
+    size_t cacheBytes = std::max<size_t>((memCap > base ? memCap - base : 0) / 4, 1u << 20);
+
+    // pass 1: count, store positions, centroid
+    Float3File pos, nrm;
+    size_t nv = 0, nf = 0;
+    double sum[3] = { 0, 0, 0 };
+    std::string posPath = scratch + ".pos";
+    ScratchPath posScratch(posPath);
+    FILE* pf = fopen(posPath.c_str(), "wb");
+    if(!pf){ std::cerr << "Cannot write " << posPath << "\n"; return false; }
+    bool wrote = true;
+    bool ok = forEachLine(src, [&](const char* p, const char* eol){
+        char rt = recordType(p, eol);
+        if(rt == 'f'){ ++nf; return; }
+        if(rt != 'v') return;
+        float v[3] = { 0, 0, 0 };
+        const char* q = p;
+        for(int k=0;k<3 && q;++k) q = scanFloat(q, eol, v[k]);
+        wrote = wrote && fwrite(v, sizeof(float), 3, pf) == 3;
+        for(int k=0;k<3;++k) sum[k] += v[k];
+        ++nv;
+    });
+    wrote = (fclose(pf) == 0) && wrote;
+    if(!ok){ std::cerr << "Cannot read " << src << "\n"; return false; }
+    if(!wrote){ std::cerr << "Cannot write " << posPath << "\n"; return false; }
+    if(!pos.open(posPath, nv, cacheBytes, true) || !nrm.open(scratch + ".nrm", nv, cacheBytes, false)){ std::cerr << "Cannot create scratch files next to " << dst << "\n"; return false; }
+    Vec3 center = nv ? Vec3((float)(sum[0]/nv), (float)(sum[1]/nv), (float)(sum[2]/nv)) : Vec3(0,0,0);
+    float radius = 0, lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for(size_t i=0;i<nv;++i){
+        const float* v = pos.get(i, false);
+        radius = std::max(radius, len(Vec3(v[0], v[1], v[2]) - center));
+        for(int k=0;k<3;++k){ lo[k] = std::min(lo[k], v[k]); hi[k] = std::max(hi[k], v[k]); }
+    }
+    if(radius < 1e-6f) radius = 1.0f;
+
+    // grid sized so an average occupied cell (surfaces fill about grid^2 cells) holds CHUNK_TARGET_TRIS
+    int grid = std::max(1, std::min(CHUNK_MAX_GRID, (int)ceil(sqrt((double)nf / CHUNK_TARGET_TRIS))));
+    float cellSize[3];
+    for(int k=0;k<3;++k) cellSize[k] = nv ? std::max(hi[k] - lo[k], 1e-6f) / grid : 1.0f;
+    size_t cells = (size_t)grid * grid * grid;
+    auto cellOf = [&](const Vec3 &c){
+        int x = std::max(0, std::min(grid-1, (int)((c.x - lo[0]) / cellSize[0])));
+        int y = std::max(0, std::min(grid-1, (int)((c.y - lo[1]) / cellSize[1])));
+        int z = std::max(0, std::min(grid-1, (int)((c.z - lo[2]) / cellSize[2])));
+        return (uint32_t)((z * grid + y) * grid + x);
+    };
+
+    // pass 2: faces -> normal sums, cell counts and an unsorted face list
+    std::vector<uint64_t> cellCount(cells, 0);
+    std::string facePath = scratch + ".faces";
+    ScratchPath faceScratch(facePath);
+    FILE* ff = fopen(facePath.c_str(), "wb");
+    if(!ff){ std::cerr << "Cannot write " << facePath << "\n"; return false; }
+    size_t bad = 0, kept = 0;
+    ok = forEachLine(src, [&](const char* p, const char* eol){
+        if(recordType(p, eol) != 'f') return;
+        int id[3] = { 0, 0, 0 }; const char* q = p;
+        for(int k=0;k<3 && q;++k) q = scanInt(q, eol, id[k]);
+        if(!q){ ++bad; return; }
+        for(int k=0;k<3;++k){ if(id[k] < 1 || (size_t)id[k] > nv){ ++bad; return; } --id[k]; }
+        Vec3 P[3];
+        for(int k=0;k<3;++k){ const float* v = pos.get(id[k], false); P[k] = Vec3(v[0], v[1], v[2]); }
+        Vec3 area = cross(P[1] - P[0], P[2] - P[0]), fn = normalize(area);
+        for(int k=0;k<3;++k){
+            Vec3 w = fn;
+            if(normalWeighting == NORMAL_AREA) w = area;
+            else if(normalWeighting == NORMAL_ANGLE) w = fn * cornerAngle(P[k], P[(k+1)%3], P[(k+2)%3]);
+            float* n = nrm.get(id[k], true);
+            n[0] += w.x; n[1] += w.y; n[2] += w.z;
+        }
+        uint32_t rec[4] = { (uint32_t)id[0], (uint32_t)id[1], (uint32_t)id[2], cellOf((P[0] + P[1] + P[2]) * (1.0f/3.0f)) };
+        ++cellCount[rec[3]]; ++kept;
+        wrote = wrote && fwrite(rec, sizeof(rec), 1, ff) == 1;
+    });
+    wrote = (fclose(ff) == 0) && wrote;
+    if(!ok){ std::cerr << "Cannot read " << src << "\n"; return false; }
+    if(!wrote || pos.failed || nrm.failed){ std::cerr << "Cannot write scratch files next to " << dst << "\n"; return false; }
+    if(bad) std::cerr << "Skipping " << bad << " malformed face(s) in " << src << "\n";
+
+    // pass 3: scatter faces into cell order, through small per-cell write buffers
+    std::vector<uint64_t> cellStart(cells + 1, 0);
+    for(size_t c=0;c<cells;++c) cellStart[c+1] = cellStart[c] + cellCount[c];
+    std::string sortedPath = scratch + ".sorted";
+    ScratchPath sortedScratch(sortedPath);
+    int sfd = ::open(sortedPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    FILE* fin = fopen(facePath.c_str(), "rb");
+    if(sfd < 0 || !fin){
+        std::cerr << "Cannot create scratch files next to " << dst << "\n";
+        if(sfd >= 0) ::close(sfd);
+        if(fin) fclose(fin);
+        return false;
+    }
+    {
+        const size_t perCell = 64;
+        std::vector<std::vector<uint32_t>> pending(cells);
+        std::vector<uint64_t> cursor(cellStart.begin(), cellStart.end() - 1);
+        auto flushCell = [&](size_t c){
+            std::vector<uint32_t> &v = pending[c];
+            if(v.empty()) return;
+            size_t bytes = v.size()*sizeof(uint32_t);
+            wrote = wrote && pwrite(sfd, v.data(), bytes, (off_t)(cursor[c] * 3 * sizeof(uint32_t))) == (ssize_t)bytes;
+            cursor[c] += v.size() / 3; v.clear();
+        };
+        uint32_t rec[4];
+        while(fread(rec, sizeof(rec), 1, fin) == 1){
+            std::vector<uint32_t> &v = pending[rec[3]];
+            v.insert(v.end(), rec, rec + 3);
+            if(v.size() >= perCell*3) flushCell(rec[3]);
+        }
+        for(size_t c=0;c<cells;++c){ flushCell(c); std::vector<uint32_t>().swap(pending[c]); }
+        ok = !ferror(fin);
+    }
+    fclose(fin);
+    if(!ok) std::cerr << "Cannot read " << facePath << "\n";
+    else if(!wrote) std::cerr << "Cannot write " << sortedPath << "\n";
+    if(!ok || !wrote){ ::close(sfd); return false; }
+    remove(facePath.c_str());
+
+    // pass 4: one chunk per occupied cell
+    FILE* out = fopen(scratch.c_str(), "wb");
+    if(!out){ std::cerr << "Cannot write " << scratch << "\n"; ::close(sfd); return false; }
+    SMFCHeader h; memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "SMFC", 4);
+    h.version = SMFC_VERSION;
+    h.vertexCount = nv; h.triCount = kept; h.grid = (uint32_t)grid;
+    h.centroid[0] = center.x; h.centroid[1] = center.y; h.centroid[2] = center.z;
+    h.modelScale = 1.0f / radius;
+    h.normalWeight = (uint32_t)normalWeighting;
+    ok = fwrite(&h, sizeof(h), 1, out) == 1;
+    uint64_t at = sizeof(h);
+    auto padTo16 = [&](){ static const char zeros[16] = {0}; size_t n = (size_t)(alignUp(at) - at); if(n){ ok = ok && fwrite(zeros, 1, n, out) == n; at += n; } };
+    std::vector<SMFCChunk> table;
+    std::vector<uint32_t> faces, local;
+    std::vector<float> verts;
+    size_t maxChunkBytes = 0;
+    for(size_t c=0;c<cells && ok;++c){
+        size_t n = (size_t)cellCount[c];
+        if(!n) continue;
+        faces.resize(n*3);
+        if(pread(sfd, faces.data(), n*3*sizeof(uint32_t), (off_t)(cellStart[c] * 3 * sizeof(uint32_t))) != (ssize_t)(n*3*sizeof(uint32_t))){
+            std::cerr << "Cannot read " << sortedPath << "\n";
+            ok = false;
+            break;
+        }
+        local = faces;
+        std::sort(local.begin(), local.end());
+        local.erase(std::unique(local.begin(), local.end()), local.end());
+        verts.resize(local.size()*6);
+        float clo[3] = { INFINITY, INFINITY, INFINITY }, chi[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for(size_t i=0;i<local.size();++i){
+            const float* p = pos.get(local[i], false);
+            const float* s = nrm.get(local[i], false);
+            Vec3 nn = normalize(Vec3(s[0], s[1], s[2]));
+            float* v = &verts[6*i];
+            v[0] = p[0]; v[1] = p[1]; v[2] = p[2]; v[3] = nn.x; v[4] = nn.y; v[5] = nn.z;
+            for(int k=0;k<3;++k){ clo[k] = std::min(clo[k], p[k]); chi[k] = std::max(chi[k], p[k]); }
+        }
+        for(uint32_t &i : faces) i = (uint32_t)(std::lower_bound(local.begin(), local.end(), i) - local.begin());
+        SMFCChunk ch; memset(&ch, 0, sizeof(ch));
+        padTo16();
+        ch.offset = at; ch.vertexCount = (uint32_t)local.size(); ch.indexCount = (uint32_t)faces.size();
+        ch.indexBytes = local.size() <= 65536 ? 2 : 4;
+        Vec3 cc((clo[0]+chi[0])*0.5f, (clo[1]+chi[1])*0.5f, (clo[2]+chi[2])*0.5f);
+        ch.center[0] = cc.x; ch.center[1] = cc.y; ch.center[2] = cc.z;
+        ch.radius = len(Vec3(chi[0], chi[1], chi[2]) - cc);
+        ok = ok && fwrite(verts.data(), sizeof(float), verts.size(), out) == verts.size();
+        at += verts.size()*sizeof(float);
+        padTo16();
+        if(ch.indexBytes == 2){
+            std::vector<uint16_t> idx(faces.begin(), faces.end());
+            ok = ok && fwrite(idx.data(), 2, idx.size(), out) == idx.size();
+        } else ok = ok && fwrite(faces.data(), 4, faces.size(), out) == faces.size();
+        at += (uint64_t)faces.size() * ch.indexBytes;
+        ch.bytes = at - ch.offset;
+        maxChunkBytes = std::max(maxChunkBytes, (size_t)ch.bytes);
+        table.push_back(ch);
+    }
+    ::close(sfd); remove(sortedPath.c_str());
+    ok = ok && !pos.failed && !nrm.failed;
+    padTo16();
+    h.chunkCount = (uint32_t)table.size(); h.tableOffset = at;
+    ok = ok && fwrite(table.data(), sizeof(SMFCChunk), table.size(), out) == table.size();
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, out) == 1;
+    ok = (fclose(out) == 0) && ok;
+    if(!ok || rename(scratch.c_str(), dst.c_str()) != 0){
+        std::cerr << "Cannot write " << dst << "\n";
+        remove(scratch.c_str());
+        return false;
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << "Wrote " << dst << ": " << kept << " tris in " << table.size() << " chunks (grid " << grid << "^3, largest "
+              << maxChunkBytes / (1024.0*1024.0) << " MB) in " << sec << " s; cache misses " << pos.misses << " + " << nrm.misses
+              << ", peak RSS " << peakRssMB() << " MB (cap " << memCap / (1024*1024) << " MB)\n";
+    return true;
+}
+
+int openChunkFile(const std::string &path, SMFCHeader &hdr, std::vector<SMFCChunk> &table){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    bool ok = fd >= 0 && pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+              memcmp(hdr.magic, "SMFC", 4) == 0 && hdr.version == SMFC_VERSION;
+    table.assign(ok ? hdr.chunkCount : 0, SMFCChunk());
+    ok = ok && pread(fd, table.data(), table.size()*sizeof(SMFCChunk), (off_t)hdr.tableOffset) == (ssize_t)(table.size()*sizeof(SMFCChunk));
+    if(!ok){
+        std::cerr << "Cannot read chunked mesh " << path << "\n";
+        if(fd >= 0) ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// -------- Deformation --------
+static const size_t DEFORM_PARALLEL_MIN = 16384;   // smaller regions are refreshed on the calling thread
+
+void MeshDeformer::clear(){ *this = MeshDeformer(); }
+
+void MeshDeformer::reset(const std::vector<Vertex> &verts, size_t triCount){
+    size_t nv = verts.size();
+    restPos.resize(nv); restNorm.resize(nv);
+    for(size_t i=0;i<nv;++i){ restPos[i] = verts[i].p; restNorm[i] = verts[i].n; }
+    vertMark.assign(nv, 0); faceMark.assign(triCount, 0); stamp = 0;
+    size_t pages = (nv + PAGE_VERTS - 1) / PAGE_VERTS;
+    dirtyPages.assign((pages + 63) / 64, 0);
+    displaced.clear(); moved.clear(); faces.clear(); touched.clear();
+    rebuildGrid();
+}
+
+// About two vertices per cell over the rest pose's bounding box; flat extents get a floor so planar meshes still bin.
+void MeshDeformer::rebuildGrid(){
+    size_t nv = restPos.size();
+    Vec3 lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f);
+    for(const Vec3 &p : restPos){
+        lo.x = std::min(lo.x, p.x); lo.y = std::min(lo.y, p.y); lo.z = std::min(lo.z, p.z);
+        hi.x = std::max(hi.x, p.x); hi.y = std::max(hi.y, p.y); hi.z = std::max(hi.z, p.z);
+    }
+    if(nv == 0) lo = hi = Vec3(0,0,0);
+    float ext[3] = { hi.x - lo.x, hi.y - lo.y, hi.z - lo.z };
+    float maxExt = std::max(1e-6f, std::max(ext[0], std::max(ext[1], ext[2])));
+    double volume = 1.0;
+    for(float e : ext) volume *= std::max(e, maxExt * 1e-3f);
+    cellSize = std::max(1e-6f, (float)cbrt(volume / std::max(1.0, nv / 2.0)));
+    cellSize = std::max(cellSize, maxExt / 1000.0f);   // at most ~1000 cells per axis
+    size_t cells = 1;
+    for(int i=0;i<3;++i){ dims[i] = std::max(1, std::min(1024, (int)(ext[i] / cellSize) + 1)); cells *= (size_t)dims[i]; }
+    gridMin = lo;
+    auto cellOf = [&](const Vec3 &p){
+        int x = std::min(dims[0]-1, (int)((p.x - lo.x) / cellSize));
+        int y = std::min(dims[1]-1, (int)((p.y - lo.y) / cellSize));
+        int z = std::min(dims[2]-1, (int)((p.z - lo.z) / cellSize));
+        return ((size_t)z * dims[1] + y) * dims[0] + x;
+    };
+    cellStart.assign(cells + 1, 0);
+    for(const Vec3 &p : restPos) ++cellStart[cellOf(p) + 1];
+    for(size_t c=0;c<cells;++c) cellStart[c+1] += cellStart[c];
+    cellVerts.resize(nv);
+    shift.assign(nv, 0.0f);
+    std::vector<uint32_t> cursor(cellStart.begin(), cellStart.end() - 1);
+    for(size_t v=0;v<nv;++v) cellVerts[cursor[cellOf(restPos[v])]++] = (uint32_t)v;
+    drift = 0.0f;
+}
+
+void MeshDeformer::query(const Vec3 &center, float radius, bool column, std::vector<uint32_t> &out) const {
+    out.clear();
+    if(cellStart.empty()) return;
+    float reach = radius + drift, r2 = radius * radius;
+    const float c[3] = { center.x, center.y, center.z }, origin[3] = { gridMin.x, gridMin.y, gridMin.z };
+    int lo[3], hi[3];
+    for(int i=0;i<3;++i){
+        lo[i] = (int)std::max(0.0f, floorf((c[i] - reach - origin[i]) / cellSize));
+        hi[i] = (int)std::min((float)(dims[i]-1), floorf((c[i] + reach - origin[i]) / cellSize));
+        if(lo[i] > hi[i]) return;
+    }
+    if(column){ lo[2] = 0; hi[2] = dims[2]-1; }
+    for(int z=lo[2]; z<=hi[2]; ++z)
+        for(int y=lo[1]; y<=hi[1]; ++y){
+            size_t row = ((size_t)z * dims[1] + y) * dims[0];
+            for(uint32_t k=cellStart[row + lo[0]]; k<cellStart[row + hi[0] + 1]; ++k){
+                uint32_t v = cellVerts[k];
+                Vec3 d = restPos[v] - center;
+                if(d.x*d.x + d.y*d.y + (column ? 0.0f : d.z*d.z) <= r2) out.push_back(v);
+            }
+        }
+    std::sort(out.begin(), out.end());
+}
+
+void MeshDeformer::wave(std::vector<Vertex> &verts, const Vec3 &center, float radius, float amplitude, float phase){
+    query(center, radius, true, scratch);
+    float k = 4.0f * 3.14159265f / radius;   // two wavelengths from the axis to the rim
+    for(uint32_t v : scratch){
+        Vec3 d = restPos[v] - center;
+        float r = sqrtf(d.x*d.x + d.y*d.y), w = 1.0f - r*r / (radius*radius);
+        verts[v].p = restPos[v] + restNorm[v] * (amplitude * w * w * sinf(k * r - phase));
+    }
+    // last frame's ripple outside the new region goes back to rest (both lists ascending)
+    size_t j = 0;
+    for(uint32_t v : displaced){
+        while(j < scratch.size() && scratch[j] < v) ++j;
+        if(j < scratch.size() && scratch[j] == v) continue;
+        verts[v].p = restPos[v]; moved.push_back(v);
+    }
+    moved.insert(moved.end(), scratch.begin(), scratch.end());
+    displaced.swap(scratch);
+}
+
+void MeshDeformer::relax(std::vector<Vertex> &verts){
+    for(uint32_t v : displaced){ verts[v].p = restPos[v]; moved.push_back(v); }
+    displaced.clear();
+}
+
+void MeshDeformer::brush(std::vector<Vertex> &verts, const Vec3 &center, float radius, float strength){
+    if(!displaced.empty()) relax(verts);
+    query(center, radius, false, scratch);
+    for(uint32_t v : scratch){
+        float r = len(restPos[v] - center), w = 1.0f - r*r / (radius*radius);
+        restPos[v] = restPos[v] + verts[v].n * (strength * w * w);
+        verts[v].p = restPos[v];
+        drift = std::max(drift, shift[v] += fabsf(strength) * w * w);
+    }
+    moved.insert(moved.end(), scratch.begin(), scratch.end());
+    // queries reach `drift` further; rebin once that costs more than a rebuild saves
+    if(drift > std::max(cellSize, 0.5f * radius)) rebuildGrid();
+}
+
+// Face normals of every triangle around a moved vertex, then vertex normals of all their corners (the same gather as
+// computeVertexNormals, so a region moved back to rest gets bit-identical normals).
+void MeshDeformer::updateNormals(std::vector<Vertex> &verts, std::vector<Tri> &tris, const VertexAdjacency &adj, int weighting){
+    faces.clear(); touched.clear();
+    if(moved.empty()) return;
+    if(++stamp == 0){ std::fill(vertMark.begin(), vertMark.end(), 0); std::fill(faceMark.begin(), faceMark.end(), 0); stamp = 1; }
+    for(uint32_t v : moved)
+        for(uint32_t k=adj.offsets[v]; k<adj.offsets[v+1]; ++k){
+            uint32_t t = adj.tris[k];
+            if(faceMark[t] != stamp){ faceMark[t] = stamp; faces.push_back(t); }
+        }
+    unsigned workers = faces.size() >= DEFORM_PARALLEL_MIN ? workerCount() : 1;
+    parallelRanges(faces.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t i=b; i<e; ++i){
+            Tri &t = tris[faces[i]];
+            Vec3 u = verts[t.b].p - verts[t.a].p; Vec3 w = verts[t.c].p - verts[t.a].p;
+            t.fn = normalize(cross(u,w));
+        }
+    });
+    for(uint32_t f : faces){
+        const int corner[3] = { tris[f].a, tris[f].b, tris[f].c };
+        for(int c : corner) if(vertMark[c] != stamp){ vertMark[c] = stamp; touched.push_back((uint32_t)c); }
+    }
+    for(uint32_t v : moved) if(vertMark[v] != stamp){ vertMark[v] = stamp; touched.push_back(v); }   // no faces, position only
+    parallelRanges(touched.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t i=b; i<e; ++i) verts[touched[i]].n = gatherVertexNormal(verts, tris, adj, weighting, touched[i]);
+    });
+    bool atRest = displaced.empty();   // sculpted normals become the rest normals the wave rides on
+    for(uint32_t v : touched){
+        size_t page = v / PAGE_VERTS;
+        dirtyPages[page / 64] |= 1ull << (page % 64);
+        if(atRest) restNorm[v] = verts[v].n;
+    }
+    moved.clear();
+}
+
+size_t dirtyVertexRuns(const std::vector<uint64_t> &pages, size_t vertexCount, std::vector<std::pair<size_t, size_t>> &runs){
+    const size_t P = MeshDeformer::PAGE_VERTS, np = (vertexCount + P - 1) / P;
+    auto set = [&](size_t p){ return (pages[p / 64] >> (p % 64)) & 1; };
+    runs.clear();
+    size_t total = 0;
+    for(size_t p=0; p<np;){
+        if(pages[p / 64] == 0){ p = (p / 64 + 1) * 64; continue; }
+        if(!set(p)){ ++p; continue; }
+        size_t q = p;
+        while(q < np && set(q)) ++q;
+        size_t b = p * P, e = std::min(vertexCount, q * P);
+        runs.push_back({ b, e }); total += e - b;
+        p = q;
+    }
+    return total;
+}
+
+// -------- Buffer staging --------
+int vertexFormat = VF_FLOAT;
+
+static void octEncode(const float* n, int16_t* out){
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    float x = l1 > 0 ? n[0]/l1 : 0.0f, y = l1 > 0 ? n[1]/l1 : 0.0f;
+    if(n[2] < 0){ float ox = x; x = (1.0f - fabsf(y)) * (ox >= 0 ? 1.0f : -1.0f); y = (1.0f - fabsf(ox)) * (y >= 0 ? 1.0f : -1.0f); }
+    out[0] = (int16_t)lrintf(std::max(-1.0f, std::min(1.0f, x)) * 32767.0f);
+    out[1] = (int16_t)lrintf(std::max(-1.0f, std::min(1.0f, y)) * 32767.0f);
+}
+// Mirrors decodeNormal() in the vertex shaders (normalized GL_SHORT -> [-1,1]).
+static Vec3 octDecode(const int16_t* e){
+    float x = std::max(-1.0f, e[0] / 32767.0f), y = std::max(-1.0f, e[1] / 32767.0f);
+    Vec3 d(x, y, 1.0f - fabsf(x) - fabsf(y));
+    if(d.z < 0){ float ox = d.x; d.x = (1.0f - fabsf(d.y)) * (ox >= 0 ? 1.0f : -1.0f); d.y = (1.0f - fabsf(ox)) * (d.y >= 0 ? 1.0f : -1.0f); }
+    return normalize(d);
+}
+
+struct QuantizedVertex { uint16_t pos[4]; int16_t oct[2]; };   // pos[3] is padding
+
+// Worst-case decode error allowed before quantized falls back to interleaved floats; 1e-3 in the normal
+// keeps N.L within a quarter of an 8-bit colour step. 16 bits over the bounding box keep positions within about
+// 1.5e-5 of the model radius; 1e-4 is still well under a pixel at any window size the viewer opens.
+static const float QUANT_MAX_NORMAL_ERROR = 1e-3f;
+static const float QUANT_MAX_POSITION_ERROR = 1e-4f;   // model radius = 1
+
+static void prepareIndices(const MeshView &mv, bool allow16, BufferImage &img){
+    size_t full = mv.triCount*3, total = full + mv.lodIndexCount;
+    if(allow16 && mv.vertexCount <= 65536){
+        uint16_t* idx = img.allocate<uint16_t>(BUF_INDEX, total);
+        parallelRanges(mv.triCount, workerCount(), [&](size_t b, size_t e, unsigned){
+            for(size_t t=b;t<e;++t){ const uint32_t* s = mv.I(t); idx[3*t] = (uint16_t)s[0]; idx[3*t+1] = (uint16_t)s[1]; idx[3*t+2] = (uint16_t)s[2]; }
+        });
+        for(size_t i=0;i<mv.lodIndexCount;++i) idx[full+i] = (uint16_t)mv.lodIdx[i];
+        img.layout.indexType = LAYOUT_UNSIGNED_SHORT;
+        return;
+    }
+    img.layout.indexType = LAYOUT_UNSIGNED_INT;
+    if(mv.istride == 3 && mv.lodIdx == mv.idx + full){
+        // mapped cache: every level is already contiguous
+        img.reference(BUF_INDEX, mv.idx, total*sizeof(uint32_t));
+        return;
+    }
+    uint32_t* idx = img.allocate<uint32_t>(BUF_INDEX, total);
+    for(size_t t=0;t<mv.triCount;++t){ const uint32_t* s = mv.I(t); idx[3*t] = s[0]; idx[3*t+1] = s[1]; idx[3*t+2] = s[2]; }
+    if(mv.lodIndexCount) memcpy(idx + full, mv.lodIdx, mv.lodIndexCount*sizeof(uint32_t));
+}
+
+void prepareBufferImage(const MeshView &mv, float scale, BufferImage &img){
+    img = BufferImage();
+    int format = vertexFormat;
+
+    if(format == VF_QUANTIZED){
+        // positions relative to the bounding box, normals octahedral; verify the decode error before using it
+        float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for(size_t i=0;i<mv.vertexCount;++i){ const float* p = mv.P(i); for(int k=0;k<3;++k){ lo[k] = std::min(lo[k], p[k]); hi[k] = std::max(hi[k], p[k]); } }
+        float range[3];
+        for(int k=0;k<3;++k){ range[k] = (mv.vertexCount && hi[k] > lo[k]) ? hi[k] - lo[k] : 0.0f; img.layout.decodeScale[k] = range[k]; img.layout.decodeOffset[k] = mv.vertexCount ? lo[k] : 0.0f; }
+        // encoded straight into the upload buffer, which is dropped again on fallback
+        QuantizedVertex* qv = img.allocate<QuantizedVertex>(BUF_POS, mv.vertexCount);
+        unsigned workers = workerCount();
+        std::vector<float> maxN(workers, 0.0f), maxP(workers, 0.0f);
+        parallelRanges(mv.vertexCount, workers, [&](size_t b, size_t e, unsigned w){
+            for(size_t i=b;i<e;++i){
+                const float* p = mv.P(i); const float* n = mv.N(i); QuantizedVertex &q = qv[i];
+                for(int k=0;k<3;++k){
+                    float u = range[k] > 0 ? (p[k] - lo[k]) / range[k] : 0.0f;
+                    q.pos[k] = (uint16_t)lrintf(std::max(0.0f, std::min(1.0f, u)) * 65535.0f);
+                    maxP[w] = std::max(maxP[w], fabsf(lo[k] + range[k] * (q.pos[k] / 65535.0f) - p[k]));
+                }
+                q.pos[3] = 0;
+                octEncode(n, q.oct);
+                if(n[0] != 0 || n[1] != 0 || n[2] != 0) maxN[w] = std::max(maxN[w], len(octDecode(q.oct) - Vec3(n[0], n[1], n[2])));
+            }
+        });
+        float normalErr = *std::max_element(maxN.begin(), maxN.end());
+        float posErr = *std::max_element(maxP.begin(), maxP.end()) * scale;   // in normalized model units
+        std::cout << "Quantization error: normal " << normalErr << ", position " << posErr << " (model radius = 1)\n";
+        if(!(normalErr <= QUANT_MAX_NORMAL_ERROR) || !(posErr <= QUANT_MAX_POSITION_ERROR)){
+            std::cerr << "Quantization error exceeds the threshold (normal " << QUANT_MAX_NORMAL_ERROR << ", position "
+                      << QUANT_MAX_POSITION_ERROR << "), using interleaved floats\n";
+            format = VF_INTERLEAVED;
+            img = BufferImage();
+        }
+    }
+
+    if(format == VF_FLOAT && mv.vstride == 3){
+        // upload straight from the mapped cache file, no staging copies
+        img.reference(BUF_POS, mv.pos, mv.vertexCount*3*sizeof(float));
+        img.reference(BUF_NORM, mv.norm, mv.vertexCount*3*sizeof(float));
+        prepareIndices(mv, false, img);
+    } else if(format == VF_FLOAT){
+        float* pos = img.allocate<float>(BUF_POS, mv.vertexCount*3);
+        float* norm = img.allocate<float>(BUF_NORM, mv.vertexCount*3);
+        parallelRanges(mv.vertexCount, workerCount(), [&](size_t b, size_t e, unsigned){
+            for(size_t i=b;i<e;++i){ memcpy(pos + 3*i, mv.P(i), 3*sizeof(float)); memcpy(norm + 3*i, mv.N(i), 3*sizeof(float)); }
+        });
+        prepareIndices(mv, false, img);
+    } else if(format == VF_INTERLEAVED){
+        img.layout.stride = 6*sizeof(float); img.layout.normOffset = 3*sizeof(float);
+        if(mv.vstride == 6){
+            // vertices[] is already {pos, normal} interleaved
+            img.reference(BUF_POS, mv.pos, mv.vertexCount*6*sizeof(float));
+        } else {
+            float* inter = img.allocate<float>(BUF_POS, mv.vertexCount*6);
+            parallelRanges(mv.vertexCount, workerCount(), [&](size_t b, size_t e, unsigned){
+                for(size_t i=b;i<e;++i){ memcpy(&inter[6*i], mv.P(i), 3*sizeof(float)); memcpy(&inter[6*i+3], mv.N(i), 3*sizeof(float)); }
+            });
+        }
+        prepareIndices(mv, true, img);
+    } else {
+        img.layout.posType = LAYOUT_UNSIGNED_SHORT; img.layout.posNormalized = true;
+        img.layout.normType = LAYOUT_SHORT; img.layout.normNormalized = true; img.layout.normSize = 2;
+        img.layout.stride = sizeof(QuantizedVertex); img.layout.normOffset = offsetof(QuantizedVertex, oct);
+        img.layout.octNormals = true;
+        prepareIndices(mv, true, img);
+    }
+    if(mv.ao) img.reference(BUF_AO, mv.ao, mv.vertexCount);
+    img.format = format;
+    img.triCount = mv.triCount;
+
+    static const char* names[] = { "float", "interleaved", "quantized" };
+    size_t vboBytes = img.bytes[BUF_POS] + img.bytes[BUF_NORM] + img.bytes[BUF_AO], iboBytes = img.bytes[BUF_INDEX];
+    size_t baseBytes = mv.vertexCount*6*sizeof(float) + (mv.triCount*3 + mv.lodIndexCount)*sizeof(uint32_t);
+    std::cout << "Vertex format " << names[format] << ": "
+              << (mv.vertexCount ? (double)vboBytes / mv.vertexCount : 0.0) << " B/vertex (float: 24), VBO "
+              << vboBytes/1024.0 << " KB + IBO " << iboBytes/1024.0 << " KB = " << (vboBytes+iboBytes)/1024.0
+              << " KB (float: " << baseBytes/1024.0 << " KB)\n";
+}
@@ -0,0 +1,476 @@
+// mesh.h
+// Mesh pipeline shared by the viewer and the micro-benchmarks: SMF parsing, adjacency, vertex normals, bounds,
+// triangle reordering, LODs, meshlets, BVH ray queries, the .smfb cache, the .smfc converter and the CPU-side buffer
+// staging.
+// Nothing here touches GL or GLUT.
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// -------- Math helpers --------
+struct Vec3 { float x,y,z; Vec3():x(0),y(0),z(0){} Vec3(float X,float Y,float Z):x(X),y(Y),z(Z){} };
+inline Vec3 operator+(const Vec3&a,const Vec3&b){return Vec3(a.x+b.x,a.y+b.y,a.z+b.z);}
+inline Vec3 operator-(const Vec3&a,const Vec3&b){return Vec3(a.x-b.x,a.y-b.y,a.z-b.z);}
+inline Vec3 operator*(const Vec3&a,float s){return Vec3(a.x*s,a.y*s,a.z*s);}
+inline float len(const Vec3&a){return sqrtf(a.x*a.x+a.y*a.y+a.z*a.z);}
+inline Vec3 normalize(const Vec3&a){float L=len(a); if(L<1e-6f) return Vec3(0,0,0); return Vec3(a.x/L,a.y/L,a.z/L);}
+inline Vec3 cross(const Vec3&a,const Vec3&b){ return Vec3(a.y*b.z-a.z*b.y, a.z*b.x-a.x*b.z, a.x*b.y-a.y*b.x); }
+inline float dot(const Vec3&a,const Vec3&b){ return a.x*b.x+a.y*b.y+a.z*b.z; }
+
+// 4-wide float lanes (rasterizer, meshlet culling, ray queries): SSE2 where available, plain arrays otherwise
+#if defined(__SSE2__)
+struct F4 { __m128 v; };
+struct M4 { __m128 v; };
+inline F4 f4(float s){ return { _mm_set1_ps(s) }; }
+inline F4 f4ramp(float s){ return { _mm_setr_ps(s, s+1.0f, s+2.0f, s+3.0f) }; }
+inline F4 operator+(F4 a, F4 b){ return { _mm_add_ps(a.v, b.v) }; }
+inline F4 operator-(F4 a, F4 b){ return { _mm_sub_ps(a.v, b.v) }; }
+inline F4 operator*(F4 a, F4 b){ return { _mm_mul_ps(a.v, b.v) }; }
+inline F4 f4load(const float* p){ return { _mm_loadu_ps(p) }; }
+inline void f4store(float* p, F4 a){ _mm_storeu_ps(p, a.v); }
+inline void f4lanes(F4 a, float* out){ _mm_storeu_ps(out, a.v); }
+inline M4 f4ge(F4 a, F4 b){ return { _mm_cmpge_ps(a.v, b.v) }; }
+inline M4 f4lt(F4 a, F4 b){ return { _mm_cmplt_ps(a.v, b.v) }; }
+inline M4 operator&(M4 a, M4 b){ return { _mm_and_ps(a.v, b.v) }; }
+inline M4 operator|(M4 a, M4 b){ return { _mm_or_ps(a.v, b.v) }; }
+inline F4 f4sqrt(F4 a){ return { _mm_sqrt_ps(a.v) }; }
+inline int m4bits(M4 m){ return _mm_movemask_ps(m.v); }
+inline F4 f4select(M4 m, F4 a, F4 b){ return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+inline F4 operator/(F4 a, F4 b){ return { _mm_div_ps(a.v, b.v) }; }
+inline F4 f4min(F4 a, F4 b){ return { _mm_min_ps(a.v, b.v) }; }
+inline F4 f4max(F4 a, F4 b){ return { _mm_max_ps(a.v, b.v) }; }
+#else
+struct F4 { float v[4]; };
+struct M4 { bool b[4]; };
+inline F4 f4(float s){ return { {s, s, s, s} }; }
+inline F4 f4ramp(float s){ return { {s, s+1.0f, s+2.0f, s+3.0f} }; }
+inline F4 operator+(F4 a, F4 b){ for(int i=0;i<4;++i) a.v[i] += b.v[i]; return a; }
+inline F4 operator-(F4 a, F4 b){ for(int i=0;i<4;++i) a.v[i] -= b.v[i]; return a; }
+inline F4 operator*(F4 a, F4 b){ for(int i=0;i<4;++i) a.v[i] *= b.v[i]; return a; }
+inline F4 f4load(const float* p){ F4 r; for(int i=0;i<4;++i) r.v[i] = p[i]; return r; }
+inline void f4store(float* p, F4 a){ for(int i=0;i<4;++i) p[i] = a.v[i]; }
+inline void f4lanes(F4 a, float* out){ f4store(out, a); }
+inline M4 f4ge(F4 a, F4 b){ M4 m; for(int i=0;i<4;++i) m.b[i] = a.v[i] >= b.v[i]; return m; }
+inline M4 f4lt(F4 a, F4 b){ M4 m; for(int i=0;i<4;++i) m.b[i] = a.v[i] < b.v[i]; return m; }
+inline M4 operator&(M4 a, M4 b){ for(int i=0;i<4;++i) a.b[i] = a.b[i] && b.b[i]; return a; }
+inline M4 operator|(M4 a, M4 b){ for(int i=0;i<4;++i) a.b[i] = a.b[i] || b.b[i]; return a; }
+inline F4 f4sqrt(F4 a){ for(int i=0;i<4;++i) a.v[i] = sqrtf(a.v[i]); return a; }
+inline int m4bits(M4 m){ int r=0; for(int i=0;i<4;++i) if(m.b[i]) r |= 1<<i; return r; }
+inline F4 f4select(M4 m, F4 a, F4 b){ for(int i=0;i<4;++i) if(!m.b[i]) a.v[i] = b.v[i]; return a; }
+inline F4 operator/(F4 a, F4 b){ for(int i=0;i<4;++i) a.v[i] /= b.v[i]; return a; }
+inline F4 f4min(F4 a, F4 b){ for(int i=0;i<4;++i) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return a; }   // like minps: b when either is NaN
+inline F4 f4max(F4 a, F4 b){ for(int i=0;i<4;++i) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+#endif
+
+// -------- Mesh --------
+struct Vertex { Vec3 p; Vec3 n; };
+struct Tri { int a,b,c; Vec3 fn; };
+
+// Read-only strided view of the mesh arrays, whether they live in the mapped cache or in vertices/triangles.
+struct MeshView {
+    const float* pos; const float* norm; size_t vstride, vertexCount;
+    const uint32_t* idx; size_t istride, triCount;
+    const uint32_t* lodIdx; size_t lodIndexCount;      // LOD 1.. indices, packed, following the full mesh in the IBO
+    const uint8_t* ao;                                 // per-vertex ambient occlusion, or nullptr when not baked
+    const float* P(size_t i) const { return pos + i*vstride; }
+    const float* N(size_t i) const { return norm + i*vstride; }
+    const uint32_t* I(size_t t) const { return idx + t*istride; }
+};
+
+// -------- Vertex formats --------
+// float:       separate float3 position / float3 normal VBOs (24 B/vertex), 32-bit indices
+// interleaved: one VBO of {float3 pos, float3 normal} (24 B/vertex), 16-bit indices when they fit
+// quantized:   one VBO of {unorm16x3 pos (+pad), snorm16x2 octahedral normal} (12 B/vertex), 16-bit indices when they fit
+enum VertexFormat { VF_FLOAT=0, VF_INTERLEAVED=1, VF_QUANTIZED=2 };
+extern int vertexFormat;
+// Component types carry the GL enum values, so the layout is built without GL headers (main.cpp checks them).
+enum : uint32_t { LAYOUT_SHORT = 0x1402, LAYOUT_UNSIGNED_SHORT = 0x1403, LAYOUT_UNSIGNED_INT = 0x1405, LAYOUT_FLOAT = 0x1406 };
+struct VertexLayout {
+    uint32_t posType=LAYOUT_FLOAT, normType=LAYOUT_FLOAT, indexType=LAYOUT_UNSIGNED_INT;
+    bool posNormalized=false, normNormalized=false;
+    int normSize=3;
+    int stride=0;
+    size_t posOffset=0, normOffset=0;
+    bool octNormals=false;
+    float decodeScale[3]={1,1,1}, decodeOffset[3]={0,0,0};   // object pos = decodeOffset + decodeScale * attribute
+};
+
+// -------- Threading helper --------
+inline unsigned workerCount(){ unsigned n = std::thread::hardware_concurrency(); return n ? n : 1u; }
+// Split [0,n) into one contiguous range per worker and run fn(begin, end, worker) on each.
+template<class F> void parallelRanges(size_t n, unsigned workers, F fn){
+    if(workers <= 1 || n < 2){ fn((size_t)0, n, 0u); return; }
+    size_t step = (n + workers - 1) / workers;
+    std::vector<std::thread> pool;
+    for(unsigned w=0; w<workers; ++w){
+        size_t b = w*step, e = std::min(n, b+step);
+        if(b >= e) break;
+        pool.emplace_back(fn, b, e, w);
+    }
+    for(auto &t : pool) t.join();
+}
+
+// -------- Memory-mapped file (read-only) --------
+struct MappedFile {
+    const char* data=nullptr; size_t size=0; int fd=-1;
+    MappedFile(){}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile(){ close(); }
+    void swap(MappedFile &o){ std::swap(data, o.data); std::swap(size, o.size); std::swap(fd, o.fd); }
+    void close(){ if(data) munmap((void*)data, size); if(fd>=0) ::close(fd); data=nullptr; size=0; fd=-1; }
+    bool open(const std::string &path){
+        close();
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+        struct stat st; if(fstat(fd, &st) != 0) return false;
+        size = (size_t)st.st_size;
+        if(size == 0) return true;
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED){ size = 0; return false; }
+        madvise(p, size, MADV_SEQUENTIAL);
+        data = (const char*)p;
+        return true;
+    }
+};
+
+// -------- In-place SMF tokenizer (no locale, no iostreams) --------
+inline bool isBlank(char c){ return c==' ' || c=='\t' || c=='\r'; }
+inline bool isDigit(char c){ return c>='0' && c<='9'; }
+inline const char* skipBlanks(const char* p, const char* e){ while(p<e && isBlank(*p)) ++p; return p; }
+
+// Parses a decimal float ("-1.5e-3" style). Returns nullptr if no digits were found.
+inline const char* scanFloat(const char* p, const char* e, float &out){
+    static const double pow10[] = { 1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+                                    1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22 };
+    p = skipBlanks(p, e);
+    bool neg = false;
+    if(p<e && (*p=='-' || *p=='+')){ neg = (*p=='-'); ++p; }
+    uint64_t mant = 0; int exp10 = 0, digits = 0; bool any = false;
+    for(; p<e && isDigit(*p); ++p){
+        any = true;
+        if(digits < 19){ mant = mant*10 + (uint64_t)(*p-'0'); if(mant) ++digits; } else ++exp10;
+    }
+    if(p<e && *p=='.'){
+        for(++p; p<e && isDigit(*p); ++p){
+            any = true;
+            if(digits < 19){ mant = mant*10 + (uint64_t)(*p-'0'); if(mant) ++digits; --exp10; }
+        }
+    }
+    if(!any) return nullptr;
+    if(p<e && (*p=='e' || *p=='E')){
+        const char* q = p+1; bool eneg = false;
+        if(q<e && (*q=='-' || *q=='+')){ eneg = (*q=='-'); ++q; }
+        if(q<e && isDigit(*q)){
+            int ev = 0;
+            for(; q<e && isDigit(*q); ++q) if(ev < 10000) ev = ev*10 + (*q-'0');
+            exp10 += eneg ? -ev : ev;
+            p = q;
+        }
+    }
+    double v = (double)mant;
+    // exact fast path: mantissa fits in 53 bits and the power of ten is exactly representable
+    if(exp10 == 0) {}
+    else if(mant < (1ull<<53) && exp10 < 0 && exp10 >= -22) v /= pow10[-exp10];
+    else if(mant < (1ull<<53) && exp10 > 0 && exp10 <= 22) v *= pow10[exp10];
+    else v *= std::pow(10.0, (double)exp10);
+    out = (float)(neg ? -v : v);
+    return p;
+}
+
+inline const char* scanInt(const char* p, const char* e, int &out){
+    p = skipBlanks(p, e);
+    bool neg = false;
+    if(p<e && (*p=='-' || *p=='+')){ neg = (*p=='-'); ++p; }
+    if(p>=e || !isDigit(*p)) return nullptr;
+    long v = 0;
+    for(; p<e && isDigit(*p); ++p) if(v < 0x7fffffffL) v = v*10 + (*p-'0');
+    out = (int)(neg ? -v : v);
+    return p;
+}
+
+// Returns 'v' or 'f' for vertex/face records, 0 for anything else (comments, blank lines, other tags).
+inline char recordType(const char* &p, const char* e){
+    p = skipBlanks(p, e);
+    if(p+1 >= e) return 0;
+    char c = *p;
+    if((c=='v' || c=='f') && isBlank(p[1])){ ++p; return c; }
+    return 0;
+}
+
+// -------- Vertex -> triangle adjacency (CSR) --------
+// tris[offsets[v] .. offsets[v+1]) lists every triangle touching v, in ascending order.
+// A triangle with a repeated corner is listed once per corner, matching a scatter over corners.
+struct VertexAdjacency {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> tris;
+    size_t vertexCount() const { return offsets.empty() ? 0 : offsets.size()-1; }
+    void clear(){ offsets.clear(); tris.clear(); }
+};
+void buildVertexAdjacency(VertexAdjacency &adj, const std::vector<Tri> &tris, size_t nv);
+
+// -------- Vertex normals & bounds --------
+enum NormalWeight { NORMAL_UNIFORM=0, NORMAL_AREA=1, NORMAL_ANGLE=2 };
+extern int normalWeighting;
+float cornerAngle(const Vec3 &p, const Vec3 &q, const Vec3 &r);
+void computeVertexNormals(std::vector<Vertex> &verts, const std::vector<Tri> &tris, const VertexAdjacency &adj, int weighting);
+void computeBounds(const std::vector<Vertex> &verts, Vec3 &center, float &radius);
+
+// -------- Triangle order optimization --------
+extern bool optimizeMeshOrder;
+void vertexCacheStats(const std::vector<Tri> &tris, size_t nv, int cacheSize, double &acmr, double &atvr);
+void optimizeTriangleOrder(std::vector<Vertex> &verts, std::vector<Tri> &tris, VertexAdjacency &adj);
+
+// -------- Mesh simplification & LOD --------
+struct LodLevel { uint32_t firstIndex, indexCount; float error; uint32_t pad; };   // error in object units; same layout in the .smfb
+extern bool generateLods;
+void buildLodChain(const std::vector<Vertex> &vertices, const std::vector<Tri> &triangles, float scale,
+                   std::vector<LodLevel> &lodLevels, std::vector<uint32_t> &lodIndices);
+
+// -------- Meshlets --------
+struct Meshlet { uint32_t firstIndex, indexCount; float center[3], radius; float axis[3], cutoff; };   // same layout in the .smfb
+extern bool buildMeshletsEnabled;
+void buildMeshlets(const std::vector<Vertex> &verts, std::vector<Tri> &tris, VertexAdjacency &adj, std::vector<Meshlet> &out);
+
+// -------- Bounding volume hierarchy & ray queries --------
+// count 0: inner node with children first and first+1; otherwise a leaf with `count` triangles in packs[first]
+struct BVHNode { float lo[3]; uint32_t first; float hi[3]; uint32_t count; };
+// Edges from v0; unused lanes are degenerate (e1 = e2 = 0) and never hit.
+struct TriPack { float v0[3][4], e1[3][4], e2[3][4]; uint32_t tri[4]; };
+struct MeshBVH {
+    std::vector<BVHNode> nodes;   // nodes[0] is the root
+    std::vector<TriPack> packs;
+    bool empty() const { return nodes.empty(); }
+    void swap(MeshBVH &o){ nodes.swap(o.nodes); packs.swap(o.packs); }
+};
+
+extern int aoSamples;
+extern float aoRadius;
+extern bool shadowsEnabled;
+static const float RAY_EPSILON = 1e-4f;   // ray origins are pushed this far off the surface (model radius = 1)
+
+// 1/d with zero components replaced by a huge finite value, so slab tests never compute 0 * inf.
+inline float safeInverse(float d){ return 1.0f / (d != 0.0f ? d : 1e-30f); }
+
+struct RayHit { float t; uint32_t tri; };
+
+// Four rays traced together. Lanes with tmax <= tmin are inactive.
+struct RayPacket {
+    F4 o[3], d[3], inv[3], tmin, tmax;
+    uint32_t tri[4];   // closest hit per lane after a closest-hit trace
+    void setDirections(const float dx[4], const float dy[4], const float dz[4]){
+        d[0] = f4load(dx); d[1] = f4load(dy); d[2] = f4load(dz);
+        float ix[4], iy[4], iz[4];
+        for(int k=0;k<4;++k){ ix[k] = safeInverse(dx[k]); iy[k] = safeInverse(dy[k]); iz[k] = safeInverse(dz[k]); }
+        inv[0] = f4load(ix); inv[1] = f4load(iy); inv[2] = f4load(iz);
+    }
+};
+
+void buildBVH(const MeshView &mv, MeshBVH &out, unsigned workers);
+bool bvhTrace(const MeshBVH &bvh, const float o[3], const float d[3], float tmin, float tmax, RayHit* hit);
+int bvhTrace4(const MeshBVH &bvh, RayPacket &r, bool closest);
+size_t bakeAmbientOcclusion(const MeshView &mv, float scale, const MeshBVH &bvh, int samples, float radius, unsigned workers,
+                            std::vector<uint8_t> &ao, size_t* blocked = nullptr);
+size_t traceLightVisibility(const MeshView &mv, float scale, const MeshBVH &bvh, const Vec3 &light, unsigned workers,
+                            std::vector<uint8_t> &vis, size_t* blocked = nullptr);
+
+// -------- Binary mesh cache (.smfb) --------
+// Layout: SMFBHeader, then float pos[3*V], float norm[3*V], uint32 idx[indexCount], LodLevel lods[lodCount],
+// Meshlet meshlets[meshletCount], uint8 ao[V] (SMFB_AO only), each section 16-byte aligned. idx starts with the full
+// mesh (3*T indices) followed by the coarser LODs.
+static const uint32_t SMFB_VERSION = 6;
+static const uint32_t SMFB_OPTIMIZED = 1u;
+static const uint32_t SMFB_LODS = 2u;
+static const uint32_t SMFB_MESHLETS = 4u;
+static const uint32_t SMFB_AO = 8u;
+struct SMFBHeader {
+    char magic[4];            // "SMFB"
+    uint32_t version;
+    uint64_t sourceHash;      // content hash of the .smf this was built from
+    uint64_t sourceSize;
+    uint32_t vertexCount, triCount;
+    uint32_t normalWeight;    // NormalWeight the normals were averaged with
+    uint32_t flags;           // SMFB_OPTIMIZED: order went through optimizeTriangleOrder(); SMFB_LODS: LOD chain generated;
+                              // SMFB_MESHLETS: triangles grouped into meshlets; SMFB_AO: ambient occlusion baked
+    float centroid[3];
+    float modelScale;
+    uint64_t posOffset, normOffset, idxOffset, fileSize;
+    uint64_t indexCount;      // all LOD levels
+    uint64_t lodOffset;
+    uint32_t lodCount, meshletCount;
+    uint64_t meshletOffset;
+    uint32_t aoSamples;       // bake settings of the ao section
+    float aoRadius;
+    uint64_t aoOffset;
+};
+
+struct MeshCache {
+    MappedFile file;
+    const SMFBHeader* hdr=nullptr;
+    const float* pos=nullptr;
+    const float* norm=nullptr;
+    const uint32_t* idx=nullptr;
+    const LodLevel* lods=nullptr;
+    const uint8_t* ao=nullptr;
+    bool loaded() const { return hdr != nullptr; }
+    void reset(){ file.close(); hdr=nullptr; pos=nullptr; norm=nullptr; idx=nullptr; lods=nullptr; ao=nullptr; }
+    void swap(MeshCache &o){ file.swap(o.file); std::swap(hdr, o.hdr); std::swap(pos, o.pos); std::swap(norm, o.norm); std::swap(idx, o.idx); std::swap(lods, o.lods); std::swap(ao, o.ao); }
+};
+
+inline uint64_t alignUp(uint64_t v){ return (v + 15) & ~(uint64_t)15; }
+
+// -------- Mesh state --------
+// Everything a loaded model owns on the CPU. The viewer keeps the displayed mesh in one MeshData; loads fill a
+// separate one and the viewer swaps it in, so a background reload never touches the mesh on screen.
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<Tri> triangles;
+    VertexAdjacency vertexFaces;
+    std::vector<Meshlet> meshlets;
+    std::vector<LodLevel> lodLevels;        // level 0 is the full mesh
+    std::vector<uint32_t> lodIndices;       // indices of levels 1.. when parsed (the cache stores them after level 0)
+    std::vector<uint8_t> ao;                // baked ambient occlusion per vertex (255 = open), empty unless --ao
+    MeshBVH bvh;                            // built when AO or shadows ask for one
+    MeshCache cache;
+    Vec3 centroid = Vec3(0,0,0);
+    float modelScale = 1.0f;
+    void swap(MeshData &o){
+        vertices.swap(o.vertices); triangles.swap(o.triangles);
+        vertexFaces.offsets.swap(o.vertexFaces.offsets); vertexFaces.tris.swap(o.vertexFaces.tris);
+        meshlets.swap(o.meshlets); lodLevels.swap(o.lodLevels); lodIndices.swap(o.lodIndices);
+        ao.swap(o.ao); bvh.swap(o.bvh); cache.swap(o.cache);
+        std::swap(centroid, o.centroid); std::swap(modelScale, o.modelScale);
+    }
+};
+MeshView meshView(const MeshData &m);
+
+// -------- SMF loader & mesh cache --------
+struct SMFParseStats { size_t bytes = 0; double seconds = 0; unsigned workers = 0; };
+// Tokenizes `path` into m.vertices/m.triangles with face normals; nothing else.
+bool parseSMF(const std::string &path, MeshData &m, SMFParseStats* stats = nullptr);
+// Everything after parsing: adjacency, vertex normals, optional reordering, meshlets, centroid/scale and the LOD chain.
+void processMesh(MeshData &m);
+bool loadSMF(const std::string &path, MeshData &m);
+bool loadMeshCache(const std::string &cachePath, uint64_t srcHash, uint64_t srcSize, MeshData &m);
+bool writeMeshCache(const std::string &cachePath, uint64_t srcHash, uint64_t srcSize, const MeshData &m);
+// Loads from the .smfb next to `path` when it matches the source, otherwise parses and (re)writes it.
+bool loadMesh(const std::string &path, MeshData &m);
+// A cache load leaves vertices/triangles empty; CPU-side consumers (software rendering, deformation) fill them in
+// with this on demand.
+void ensureCPUMesh(MeshData &m);
+
+// -------- Out-of-core chunked meshes (.smfc) --------
+// For models larger than memory. convertToChunks() turns an .smf into an .smfc in a few streaming passes whose working
+// set is bounded by `memCap` (whole process): positions and normal sums live in scratch files behind a fixed-size block
+// cache, and faces are bucketed on disk into a grid of spatial cells. Every cell becomes one chunk of interleaved float
+// position+normal vertices with its own indices and bounding sphere, which the viewer streams in on demand.
+static const uint32_t SMFC_VERSION = 1;
+struct SMFCHeader {
+    char magic[4];            // "SMFC"
+    uint32_t version;
+    uint64_t vertexCount, triCount;   // of the source mesh; chunks duplicate vertices on their borders
+    uint32_t chunkCount, grid;
+    float centroid[3];
+    float modelScale;
+    uint32_t normalWeight, pad;
+    uint64_t tableOffset;
+};
+struct SMFCChunk {
+    uint64_t offset;          // float {pos, normal}[vertexCount], then indices (16-byte aligned)
+    uint64_t bytes;
+    uint32_t vertexCount, indexCount, indexBytes, pad;
+    float center[3], radius;
+};
+
+bool convertToChunks(const std::string &src, const std::string &dst, size_t memCap);
+// Opens an .smfc and reads its header and chunk table; returns the descriptor, or -1 after printing why.
+int openChunkFile(const std::string &path, SMFCHeader &hdr, std::vector<SMFCChunk> &table);
+
+// -------- Deformation --------
+// Moves a region of the mesh and refreshes only what depends on it: the face normals around the moved vertices, the
+// vertex normals of those faces' corners, and a bitmap of dirty vertex pages for the buffer upload. Regions are
+// found through a uniform grid over the rest pose. Sculpting edits the rest pose, and the wave rides on top of it.
+struct MeshDeformer {
+    static const uint32_t PAGE_VERTS = 512;        // upload granularity (12 KB of {pos, normal})
+    std::vector<Vec3> restPos, restNorm;
+    std::vector<uint32_t> cellStart, cellVerts;    // CSR grid: cell -> vertices binned there at the last rebuild
+    Vec3 gridMin; float cellSize = 1.0f; int dims[3] = { 1, 1, 1 };
+    std::vector<float> shift;                      // bound on how far each rest position moved since it was binned
+    float drift = 0.0f;                            // largest shift
+    std::vector<uint32_t> displaced;               // vertices the wave holds away from rest (ascending)
+    std::vector<uint32_t> moved;                   // moved since the last updateNormals()
+    std::vector<uint32_t> faces, touched;          // refreshed by the last updateNormals()
+    std::vector<uint32_t> vertMark, faceMark; uint32_t stamp = 0;
+    std::vector<uint64_t> dirtyPages;              // one bit per PAGE_VERTS vertices, cleared by the caller
+    std::vector<uint32_t> scratch;
+
+    bool ready(size_t vertexCount) const { return vertexCount > 0 && restPos.size() == vertexCount; }
+    void reset(const std::vector<Vertex> &verts, size_t triCount);   // takes `verts` as the rest pose
+    void clear();
+    // Ripple of `amplitude` along the rest normals in the vertical (z) column of `radius` around `center`, so it crosses
+    // the surface whatever the shape; last frame's ripple outside the column relaxes.
+    void wave(std::vector<Vertex> &verts, const Vec3 &center, float radius, float amplitude, float phase);
+    void relax(std::vector<Vertex> &verts);        // ends the wave
+    // Pushes the rest pose within `radius` of `center` along its normals (negative strength digs in).
+    void brush(std::vector<Vertex> &verts, const Vec3 &center, float radius, float strength);
+    void updateNormals(std::vector<Vertex> &verts, std::vector<Tri> &tris, const VertexAdjacency &adj, int weighting);
+    // Rest positions within `radius` of `center` (of its z axis with `column`), ascending.
+    void query(const Vec3 &center, float radius, bool column, std::vector<uint32_t> &out) const;
+    void rebuildGrid();
+};
+// The viewer's wave and brush, in units of the model's bounding radius (the wave's axis circles the centroid).
+static const float WAVE_RADIUS = 0.2f, WAVE_AMPLITUDE = 0.02f, WAVE_ORBIT = 0.6f, WAVE_SPEED = 6.0f;
+static const float BRUSH_RADIUS = 0.08f, BRUSH_STRENGTH = 0.004f;
+inline Vec3 waveCenter(const Vec3 &centroid, float modelRadius, float seconds){
+    float a = 0.5f * seconds;
+    return centroid + Vec3(cosf(a), sinf(a), 0.0f) * (WAVE_ORBIT * modelRadius);
+}
+// Runs of set page bits as [first, end) vertex ranges clipped to `vertexCount`; returns the vertices they cover.
+size_t dirtyVertexRuns(const std::vector<uint64_t> &pages, size_t vertexCount, std::vector<std::pair<size_t, size_t>> &runs);
+
+// -------- Buffer staging --------
+// CPU-side contents of the mesh buffers in the chosen vertex format. Building one touches no GL state, so the
+// background loader prepares it off the main thread; data[] points into the mesh (mapped cache or vertices[]) or
+// into storage[].
+// BUF_NORM is empty for interleaved layouts, BUF_AO without baked AO; indices come last (see loaderLoad()).
+enum { BUF_POS = 0, BUF_NORM = 1, BUF_AO = 2, BUF_INDEX = 3, BUF_COUNT = 4 };
+struct BufferImage {
+    VertexLayout layout;
+    int format = VF_FLOAT;
+    const void* data[BUF_COUNT] = { nullptr, nullptr, nullptr, nullptr };
+    size_t bytes[BUF_COUNT] = { 0, 0, 0, 0 };
+    std::vector<char> storage[BUF_COUNT];
+    size_t triCount = 0;
+    template<class T> T* allocate(int buf, size_t count){
+        storage[buf].resize(count * sizeof(T));
+        data[buf] = storage[buf].data(); bytes[buf] = storage[buf].size();
+        return (T*)storage[buf].data();
+    }
+    void reference(int buf, const void* p, size_t n){ storage[buf].clear(); data[buf] = p; bytes[buf] = n; }
+};
+void prepareBufferImage(const MeshView &mv, float scale, BufferImage &img);
+
+// Process-wide peak resident set size.
+inline double peakRssMB(){
+    struct rusage ru; getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / (1024.0*1024.0);   // bytes
+#else
+    return ru.ru_maxrss / 1024.0;            // kilobytes
+#endif
+}
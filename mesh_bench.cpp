@@ -0,0 +1,417 @@
+// mesh_bench.cpp
+// Micro-benchmarks for the mesh pipeline in mesh.cpp, without GL: synthetic meshes (sphere, grid, noise) from 1k to
+// 50M triangles are written as .smf, then every load stage is timed on its own and reported as ns/triangle, MB/s
+// and peak resident memory. Each mesh runs in a forked child so the peak memory of one size does not hide the next.
+
+#include "mesh.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <sys/wait.h>
+
+// -------- Synthetic meshes --------
+// sphere: UV sphere with one vertex per pole. grid: flat heightfield in scanline order.
+// noise: heightfield with hash noise whose vertices are written in a scattered order, like scanned or merged models.
+static const char* GENERATORS[] = { "sphere", "grid", "noise" };
+
+static uint32_t hash2(uint32_t x, uint32_t y){
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u;
+    h ^= h >> 15; h *= 0x2c1b3c6du; h ^= h >> 12; h *= 0x297a2d39u; h ^= h >> 15;
+    return h;
+}
+
+// Affine permutation i -> (a*i + c) mod n and its inverse; shuffles vertex order without a table.
+struct IndexShuffle {
+    uint64_t n, a, c, inv;
+    explicit IndexShuffle(uint64_t count) : n(count), a(1), c(0), inv(1) {
+        if(n < 3) return;
+        a = 0x9e3779b97f4a7c15ull % n;
+        while(a < 2 || gcd(a, n) != 1) a = a + 1 < n ? a + 1 : 2;
+        c = n / 3;
+        // modular inverse of a by extended Euclid
+        int64_t t = 0, nt = 1, r = (int64_t)n, nr = (int64_t)a;
+        while(nr){ int64_t q = r / nr; t -= q * nt; std::swap(t, nt); r -= q * nr; std::swap(r, nr); }
+        inv = (uint64_t)(t < 0 ? t + (int64_t)n : t);
+    }
+    static uint64_t gcd(uint64_t x, uint64_t y){ while(y){ uint64_t t = x % y; x = y; y = t; } return x; }
+    uint64_t to(uint64_t i) const { return (uint64_t)(((unsigned __int128)a * i + c) % n); }
+    uint64_t from(uint64_t j) const { return (uint64_t)(((unsigned __int128)inv * ((j + n - c) % n)) % n); }
+};
+
+// Writes a mesh of about `targetTris` triangles; returns the exact count, or 0 if the file cannot be written.
+static size_t writeSyntheticSMF(const std::string &path, const std::string &gen, size_t targetTris){
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f){ std::cerr << "Cannot write " << path << "\n"; return 0; }
+    std::vector<char> buf(1 << 20);
+    setvbuf(f, buf.data(), _IOFBF, buf.size());
+    size_t tris = 0;
+    if(gen == "sphere"){
+        // nx segments around, ny rings from pole to pole: 2*nx*(ny-1) triangles
+        size_t nx = std::max<size_t>(3, (size_t)ceil(sqrt((double)targetTris)));
+        size_t ny = std::max<size_t>(2, (targetTris + 2*nx - 1) / (2*nx) + 1);
+        const double pi = 3.14159265358979;
+        fprintf(f, "v 0 0 1\n");
+        for(size_t j=1;j<ny;++j){
+            double th = pi * j / ny, z = cos(th), s = sin(th);
+            for(size_t i=0;i<nx;++i){ double ph = 2*pi * i / nx; fprintf(f, "v %.6f %.6f %.6f\n", s*cos(ph), s*sin(ph), z); }
+        }
+        fprintf(f, "v 0 0 -1\n");
+        auto ring = [&](size_t j, size_t i){ return 2 + (j-1)*nx + i % nx; };   // 1-based
+        size_t bottom = 2 + (ny-1)*nx;
+        for(size_t i=0;i<nx;++i) fprintf(f, "f 1 %zu %zu\n", ring(1, i), ring(1, i+1));
+        for(size_t j=1;j+1<ny;++j)
+            for(size_t i=0;i<nx;++i){
+                size_t a = ring(j, i), b = ring(j, i+1), c = ring(j+1, i), d = ring(j+1, i+1);
+                fprintf(f, "f %zu %zu %zu\nf %zu %zu %zu\n", a, c, d, a, d, b);
+            }
+        for(size_t i=0;i<nx;++i) fprintf(f, "f %zu %zu %zu\n", ring(ny-1, i+1), ring(ny-1, i), bottom);
+        tris = 2*nx*(ny-1);
+    } else {
+        // n x n quads over the unit square: (n+1)^2 vertices, 2*n^2 triangles
+        bool noise = gen == "noise";
+        size_t n = std::max<size_t>(1, (size_t)ceil(sqrt(targetTris / 2.0)));
+        size_t side = n + 1, nv = side * side;
+        IndexShuffle shuffle(noise ? nv : 1);
+        for(size_t k=0;k<nv;++k){
+            size_t v = noise ? shuffle.from(k) : k, i = v / side, j = v % side;
+            double x = (double)i / n, y = (double)j / n, z = 0.0;
+            if(noise) z = 0.1 * sin(6*x) * cos(5*y) + 0.02 * (hash2((uint32_t)i, (uint32_t)j) / 4294967296.0 - 0.5);
+            fprintf(f, "v %.6f %.6f %.6f\n", x, y, z);
+        }
+        auto id = [&](size_t i, size_t j){ size_t v = i*side + j; return (noise ? shuffle.to(v) : v) + 1; };
+        for(size_t i=0;i<n;++i)
+            for(size_t j=0;j<n;++j){
+                size_t a = id(i, j), b = id(i+1, j), c = id(i, j+1), d = id(i+1, j+1);
+                fprintf(f, "f %zu %zu %zu\nf %zu %zu %zu\n", a, b, d, a, d, c);
+            }
+        tris = 2*n*n;
+    }
+    bool ok = !ferror(f);
+    if(fclose(f) != 0 || !ok){ std::cerr << "Cannot write " << path << "\n"; return 0; }
+    return tris;
+}
+
+// -------- Stages --------
+// One row of the report; sent from the child to the parent through a pipe, hence plain data.
+struct StageResult {
+    char gen[16], stage[24];
+    uint64_t tris;
+    double ms, mbps, peakMB;   // mbps < 0: not meaningful for the stage
+};
+
+static bool stageSkipped(const std::vector<std::string> &skip, const char* stage){
+    for(const std::string &s : skip)
+        if(strncmp(stage, s.c_str(), s.size()) == 0 && (stage[s.size()] == 0 || stage[s.size()] == '/')) return true;
+    return false;
+}
+
+static size_t fileBytes(const std::string &path){ struct stat st; return stat(path.c_str(), &st) == 0 ? (size_t)st.st_size : 0; }
+
+static const size_t CHUNK_MEM_CAP = 512u << 20;   // the viewer's default --mem-cap
+
+// Runs every stage on `smfPath` in order, the way loadMesh() does, and writes one StageResult per stage to `fd`.
+static bool runStages(const std::string &gen, size_t tris, const std::string &smfPath, const std::string &cachePath,
+                      const std::string &chunkPath, const std::vector<std::string> &skip, int fd){
+    MeshData m;
+    auto t0 = std::chrono::steady_clock::now();
+    auto report = [&](const char* stage, size_t bytes, int frames = 1){
+        auto t1 = std::chrono::steady_clock::now();
+        StageResult r{};
+        snprintf(r.gen, sizeof(r.gen), "%s", gen.c_str());
+        snprintf(r.stage, sizeof(r.stage), "%s", stage);
+        r.tris = tris;
+        double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        r.ms = ms / frames;
+        r.mbps = bytes && ms > 0 ? bytes / (1024.0*1024.0) / (ms / 1000.0) : -1.0;
+        r.peakMB = peakRssMB();
+        t0 = std::chrono::steady_clock::now();
+        return write(fd, &r, sizeof(r)) == (ssize_t)sizeof(r);
+    };
+    auto start = [&](){ t0 = std::chrono::steady_clock::now(); };
+
+    // the out-of-core converter streams the .smf on its own; it goes first so the parsed mesh does not hide its peak memory
+    if(!stageSkipped(skip, "chunk")){
+        start();
+        if(!convertToChunks(smfPath, chunkPath, CHUNK_MEM_CAP)){ std::cerr << "Cannot convert " << smfPath << "\n"; return false; }
+        report("chunk", fileBytes(smfPath));
+        unlink(chunkPath.c_str());
+    }
+
+    start();
+    if(!parseSMF(smfPath, m)){ std::cerr << "Cannot parse " << smfPath << "\n"; return false; }
+    report("parse", fileBytes(smfPath));
+    unlink(smfPath.c_str());
+
+    start(); buildVertexAdjacency(m.vertexFaces, m.triangles, m.vertices.size()); report("adjacency", 0);
+    static const char* weightNames[] = { "normals/uniform", "normals/area", "normals/angle" };
+    for(int w : { NORMAL_UNIFORM, NORMAL_AREA, NORMAL_ANGLE }){
+        if(stageSkipped(skip, weightNames[w])) continue;
+        start(); computeVertexNormals(m.vertices, m.triangles, m.vertexFaces, w); report(weightNames[w], 0);
+    }
+    // the cache stores normals averaged with normalWeighting; end on that weighting like processMesh() does
+    computeVertexNormals(m.vertices, m.triangles, m.vertexFaces, normalWeighting);
+
+    if(!stageSkipped(skip, "optimize")){
+        start(); optimizeTriangleOrder(m.vertices, m.triangles, m.vertexFaces); report("optimize", 0);
+    }
+    if(!stageSkipped(skip, "meshlets")){
+        start(); buildMeshlets(m.vertices, m.triangles, m.vertexFaces, m.meshlets); report("meshlets", 0);
+    }
+    float maxd = 0.0f;
+    start(); computeBounds(m.vertices, m.centroid, maxd); report("bounds", 0);
+    m.modelScale = 1.0f / (maxd < 1e-6f ? 1.0f : maxd);
+    if(!stageSkipped(skip, "lod")){
+        generateLods = true;
+        start(); buildLodChain(m.vertices, m.triangles, m.modelScale, m.lodLevels, m.lodIndices); report("lod", 0);
+    } else {
+        generateLods = false;
+        buildLodChain(m.vertices, m.triangles, m.modelScale, m.lodLevels, m.lodIndices);
+    }
+
+    static const char* formatNames[] = { "staging/float", "staging/interleaved", "staging/quantized" };
+    for(int f : { VF_FLOAT, VF_INTERLEAVED, VF_QUANTIZED }){
+        if(stageSkipped(skip, formatNames[f])) continue;
+        vertexFormat = f;
+        BufferImage img;
+        start(); prepareBufferImage(meshView(m), m.modelScale, img);
+        size_t bytes = 0; for(int b=0;b<BUF_COUNT;++b) bytes += img.bytes[b];
+        report(formatNames[f], bytes);
+    }
+    vertexFormat = VF_FLOAT;
+
+    if(!stageSkipped(skip, "cache")){
+        // source hash/size are only compared against each other here, so any fixed pair will do
+        const uint64_t srcHash = 0x5eedu, srcSize = tris;
+        start();
+        if(!writeMeshCache(cachePath, srcHash, srcSize, m)){ std::cerr << "Cannot write " << cachePath << "\n"; return false; }
+        size_t bytes = fileBytes(cachePath);
+        report("cache/write", bytes);
+        MeshData c;
+        start();
+        if(!loadMeshCache(cachePath, srcHash, srcSize, c)){ std::cerr << "Cannot load " << cachePath << "\n"; unlink(cachePath.c_str()); return false; }
+        report("cache/load", bytes);
+        unlink(cachePath.c_str());
+    }
+
+    // the viewer's wave and sculpt brush; times are per frame and MB/s counts the dirty ranges the frames upload
+    const int DEFORM_FRAMES = 32;
+    MeshDeformer deformer;
+    if(!stageSkipped(skip, "deform/setup")){
+        start(); deformer.reset(m.vertices, m.triangles.size()); report("deform/setup", 0);
+    } else deformer.reset(m.vertices, m.triangles.size());
+    std::vector<std::pair<size_t, size_t>> runs;
+    auto deformStage = [&](const char* stage, const std::function<void(int)> &step){
+        if(stageSkipped(skip, stage)) return true;
+        size_t uploaded = 0;
+        start();
+        for(int f=0; f<DEFORM_FRAMES; ++f){
+            step(f);
+            deformer.updateNormals(m.vertices, m.triangles, m.vertexFaces, normalWeighting);
+            uploaded += dirtyVertexRuns(deformer.dirtyPages, m.vertices.size(), runs) * sizeof(Vertex);
+            std::fill(deformer.dirtyPages.begin(), deformer.dirtyPages.end(), 0);
+        }
+        return report(stage, uploaded, DEFORM_FRAMES);
+    };
+    float radius = 1.0f / m.modelScale;
+    deformStage("deform/wave", [&](int f){
+        deformer.wave(m.vertices, waveCenter(m.centroid, radius, f / 60.0f), WAVE_RADIUS * radius, WAVE_AMPLITUDE * radius, WAVE_SPEED * f / 60.0f);
+    });
+    deformer.relax(m.vertices);
+    deformer.updateNormals(m.vertices, m.triangles, m.vertexFaces, normalWeighting);
+    deformStage("deform/brush", [&](int f){
+        deformer.brush(m.vertices, deformer.restPos[(size_t)f * 7919 % m.vertices.size()], BRUSH_RADIUS * radius, BRUSH_STRENGTH * radius);
+    });
+    return true;
+}
+
+// Generates and measures one mesh in a child process; appends its rows to `results`. Returns false if it failed
+// (out of memory, disk full, ...); the remaining sizes still run.
+static bool runCase(const std::string &gen, size_t targetTris, const std::string &tmpDir,
+                    const std::vector<std::string> &skip, std::vector<StageResult> &results){
+    int fds[2];
+    if(pipe(fds) != 0){ perror("pipe"); return false; }
+    std::string base = tmpDir + "/mesh_bench_" + std::to_string(getpid()) + "_" + gen + "_" + std::to_string(targetTris);
+    std::string smfPath = base + ".smf", cachePath = base + ".smfb", chunkPath = base + ".smfc";
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0){ perror("fork"); close(fds[0]); close(fds[1]); return false; }
+    if(pid == 0){
+        close(fds[0]);
+        size_t tris = writeSyntheticSMF(smfPath, gen, targetTris);
+        // the stages log progress on std::cout; keep the table readable
+        std::ofstream null("/dev/null");
+        std::cout.rdbuf(null.rdbuf());
+        bool ok = tris && runStages(gen, tris, smfPath, cachePath, chunkPath, skip, fds[1]);
+        unlink(smfPath.c_str()); unlink(cachePath.c_str()); unlink(chunkPath.c_str());
+        close(fds[1]);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    StageResult r;
+    size_t first = results.size();
+    while(read(fds[0], &r, sizeof(r)) == (ssize_t)sizeof(r)){
+        printf("  %-7s %11llu %-20s %10.2f %9.1f ", r.gen, (unsigned long long)r.tris, r.stage, r.ms, r.ms * 1e6 / std::max<uint64_t>(1, r.tris));
+        if(r.mbps >= 0) printf("%9.1f", r.mbps); else printf("%9s", "-");
+        printf(" %9.0f\n", r.peakMB);
+        fflush(stdout);
+        results.push_back(r);
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    unlink(smfPath.c_str()); unlink(cachePath.c_str()); unlink(chunkPath.c_str());
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 0) return true;
+    if(WIFSIGNALED(status)) printf("  %-7s %11zu failed after %zu stage(s): signal %d%s\n", gen.c_str(), targetTris, results.size() - first,
+                                   WTERMSIG(status), WTERMSIG(status) == SIGKILL ? " (out of memory?)" : "");
+    else printf("  %-7s %11zu failed after %zu stage(s)\n", gen.c_str(), targetTris, results.size() - first);
+    return false;
+}
+
+// -------- Baselines --------
+// Same one-entry-per-line layout as the viewer's --bench-save files; compared on ns/triangle.
+static std::string resultName(const StageResult &r){ return std::string(r.gen) + "/" + std::to_string(r.tris) + "/" + r.stage; }
+
+static bool writeResultsJSON(const std::string &path, const std::vector<StageResult> &results){
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f){ std::cerr << "Cannot write " << path << "\n"; return false; }
+    fprintf(f, "{\n  \"mode\": \"mesh\",\n  \"threads\": %u,\n  \"stages\": [\n", workerCount());
+    for(size_t i=0;i<results.size();++i){
+        const StageResult &r = results[i];
+        fprintf(f, "    { \"name\": \"%s\", \"ms\": %.4f, \"ns_per_tri\": %.4f, \"mb_per_s\": %.2f, \"peak_mb\": %.1f }%s\n",
+                resultName(r).c_str(), r.ms, r.ms * 1e6 / std::max<uint64_t>(1, r.tris), r.mbps, r.peakMB, i+1 < results.size() ? "," : "");
+    }
+    fputs("  ]\n}\n", f);
+    return fclose(f) == 0;
+}
+
+// Reads back the files writeResultsJSON produces: name -> ns/triangle. Not a general JSON parser.
+static bool readResultsJSON(const std::string &path, std::vector<std::pair<std::string, double>> &out){
+    std::ifstream in(path);
+    if(!in){ std::cerr << "Cannot open baseline " << path << "\n"; return false; }
+    std::string line;
+    while(std::getline(in, line)){
+        size_t p = line.find("\"name\": \"");
+        if(p == std::string::npos) continue;
+        p += 9;
+        size_t e = line.find('"', p), q = line.find("\"ns_per_tri\"");
+        double ns = 0;
+        if(e == std::string::npos || q == std::string::npos || sscanf(line.c_str() + q + 12, " : %lf", &ns) != 1){
+            std::cerr << "Malformed baseline entry in " << path << ": " << line << "\n";
+            return false;
+        }
+        out.push_back({ line.substr(p, e - p), ns });
+    }
+    return true;
+}
+
+// -------- Command line --------
+static bool optValue(const std::string &arg, const char* key, std::string &value){
+    size_t n = strlen(key);
+    if(arg.compare(0, n, key) != 0) return false;
+    value = arg.substr(n);
+    return true;
+}
+
+// "10k", "1M", "2500" -> triangles
+static bool parseCount(const std::string &s, size_t &out){
+    char* end = nullptr;
+    double v = strtod(s.c_str(), &end);
+    if(end == s.c_str() || v <= 0) return false;
+    if(*end == 'k' || *end == 'K'){ v *= 1e3; ++end; }
+    else if(*end == 'm' || *end == 'M'){ v *= 1e6; ++end; }
+    if(*end) return false;
+    out = (size_t)v;
+    return out > 0;
+}
+
+static std::vector<std::string> splitList(const std::string &s){
+    std::vector<std::string> out;
+    size_t b = 0;
+    while(b <= s.size()){
+        size_t e = s.find(',', b);
+        if(e == std::string::npos) e = s.size();
+        if(e > b) out.push_back(s.substr(b, e - b));
+        b = e + 1;
+    }
+    return out;
+}
+
+static const char* usage =
+    "Usage: MeshBench [options]\n"
+    "  --sizes=1k,10k,...     triangle counts (default 1k,10k,100k,1M,10M,50M)\n"
+    "  --max=N                drop sizes above N triangles (e.g. --max=10M)\n"
+    "  --gen=sphere,grid,noise  generators to run (default all)\n"
+    "  --skip=chunk,lod,...     stages to leave out (parse, adjacency and bounds always run)\n"
+    "  --normals=uniform|area|angle  weighting stored in the cache stage\n"
+    "  --tmp=DIR              scratch directory for the generated .smf/.smfb/.smfc (default $TMPDIR or /tmp)\n"
+    "  --save=F.json  --baseline=F.json  --tolerance=PCT   store / compare ns per triangle against a baseline\n";
+
+int main(int argc, char** argv){
+    std::vector<size_t> sizes = { 1000, 10000, 100000, 1000000, 10000000, 50000000 };
+    std::vector<std::string> gens(std::begin(GENERATORS), std::end(GENERATORS)), skip;
+    const char* tmpEnv = getenv("TMPDIR");
+    std::string tmpDir = tmpEnv && *tmpEnv ? tmpEnv : "/tmp", savePath, baselinePath, v;
+    size_t maxTris = 0;
+    float tolerance = 0.10f;
+    for(int i=1;i<argc;++i){
+        std::string a = argv[i];
+        bool ok = true;
+        if(optValue(a, "--sizes=", v)){
+            sizes.clear();
+            for(const std::string &s : splitList(v)){ size_t n; if(!parseCount(s, n)){ ok = false; break; } sizes.push_back(n); }
+            ok = ok && !sizes.empty();
+        }
+        else if(optValue(a, "--max=", v)) ok = parseCount(v, maxTris);
+        else if(optValue(a, "--gen=", v)){
+            gens = splitList(v);
+            for(const std::string &g : gens) ok = ok && std::find(std::begin(GENERATORS), std::end(GENERATORS), g) != std::end(GENERATORS);
+            ok = ok && !gens.empty();
+        }
+        else if(optValue(a, "--skip=", v)) skip = splitList(v);
+        else if(a == "--normals=uniform") normalWeighting = NORMAL_UNIFORM;
+        else if(a == "--normals=area") normalWeighting = NORMAL_AREA;
+        else if(a == "--normals=angle") normalWeighting = NORMAL_ANGLE;
+        else if(optValue(a, "--tmp=", v)) tmpDir = v;
+        else if(optValue(a, "--save=", v)) savePath = v;
+        else if(optValue(a, "--baseline=", v)) baselinePath = v;
+        else if(optValue(a, "--tolerance=", v)){ ok = sscanf(v.c_str(), "%f", &tolerance) == 1 && tolerance >= 0; tolerance /= 100.0f; }
+        else ok = false;
+        if(!ok){ std::cerr << "Bad option " << a << "\n" << usage; return 1; }
+    }
+    if(maxTris) sizes.erase(std::remove_if(sizes.begin(), sizes.end(), [&](size_t n){ return n > maxTris; }), sizes.end());
+    std::vector<std::pair<std::string, double>> base;
+    if(!baselinePath.empty() && !readResultsJSON(baselinePath, base)) return 1;
+
+    printf("Mesh pipeline benchmark (%u thread(s), scratch %s)\n", workerCount(), tmpDir.c_str());
+    printf("  %-7s %11s %-20s %10s %9s %9s %9s\n", "mesh", "tris", "stage", "ms", "ns/tri", "MB/s", "peak MB");
+    std::vector<StageResult> results;
+    int failed = 0;
+    for(size_t n : sizes)
+        for(const std::string &g : gens) failed += !runCase(g, n, tmpDir, skip, results);
+
+    int regressions = 0;
+    if(!base.empty()){
+        printf("Against %s (tolerance %.0f%%):\n", baselinePath.c_str(), tolerance * 100.0f);
+        for(const StageResult &r : results){
+            std::string name = resultName(r);
+            auto b = std::find_if(base.begin(), base.end(), [&](const std::pair<std::string, double> &x){ return x.first == name; });
+            if(b == base.end()) continue;
+            double ns = r.ms * 1e6 / std::max<uint64_t>(1, r.tris);
+            bool slower = ns > b->second * (1.0 + tolerance);
+            if(slower || b->second > ns * (1.0 + tolerance))
+                printf("  %-40s %9.1f -> %9.1f ns/tri  %+6.1f%%%s\n", name.c_str(), b->second, ns,
+                       b->second > 0 ? 100.0 * (ns / b->second - 1.0) : 0.0, slower ? "  REGRESSION" : "");
+            regressions += slower;
+        }
+    }
+    if(!savePath.empty()){
+        if(!writeResultsJSON(savePath, results)) return 1;
+        std::cout << "Wrote baseline " << savePath << "\n";
+    }
+    if(failed) std::cerr << failed << " mesh(es) failed\n";
+    if(regressions){ std::cerr << regressions << " stage(s) regressed by more than " << tolerance*100.0f << "%\n"; return 1; }
+    return failed ? 1 : 0;
+}
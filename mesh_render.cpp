@@ -0,0 +1,63 @@
+// mesh_render.cpp
+// `--render` without the viewer: loads an .smf through mesh.cpp, draws one frame with the CPU rasterizer in render.cpp
+// and writes it as a PPM. It links no GL or GLUT, so `make test` builds and runs it on any platform; the options and
+// defaults match the viewer's, so both produce the same image.
+
+#include "render.h"
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+
+static bool optValue(const std::string &arg, const char* key, std::string &value){
+    size_t n = strlen(key);
+    if(arg.compare(0, n, key) != 0) return false;
+    value = arg.substr(n);
+    return true;
+}
+
+static const char* usage =
+    "Usage: MeshRender [options] --render=out.ppm models/your.smf\n"
+    "  --normals=uniform|area|angle   vertex normal weighting\n"
+    "  --size=WxH  --shade=flat|gouraud|phong  --material=N  --ortho\n"
+    "  --cam=angle,radius,height  --light=angle,radius,height  --threads=N\n"
+    "  --ao[=SAMPLES]  --ao-radius=R  --shadows   baked occlusion / light1 shadows, as in the viewer\n";
+
+int main(int argc, char** argv){
+    std::string modelPath, renderPath, v;
+    // the viewer's startup state (main.cpp)
+    ViewParams vp = { 0.0f, 3.0f, 0.0f, true, 3, 0, 0.0f, 1.2f, 0.5f, 900, 700 };
+    unsigned threads = workerCount();
+    initMaterials();
+    for(int i=1;i<argc;++i){
+        std::string a = argv[i];
+        bool ok = true;
+        if(a == "--normals=uniform") normalWeighting = NORMAL_UNIFORM;
+        else if(a == "--normals=area") normalWeighting = NORMAL_AREA;
+        else if(a == "--normals=angle") normalWeighting = NORMAL_ANGLE;
+        else if(optValue(a, "--render=", v)) renderPath = v;
+        else if(optValue(a, "--size=", v)) ok = sscanf(v.c_str(), "%dx%d", &vp.width, &vp.height) == 2 && vp.width > 0 && vp.height > 0;
+        else if(optValue(a, "--shade=", v)){ vp.shadeMode = v=="flat" ? 1 : v=="gouraud" ? 2 : v=="phong" ? 3 : 0; ok = vp.shadeMode != 0; }
+        else if(optValue(a, "--material=", v)) ok = sscanf(v.c_str(), "%d", &vp.materialIndex) == 1 && vp.materialIndex >= 0 && vp.materialIndex < (int)materials.size();
+        else if(optValue(a, "--cam=", v)) ok = sscanf(v.c_str(), "%f,%f,%f", &vp.camAngle, &vp.camRadius, &vp.camHeight) == 3;
+        else if(optValue(a, "--light=", v)) ok = sscanf(v.c_str(), "%f,%f,%f", &vp.lightAngle, &vp.lightRadius, &vp.lightHeight) == 3;
+        else if(optValue(a, "--threads=", v)) ok = sscanf(v.c_str(), "%u", &threads) == 1 && threads > 0;
+        else if(a == "--ortho") vp.perspective = false;
+        else if(a == "--ao") aoSamples = 64;
+        else if(optValue(a, "--ao=", v)) ok = sscanf(v.c_str(), "%d", &aoSamples) == 1 && aoSamples > 0 && aoSamples <= 4096;
+        else if(optValue(a, "--ao-radius=", v)) ok = sscanf(v.c_str(), "%f", &aoRadius) == 1 && aoRadius > 0;
+        else if(a == "--shadows") shadowsEnabled = true;
+        else if(a.compare(0, 2, "--") != 0 && modelPath.empty()) modelPath = a;
+        else ok = false;
+        if(!ok){ std::cerr << "Bad option " << a << "\n" << usage; return 1; }
+    }
+    if(modelPath.empty() || renderPath.empty()){ std::cerr << usage; return 1; }
+
+    MeshData mesh;
+    if(!loadMesh(modelPath, mesh)) return 1;
+    SoftFramebuffer fb;
+    auto t0 = std::chrono::steady_clock::now();
+    renderSoftware(mesh, vp, fb, threads);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << "Rendered " << fb.width << "x" << fb.height << " on " << threads << " thread(s) in " << ms << " ms\n";
+    return writePPM(renderPath, fb) ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+// ppm_compare.cpp
+// Compares a rendered binary PPM (P6) against a reference image for `make test`: a pixel fails when any channel differs
+// by more than --tolerance, and the comparison fails when more than --max-bad of the pixels do (silhouette pixels can
+// flip coverage between compilers that contract floating-point expressions differently).
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+struct Image { int width = 0, height = 0; std::vector<uint8_t> rgb; };
+
+static bool optValue(const std::string &arg, const char* key, std::string &out){
+    size_t n = std::string(key).size();
+    if(arg.compare(0, n, key) != 0) return false;
+    out = arg.substr(n);
+    return true;
+}
+
+// P6 with maxval 255, as writePPM() produces; comments in the header are skipped.
+static bool readPPM(const std::string &path, Image &img){
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f){ std::cerr << "Cannot open " << path << "\n"; return false; }
+    int field[3] = { 0, 0, 0 };
+    bool ok = fgetc(f) == 'P' && fgetc(f) == '6';
+    for(int i=0; i<3 && ok; ++i){
+        int c = fgetc(f);
+        while(c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#'){
+            if(c == '#') while(c != '\n' && c != EOF) c = fgetc(f);
+            c = fgetc(f);
+        }
+        if(c < '0' || c > '9'){ ok = false; break; }
+        while(c >= '0' && c <= '9'){ field[i] = field[i]*10 + (c - '0'); c = fgetc(f); }
+    }
+    ok = ok && field[0] > 0 && field[1] > 0 && field[2] == 255;
+    if(ok){
+        img.width = field[0]; img.height = field[1];
+        img.rgb.resize((size_t)img.width * img.height * 3);
+        ok = fread(img.rgb.data(), 1, img.rgb.size(), f) == img.rgb.size();
+    }
+    fclose(f);
+    if(!ok) std::cerr << path << " is not a readable 8-bit binary PPM\n";
+    return ok;
+}
+
+int main(int argc, char** argv){
+    std::string refPath, outPath, v;
+    int tolerance = 8;
+    double maxBad = 0.002;
+    for(int i=1;i<argc;++i){
+        std::string a = argv[i];
+        bool ok = true;
+        if(optValue(a, "--tolerance=", v)) ok = sscanf(v.c_str(), "%d", &tolerance) == 1 && tolerance >= 0;
+        else if(optValue(a, "--max-bad=", v)) ok = sscanf(v.c_str(), "%lf", &maxBad) == 1 && maxBad >= 0;
+        else if(refPath.empty()) refPath = a;
+        else if(outPath.empty()) outPath = a;
+        else ok = false;
+        if(!ok){ std::cerr << "Bad argument: " << a << "\n"; return 2; }
+    }
+    if(outPath.empty()){
+        std::cerr << "Usage: " << argv[0] << " reference.ppm rendered.ppm [--tolerance=8] [--max-bad=0.002]\n";
+        return 2;
+    }
+    Image ref, out;
+    if(!readPPM(refPath, ref) || !readPPM(outPath, out)) return 2;
+    if(ref.width != out.width || ref.height != out.height){
+        std::cerr << "FAIL " << outPath << ": " << out.width << "x" << out.height << ", reference is "
+                  << ref.width << "x" << ref.height << "\n";
+        return 1;
+    }
+    size_t pixels = (size_t)ref.width * ref.height, bad = 0;
+    int worst = 0;
+    for(size_t p=0; p<pixels; ++p){
+        int d = 0;
+        for(int k=0;k<3;++k) d = std::max(d, std::abs((int)ref.rgb[3*p+k] - (int)out.rgb[3*p+k]));
+        worst = std::max(worst, d);
+        if(d > tolerance) ++bad;
+    }
+    bool pass = bad <= (size_t)(maxBad * pixels);
+    std::cout << (pass ? "ok   " : "FAIL ") << outPath << ": " << bad << " of " << pixels << " pixels differ by more than "
+              << tolerance << " (allowed " << (size_t)(maxBad * pixels) << "), largest difference " << worst << "\n";
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,306 @@
+// render.cpp
+// Materials, camera matrices and the CPU rasterizer declared in render.h.
+
+#include "render.h"
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+
+// -------- Materials --------
+std::vector<Material> materials;
+
+void initMaterials(){
+    materials.clear();
+    // White shiny
+    materials.push_back({ {0.25f,0.25f,0.25f,1.0f}, {0.8f,0.8f,0.8f,1.0f}, {1.0f,1.0f,1.0f,1.0f}, 120.0f, "White Shiny" });
+    // Gold (different shading properties)
+    materials.push_back({ {0.24725f,0.1995f,0.0745f,1.0f}, {0.75164f,0.60648f,0.22648f,1.0f}, {0.628281f,0.555802f,0.366065f,1.0f}, 51.2f, "Gold" });
+    // Required red high-specular material (matches assignment)
+    materials.push_back({ {0.6f,0.2f,0.2f,1.0f}, {0.9f,0.1f,0.1f,1.0f}, {0.8f,0.8f,0.8f,1.0f}, 80.0f, "Red Bright Spec" });
+}
+
+// -------- View parameters --------
+void cameraMatrices(const ViewParams &vp, Mat4 &proj, Mat4 &view){
+    float aspect = (vp.height==0) ? 1.0f : (float)vp.width / (float)vp.height;
+    if(vp.perspective) proj = mat4Perspective(60.0f, aspect, CAMERA_NEAR, CAMERA_FAR);
+    else { float s=1.8f; proj = mat4Ortho(-s*aspect, s*aspect, -s, s, CAMERA_NEAR, CAMERA_FAR); }
+    Vec3 eye(vp.camRadius * cosf(vp.camAngle), vp.camRadius * sinf(vp.camAngle), vp.camHeight);
+    view = mat4LookAt(eye, Vec3(0,0,0), Vec3(0,0,1));
+}
+Mat4 modelMatrix(const MeshData &m){
+    const Vec3 &c = m.centroid; float s = m.modelScale;
+    return mat4Translate(-c.x, -c.y, -c.z) * mat4Scale(s, s, s);
+}
+
+// -------- Headless CPU rasterizer --------
+static const int SOFT_TILE = 64;
+enum SoftShade { SOFT_CONST=0, SOFT_GOURAUD=1, SOFT_PHONG=2 };
+
+// Screen-space triangle after clipping; a/b carry color (Gouraud) or eye position/normal (Phong), ao/vis the
+// occlusion attributes Phong interpolates.
+struct RasterTri { float x[3], y[3], z[3], iw[3]; Vec3 a[3], b[3]; float ao[3], vis[3]; Vec3 color; int mode; };
+struct ClipVert { float c[4]; Vec3 a, b; float ao = 1.0f, vis = 1.0f; };
+
+struct ShadeLights { Vec3 pos0, pos1; const Material* mat; };
+
+// GLSL lighting from gouraud_vs/phong_fs for one eye-space point; ao and vis are inAO/inShadow
+static Vec3 shadeTwoLights(const Vec3 &P, const Vec3 &Nin, const ShadeLights &L, float ao, float vis){
+    const Material &m = *L.mat;
+    Vec3 N = normalize(Nin), V = normalize(Vec3(-P.x, -P.y, -P.z));
+    float nl[2], s[2];
+    const Vec3* lp[2] = { &L.pos0, &L.pos1 };
+    for(int i=0;i<2;++i){
+        Vec3 Ld = normalize(*lp[i] - P);
+        nl[i] = std::max(dot(N, Ld), 0.0f);
+        Vec3 R = N * (2.0f * dot(N, Ld)) - Ld;
+        s[i] = (nl[i] > 0.0f) ? powf(std::max(dot(R, V), 0.0f), m.shininess) : 0.0f;
+    }
+    const LightColors &c0 = light0Colors, &c1 = light1Colors;
+    Vec3 col;
+    float* out = &col.x;
+    for(int k=0;k<3;++k){
+        float v = m.ambient[k] * (c0.ambient[k] + c1.ambient[k]) * ao
+                + m.diffuse[k] * (c0.diffuse[k] * nl[0] * ao + c1.diffuse[k] * nl[1] * vis)
+                + m.specular[k] * (c0.specular[k] * s[0] + c1.specular[k] * s[1] * vis);
+        out[k] = std::max(0.0f, std::min(1.0f, v));
+    }
+    return col;
+}
+
+// Fixed-function LIGHT0 with GL_COLOR_MATERIAL, as flat_fs evaluates it (no GL_NORMALIZE,
+// infinite viewer, default 0.2 global ambient).
+static Vec3 shadeFixedFunction(const Vec3 &P, const Vec3 &N, const Vec3 &color, const Vec3 &lightEye, const Material &m){
+    Vec3 VP = normalize(lightEye - P);
+    float nl = dot(N, VP);
+    Vec3 H = normalize(VP + Vec3(0,0,1));
+    float sp = (nl > 0.0f) ? powf(std::max(dot(N, H), 0.0f), m.shininess) : 0.0f;
+    const LightColors &c0 = light0Colors;
+    Vec3 col; float* out = &col.x; const float* cm = &color.x;
+    for(int k=0;k<3;++k){
+        float v = 0.2f*cm[k] + c0.ambient[k]*cm[k] + std::max(nl, 0.0f)*c0.diffuse[k]*cm[k] + sp*c0.specular[k]*m.specular[k];
+        out[k] = std::max(0.0f, std::min(1.0f, v));
+    }
+    return col;
+}
+
+static void clipTransform(const Mat4 &M, const Vec3 &p, float* c){
+    c[0] = M.m[0]*p.x + M.m[4]*p.y + M.m[8]*p.z  + M.m[12];
+    c[1] = M.m[1]*p.x + M.m[5]*p.y + M.m[9]*p.z  + M.m[13];
+    c[2] = M.m[2]*p.x + M.m[6]*p.y + M.m[10]*p.z + M.m[14];
+    c[3] = M.m[3]*p.x + M.m[7]*p.y + M.m[11]*p.z + M.m[15];
+}
+
+static ClipVert lerpClip(const ClipVert &p, const ClipVert &q, float t){
+    ClipVert r;
+    for(int k=0;k<4;++k) r.c[k] = p.c[k] + (q.c[k]-p.c[k])*t;
+    r.a = p.a + (q.a - p.a)*t; r.b = p.b + (q.b - p.b)*t;
+    r.ao = p.ao + (q.ao - p.ao)*t; r.vis = p.vis + (q.vis - p.vis)*t;
+    return r;
+}
+
+// Clips against the near plane (z >= -w), projects to window space and bins into tiles.
+static void setupTriangle(const ClipVert* in, int mode, const Vec3 &color, const SoftFramebuffer &fb, int tilesX,
+                          std::vector<RasterTri> &out, std::vector<std::vector<uint32_t>> &bins){
+    for(int plane=0; plane<4; ++plane){   // trivial reject against the x/y sides of the frustum
+        int axis = plane >> 1, outside = 0;
+        for(int i=0;i<3;++i){ float c = in[i].c[axis], w = in[i].c[3]; if((plane & 1) ? (c < -w) : (c > w)) ++outside; }
+        if(outside == 3) return;
+    }
+    ClipVert poly[4]; int n = 0;
+    for(int i=0;i<3;++i){
+        const ClipVert &p = in[i], &q = in[(i+1)%3];
+        float dp = p.c[2] + p.c[3], dq = q.c[2] + q.c[3];
+        if(dp >= 0) poly[n++] = p;
+        if((dp >= 0) != (dq >= 0) && n < 4) poly[n++] = lerpClip(p, q, dp / (dp - dq));
+    }
+    for(int k=1; k+1<n; ++k){
+        const ClipVert* v[3] = { &poly[0], &poly[k], &poly[k+1] };
+        RasterTri t; t.mode = mode; t.color = color;
+        for(int i=0;i<3;++i){
+            float iw = 1.0f / v[i]->c[3];
+            t.x[i] = (v[i]->c[0]*iw*0.5f + 0.5f) * fb.width;
+            t.y[i] = (v[i]->c[1]*iw*0.5f + 0.5f) * fb.height;
+            t.z[i] = v[i]->c[2]*iw*0.5f + 0.5f;
+            t.iw[i] = iw; t.a[i] = v[i]->a; t.b[i] = v[i]->b; t.ao[i] = v[i]->ao; t.vis[i] = v[i]->vis;
+        }
+        float area = (t.x[1]-t.x[0])*(t.y[2]-t.y[0]) - (t.y[1]-t.y[0])*(t.x[2]-t.x[0]);
+        if(!(area != 0.0f)) continue;   // degenerate or NaN
+        if(area < 0){   // no face culling in drawMesh(); make every triangle counter-clockwise
+            std::swap(t.x[1],t.x[2]); std::swap(t.y[1],t.y[2]); std::swap(t.z[1],t.z[2]);
+            std::swap(t.iw[1],t.iw[2]); std::swap(t.a[1],t.a[2]); std::swap(t.b[1],t.b[2]);
+            std::swap(t.ao[1],t.ao[2]); std::swap(t.vis[1],t.vis[2]);
+        }
+        float minx = std::min(t.x[0], std::min(t.x[1], t.x[2])), maxx = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+        float miny = std::min(t.y[0], std::min(t.y[1], t.y[2])), maxy = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+        if(maxx < 0 || maxy < 0 || minx >= fb.width || miny >= fb.height) continue;
+        int tx0 = std::max(0, (int)minx / SOFT_TILE), tx1 = std::min(tilesX-1, (int)std::min(maxx, (float)fb.width-1) / SOFT_TILE);
+        int ty0 = std::max(0, (int)miny / SOFT_TILE), ty1 = std::min(fb.rows/SOFT_TILE-1, (int)std::min(maxy, (float)fb.height-1) / SOFT_TILE);
+        uint32_t id = (uint32_t)out.size();
+        out.push_back(t);
+        for(int ty=ty0; ty<=ty1; ++ty) for(int tx=tx0; tx<=tx1; ++tx) bins[ty*tilesX + tx].push_back(id);
+    }
+}
+
+// Edge-function coverage and depth for 4 pixels at a time; lighting runs per covered lane.
+static void rasterTileTri(const RasterTri &t, int tx0, int ty0, SoftFramebuffer &fb, const ShadeLights &L){
+    float minx = std::min(t.x[0], std::min(t.x[1], t.x[2])), maxx = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+    float miny = std::min(t.y[0], std::min(t.y[1], t.y[2])), maxy = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+    int x0 = std::max(tx0, (int)floorf(minx - 0.5f)), x1 = std::min(tx0 + SOFT_TILE - 1, (int)ceilf(maxx));
+    int y0 = std::max(ty0, (int)floorf(miny - 0.5f)), y1 = std::min(ty0 + SOFT_TILE - 1, (int)ceilf(maxy));
+    if(x0 > x1 || y0 > y1) return;
+    x0 = tx0 + ((x0 - tx0) & ~3);
+    // e_i(p) = A_i*x + B_i*y + C_i is the weight of vertex i
+    float A[3], B[3], C[3];
+    for(int i=0;i<3;++i){
+        int j = (i+1)%3, k = (i+2)%3;
+        A[i] = -(t.y[k] - t.y[j]); B[i] = t.x[k] - t.x[j];
+        C[i] = (t.y[k] - t.y[j]) * t.x[j] - (t.x[k] - t.x[j]) * t.y[j];
+    }
+    float invArea = 1.0f / ((t.x[1]-t.x[0])*(t.y[2]-t.y[0]) - (t.y[1]-t.y[0])*(t.x[2]-t.x[0]));
+    F4 zero = f4(0.0f), one = f4(1.0f), ia = f4(invArea);
+    F4 z0 = f4(t.z[0]), dz1 = f4(t.z[1]-t.z[0]), dz2 = f4(t.z[2]-t.z[0]);
+    F4 iw0 = f4(t.iw[0]), iw1 = f4(t.iw[1]), iw2 = f4(t.iw[2]);
+    for(int y=y0; y<=y1; ++y){
+        float py = y + 0.5f;
+        F4 r0 = f4(B[0]*py + C[0]), r1 = f4(B[1]*py + C[1]), r2 = f4(B[2]*py + C[2]);
+        float* zrow = &fb.depth[(size_t)y*fb.stride];
+        uint8_t* crow = &fb.rgb[(size_t)y*fb.stride*3];
+        for(int x=x0; x<=x1; x+=4){
+            F4 px = f4ramp(x + 0.5f);
+            F4 w0 = f4(A[0])*px + r0, w1 = f4(A[1])*px + r1, w2 = f4(A[2])*px + r2;
+            M4 m = f4ge(w0, zero) & f4ge(w1, zero) & f4ge(w2, zero);
+            if(!m4bits(m)) continue;
+            F4 l1 = w1*ia, l2 = w2*ia, l0 = one - l1 - l2;
+            F4 z = z0 + l1*dz1 + l2*dz2;
+            F4 zb = f4load(zrow + x);
+            m = m & f4lt(z, zb) & f4ge(z, zero) & f4ge(one, z);
+            int bits = m4bits(m);
+            if(!bits) continue;
+            f4store(zrow + x, f4select(m, z, zb));
+            // perspective-correct barycentrics
+            F4 q0 = l0*iw0, q1 = l1*iw1, q2 = l2*iw2;
+            float b0[4], b1[4], b2[4];
+            f4lanes(q0, b0); f4lanes(q1, b1); f4lanes(q2, b2);
+            for(int lane=0; lane<4; ++lane){
+                if(!(bits & (1<<lane))) continue;
+                float s = 1.0f / (b0[lane] + b1[lane] + b2[lane]);
+                float u0 = b0[lane]*s, u1 = b1[lane]*s, u2 = b2[lane]*s;
+                Vec3 col;
+                if(t.mode == SOFT_CONST) col = t.color;
+                else if(t.mode == SOFT_GOURAUD) col = t.a[0]*u0 + t.a[1]*u1 + t.a[2]*u2;
+                else col = shadeTwoLights(t.a[0]*u0 + t.a[1]*u1 + t.a[2]*u2, t.b[0]*u0 + t.b[1]*u1 + t.b[2]*u2, L,
+                                          t.ao[0]*u0 + t.ao[1]*u1 + t.ao[2]*u2, t.vis[0]*u0 + t.vis[1]*u1 + t.vis[2]*u2);
+                uint8_t* c = crow + (size_t)(x+lane)*3;
+                c[0] = (uint8_t)(std::max(0.0f, std::min(1.0f, col.x))*255.0f + 0.5f);
+                c[1] = (uint8_t)(std::max(0.0f, std::min(1.0f, col.y))*255.0f + 0.5f);
+                c[2] = (uint8_t)(std::max(0.0f, std::min(1.0f, col.z))*255.0f + 0.5f);
+            }
+        }
+    }
+}
+
+// Renders `mesh` plus the light1 marker cube; `workers` threads share the vertex, setup and tile passes.
+void renderSoftware(MeshData &mesh, const ViewParams &vp, SoftFramebuffer &fb, unsigned workers){
+    ensureCPUMesh(mesh);
+    fb.width = vp.width; fb.height = vp.height;
+    int tilesX = (vp.width + SOFT_TILE - 1) / SOFT_TILE, tilesY = (vp.height + SOFT_TILE - 1) / SOFT_TILE;
+    fb.stride = tilesX * SOFT_TILE; fb.rows = tilesY * SOFT_TILE;
+    fb.depth.assign((size_t)fb.stride * fb.rows, 1.0f);
+    fb.rgb.resize((size_t)fb.stride * fb.rows * 3);
+    const uint8_t bg = (uint8_t)(0.06f*255.0f + 0.5f);
+    memset(fb.rgb.data(), bg, fb.rgb.size());
+
+    Mat4 proj, view;
+    cameraMatrices(vp, proj, view);
+    Mat4 mv = view * modelMatrix(mesh);
+    Mat4 mvp = proj * mv;
+    const Material &mat = materials[vp.materialIndex];
+    Vec3 light1Obj = cylinderLightPos(vp.lightAngle, vp.lightRadius, vp.lightHeight);
+    ShadeLights L = { Vec3(light0PosEye[0], light0PosEye[1], light0PosEye[2]), transformPoint(mv, light1Obj), &mat };
+    int mode = vp.shadeMode == 1 ? SOFT_CONST : vp.shadeMode == 2 ? SOFT_GOURAUD : SOFT_PHONG;
+    if(workers < 1) workers = 1;
+
+    // occlusion attributes, as drawMesh() binds them
+    const uint8_t* ao = meshView(mesh).ao;
+    std::vector<uint8_t> vis;
+    if(shadowsEnabled && mode != SOFT_CONST) traceLightVisibility(meshView(mesh), mesh.modelScale, mesh.bvh, light1Obj, workers, vis);
+
+    // vertex pass; normalMatrix is the upper 3x3 of the modelview, as setCommonUniforms() uploads it
+    std::vector<ClipVert> cv(mesh.vertices.size());
+    parallelRanges(mesh.vertices.size(), workers, [&](size_t b, size_t e, unsigned){
+        for(size_t i=b;i<e;++i){
+            const Vertex &v = mesh.vertices[i]; ClipVert &o = cv[i];
+            clipTransform(mvp, v.p, o.c);
+            if(mode == SOFT_CONST) continue;
+            if(ao) o.ao = ao[i] / 255.0f;
+            if(!vis.empty()) o.vis = vis[i] / 255.0f;
+            Vec3 pe = transformPoint(mv, v.p), ne = normalize(transformDir(mv, v.n));
+            if(mode == SOFT_GOURAUD) o.a = shadeTwoLights(pe, ne, L, o.ao, o.vis);
+            else { o.a = pe; o.b = ne; }
+        }
+    });
+
+    // flat mode: fixed-function light0 was positioned under the view matrix, normals go through the inverse transpose
+    Vec3 light0Flat = transformPoint(view, L.pos0);
+    Mat4 nrm = mat4NormalMatrix(mv);
+
+    // setup & binning, one output list per worker so no locking is needed
+    size_t nTiles = (size_t)tilesX * tilesY;
+    std::vector<std::vector<RasterTri>> tris(workers);
+    std::vector<std::vector<std::vector<uint32_t>>> bins(workers, std::vector<std::vector<uint32_t>>(nTiles));
+    parallelRanges(mesh.triangles.size(), workers, [&](size_t b, size_t e, unsigned w){
+        tris[w].reserve((e-b) + (e-b)/8);
+        for(size_t i=b;i<e;++i){
+            const Tri &t = mesh.triangles[i];
+            ClipVert in[3] = { cv[t.a], cv[t.b], cv[t.c] };
+            Vec3 color;
+            if(mode == SOFT_CONST){
+                Vec3 fn = normalize(t.fn);
+                Vec3 base(fabsf(fn.x), fabsf(fn.y), fabsf(fn.z));
+                // GL_FLAT takes the provoking (last) vertex
+                color = shadeFixedFunction(transformPoint(mv, mesh.vertices[t.c].p), transformDir(nrm, fn), base, light0Flat, mat);
+            }
+            setupTriangle(in, mode, color, fb, tilesX, tris[w], bins[w]);
+        }
+    });
+    // light marker: unlit glutSolidCube(1.0) scaled by 0.03/modelScale at light1_obj
+    {
+        float k = 0.03f / mesh.modelScale;
+        Mat4 cubeM = proj * mv * mat4Translate(light1Obj.x, light1Obj.y, light1Obj.z) * mat4Scale(k, k, k);
+        static const int faces[6][4] = { {0,1,3,2}, {4,6,7,5}, {0,4,5,1}, {2,3,7,6}, {0,2,6,4}, {1,5,7,3} };
+        ClipVert corner[8];
+        for(int i=0;i<8;++i) clipTransform(cubeM, Vec3((i&1)?0.5f:-0.5f, (i&2)?0.5f:-0.5f, (i&4)?0.5f:-0.5f), corner[i].c);
+        for(auto &f : faces){
+            ClipVert q0[3] = { corner[f[0]], corner[f[1]], corner[f[2]] }, q1[3] = { corner[f[0]], corner[f[2]], corner[f[3]] };
+            setupTriangle(q0, SOFT_CONST, Vec3(1.0f,0.6f,0.2f), fb, tilesX, tris[workers-1], bins[workers-1]);
+            setupTriangle(q1, SOFT_CONST, Vec3(1.0f,0.6f,0.2f), fb, tilesX, tris[workers-1], bins[workers-1]);
+        }
+    }
+
+    // raster: threads pull tiles; within a tile triangles keep submission order
+    std::atomic<size_t> nextTile(0);
+    auto rasterWorker = [&](){
+        for(size_t tile; (tile = nextTile.fetch_add(1)) < nTiles; ){
+            int tx0 = (int)(tile % tilesX) * SOFT_TILE, ty0 = (int)(tile / tilesX) * SOFT_TILE;
+            for(unsigned w=0; w<workers; ++w)
+                for(uint32_t id : bins[w][tile]) rasterTileTri(tris[w][id], tx0, ty0, fb, L);
+        }
+    };
+    std::vector<std::thread> pool;
+    for(unsigned w=1; w<workers; ++w) pool.emplace_back(rasterWorker);
+    rasterWorker();
+    for(auto &t : pool) t.join();
+}
+
+// Binary PPM, top row first (the framebuffer is bottom-up like GL)
+bool writePPM(const std::string &path, const SoftFramebuffer &fb){
+    FILE* f = fopen(path.c_str(), "wb");
+    if(!f){ std::cerr << "Cannot write " << path << "\n"; return false; }
+    fprintf(f, "P6\n%d %d\n255\n", fb.width, fb.height);
+    bool ok = true;
+    for(int y=fb.height-1; y>=0 && ok; --y) ok = fwrite(&fb.rgb[(size_t)y*fb.stride*3], 3, fb.width, f) == (size_t)fb.width;
+    ok = (fclose(f) == 0) && ok;
+    if(!ok) std::cerr << "Cannot write " << path << "\n";
+    return ok;
+}
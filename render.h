@@ -0,0 +1,108 @@
+// render.h
+// CPU-side rendering shared by the GLUT viewer and MeshRender: 4x4 matrices, the materials and lights, the camera
+// (ViewParams) and the tile-based software rasterizer behind --render, --sweep and --headless.
+// Nothing here touches GL or GLUT.
+#pragma once
+
+#include "mesh.h"
+#include <vector>
+#include <string>
+
+// -------- Math helpers --------
+// Column-major 4x4 matrix, same memory layout as glGetFloatv/glLoadMatrixf.
+struct Mat4 { float m[16]; };
+inline Mat4 mat4Identity(){ Mat4 r; for(int i=0;i<16;++i) r.m[i] = (i%5==0) ? 1.0f : 0.0f; return r; }
+inline Mat4 operator*(const Mat4&a,const Mat4&b){
+    Mat4 r;
+    for(int c=0;c<4;++c) for(int row=0;row<4;++row){
+        float s=0; for(int k=0;k<4;++k) s += a.m[k*4+row]*b.m[c*4+k]; r.m[c*4+row]=s;
+    }
+    return r;
+}
+inline Vec3 transformPoint(const Mat4&M,const Vec3&p){ return Vec3(M.m[0]*p.x+M.m[4]*p.y+M.m[8]*p.z+M.m[12], M.m[1]*p.x+M.m[5]*p.y+M.m[9]*p.z+M.m[13], M.m[2]*p.x+M.m[6]*p.y+M.m[10]*p.z+M.m[14]); }
+inline Vec3 transformDir(const Mat4&M,const Vec3&d){ return Vec3(M.m[0]*d.x+M.m[4]*d.y+M.m[8]*d.z, M.m[1]*d.x+M.m[5]*d.y+M.m[9]*d.z, M.m[2]*d.x+M.m[6]*d.y+M.m[10]*d.z); }
+// Inverse transpose of the upper 3x3 (what fixed-function GL applies to glNormal without GL_NORMALIZE).
+inline Mat4 mat4NormalMatrix(const Mat4&mv){
+    const float* M = mv.m;
+    float det = M[0]*(M[5]*M[10]-M[9]*M[6]) - M[4]*(M[1]*M[10]-M[9]*M[2]) + M[8]*(M[1]*M[6]-M[5]*M[2]);
+    float id = (det != 0.0f) ? 1.0f/det : 0.0f;
+    Mat4 nrm = mat4Identity();
+    nrm.m[0] = (M[5]*M[10]-M[6]*M[9])*id; nrm.m[4] = (M[2]*M[9]-M[1]*M[10])*id; nrm.m[8]  = (M[1]*M[6]-M[2]*M[5])*id;
+    nrm.m[1] = (M[6]*M[8]-M[4]*M[10])*id; nrm.m[5] = (M[0]*M[10]-M[2]*M[8])*id; nrm.m[9]  = (M[2]*M[4]-M[0]*M[6])*id;
+    nrm.m[2] = (M[4]*M[9]-M[5]*M[8])*id;  nrm.m[6] = (M[1]*M[8]-M[0]*M[9])*id;  nrm.m[10] = (M[0]*M[5]-M[1]*M[4])*id;
+    return nrm;
+}
+inline Mat4 mat4Translate(float x,float y,float z){ Mat4 r=mat4Identity(); r.m[12]=x; r.m[13]=y; r.m[14]=z; return r; }
+inline Mat4 mat4Scale(float x,float y,float z){ Mat4 r=mat4Identity(); r.m[0]=x; r.m[5]=y; r.m[10]=z; return r; }
+// gluPerspective / glOrtho / gluLookAt equivalents
+inline Mat4 mat4Perspective(float fovyDeg,float aspect,float n,float f){
+    Mat4 r; for(float &v : r.m) v=0;
+    float c = 1.0f / tanf(fovyDeg * 3.14159265358979f / 360.0f);
+    r.m[0]=c/aspect; r.m[5]=c; r.m[10]=(f+n)/(n-f); r.m[11]=-1.0f; r.m[14]=2.0f*f*n/(n-f);
+    return r;
+}
+inline Mat4 mat4Ortho(float l,float rt,float b,float t,float n,float f){
+    Mat4 r=mat4Identity();
+    r.m[0]=2.0f/(rt-l); r.m[5]=2.0f/(t-b); r.m[10]=-2.0f/(f-n);
+    r.m[12]=-(rt+l)/(rt-l); r.m[13]=-(t+b)/(t-b); r.m[14]=-(f+n)/(f-n);
+    return r;
+}
+inline Mat4 mat4LookAt(const Vec3&eye,const Vec3&center,const Vec3&up){
+    Vec3 f = normalize(center - eye);
+    Vec3 s = normalize(cross(f, up));
+    Vec3 u = cross(s, f);
+    Mat4 r=mat4Identity();
+    r.m[0]=s.x; r.m[4]=s.y; r.m[8]=s.z;
+    r.m[1]=u.x; r.m[5]=u.y; r.m[9]=u.z;
+    r.m[2]=-f.x; r.m[6]=-f.y; r.m[10]=-f.z;
+    return r * mat4Translate(-eye.x, -eye.y, -eye.z);
+}
+
+// -------- Materials --------
+struct Material {
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    float shininess;
+    std::string name;
+};
+extern std::vector<Material> materials;
+void initMaterials();
+
+// -------- Lights --------
+// Light0 sits near the eye; light1 orbits the model on a cylinder (lightAngle/lightRadius/lightHeight).
+struct LightColors { float ambient[4]; float diffuse[4]; float specular[4]; };
+static const LightColors light0Colors = { {0.2f,0.2f,0.2f,1.0f}, {0.6f,0.6f,0.6f,1.0f}, {1.0f,1.0f,1.0f,1.0f} };
+static const LightColors light1Colors = { {0.0f,0.0f,0.0f,1.0f}, {0.8f,0.5f,0.2f,1.0f}, {0.8f,0.8f,0.8f,1.0f} };
+static const float light0PosEye[3] = { 0.0f, 0.0f, 1.5f };
+inline Vec3 cylinderLightPos(float angle, float radius, float height){ return Vec3(radius * cosf(angle), radius * sinf(angle), height); }
+
+// -------- View parameters --------
+// Snapshot of everything a frame depends on, so frames can be rendered without touching the UI globals.
+struct ViewParams {
+    float camAngle, camRadius, camHeight;
+    bool perspective;
+    int shadeMode, materialIndex;
+    float lightAngle, lightRadius, lightHeight;
+    int width, height;
+};
+// Same projection and eye placement that setupCamera() hands to GLU.
+static const float CAMERA_NEAR = 0.1f, CAMERA_FAR = 50.0f;
+void cameraMatrices(const ViewParams &vp, Mat4 &proj, Mat4 &view);
+// drawMesh(): glTranslatef(-centroid) then glScalef(modelScale)
+Mat4 modelMatrix(const MeshData &m);
+
+// -------- Headless CPU rasterizer --------
+// Tile-based software path reproducing drawMesh(): flat mode mirrors flat_fs (fixed-function LIGHT0 semantics,
+// lit at the provoking vertex), Gouraud/Phong mirror gouraud_vs/phong_fs. Used where there is no GL context
+// (--render, --sweep, --headless and MeshRender).
+struct SoftFramebuffer {
+    int width=0, height=0, stride=0, rows=0;   // stride/rows are padded up to whole tiles
+    std::vector<float> depth;
+    std::vector<uint8_t> rgb;
+};
+
+// Renders `mesh` plus the light1 marker cube; `workers` threads share the vertex, setup and tile passes.
+void renderSoftware(MeshData &mesh, const ViewParams &vp, SoftFramebuffer &fb, unsigned workers);
+// Binary PPM, top row first (the framebuffer is bottom-up like GL)
+bool writePPM(const std::string &path, const SoftFramebuffer &fb);